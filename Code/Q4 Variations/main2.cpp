@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <time.h>
 #include "E101.h"
+#include "../gate_monitor.h"
 
 const int INITIAL_QUADRANT = 1; //Use this to skip quadrants when testing.
 
@@ -56,6 +57,9 @@ char       IP[]           = "130.195.6.196"; //If set to "const", the compiler w
 const int  PORT           = 1024;
 const int  GATE_TIMER     = 1500000; //Microseconds
 const int  GATE2_DISTANCE = 160; //#todo find out what value to use.
+const int  GATE_SAMPLE_US    = 5000;     //Sampling period of the gate monitor (200 Hz).
+const int  GATE_HYSTERESIS   = 20;       //Gate counts as open again only below GATE2_DISTANCE - GATE_HYSTERESIS.
+const long GATE_WAIT_TIMEOUT = 20000000; //Microseconds. Longest wait for the gate before the fallback.
 
 //Fields
 int lum_threshold;
@@ -541,14 +545,16 @@ int main(){
         if (isRedLine()){
             set_motor(L_MOTOR,0);
             set_motor(R_MOTOR,0);
-            while(readAnalogSensor(F_SENSOR, 5).average < GATE2_DISTANCE) {
-                //Wait for the gate to close.
-                //=== Do nothing ===
-            }
-            while(readAnalogSensor(F_SENSOR, 5).average >= GATE2_DISTANCE) {
-                //After the gate is closed, wait for it to open again.
-                //=== Do nothing ===
+            //Wait for the gate to close, and after that for it to open again.
+            //The monitor samples the sensor in its own thread, so this doesn't spin on the ADC.
+            GateMonitor gate_monitor;
+            startGateMonitor(&gate_monitor, F_SENSOR, GATE_READINGS, GATE_SAMPLE_US, GATE2_DISTANCE, GATE2_DISTANCE - GATE_HYSTERESIS);
+            if (!waitForGateOpening(&gate_monitor, GATE_WAIT_TIMEOUT)){
+                //Fallback: no closed -> open edge was seen. Go as soon as the way is clear.
+                while(readAnalogSensor(F_SENSOR, GATE_READINGS).average >= GATE2_DISTANCE - GATE_HYSTERESIS)
+                    sleep1(0, GATE_SAMPLE_US);
             }
+            stopGateMonitor(&gate_monitor);
             usleep(GATE_TIMER); //Wait just a little more to avoid a collision with a partially open gate.
         }
         
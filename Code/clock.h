@@ -0,0 +1,151 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <time.h>
+#include <errno.h>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <set>
+
+//Source of time for every sleep, timeout and derivative in the program.
+//The default is CLOCK_MONOTONIC. The simulator swaps in a VirtualClock, so the same code
+//runs a lap in a fraction of the real time: virtual time stands still while any thread
+//is working and jumps to the next wake-up as soon as all of them are asleep.
+//
+//Code that has to block for some time must do it through clockSleepUntil() (or something
+//built on it, like waitForTick()). Blocking on anything else while another thread sleeps on
+//the clock would stop time, so threads are joined through clockJoin(). A thread started
+//with attach() keeps its place until it is joined: it doesn't detach on its way out.
+
+//Interface of a clock.
+class ClockSource{
+public:
+    virtual ~ClockSource(){}
+    virtual void now(struct timespec *t) = 0;
+    virtual void sleepUntil(const struct timespec *deadline) = 0;
+    //A new thread that will sleep on the clock. Called by the parent, before starting it, or
+    //before handing work to a thread that detaches when it is done (see PictureCopier).
+    virtual void attach(){}
+    //The calling thread won't sleep on the clock any more (it is about to block).
+    virtual void detach(){}
+    virtual bool isVirtual(){ return false; }
+};
+
+//Real time.
+class MonotonicClock : public ClockSource{
+public:
+    void now(struct timespec *t){
+        clock_gettime(CLOCK_MONOTONIC, t);
+    }
+
+    void sleepUntil(const struct timespec *deadline){
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL) == EINTR){
+            //Interrupted by a signal: go back to sleep until the same deadline.
+        }
+    }
+};
+
+//Discrete-event clock. It counts the threads that use it (the main thread from the start)
+//and keeps the deadline of each one that is asleep. When the last one goes to sleep, time
+//jumps to the earliest deadline and the threads due then are woken.
+class VirtualClock : public ClockSource{
+public:
+    std::mutex                mutex;
+    std::condition_variable   woken;
+    long long                 now_ns;
+    int                       threads;  //Threads that can sleep on the clock.
+    std::multiset<long long>  sleeping; //Deadlines of the threads asleep.
+    long                      jumps;    //Times time moved.
+
+    VirtualClock(){
+        now_ns   = 0;
+        threads  = 1;
+        jumps    = 0;
+    }
+
+    void now(struct timespec *t){
+        std::lock_guard<std::mutex> lock(mutex);
+        t->tv_sec  = now_ns/1000000000LL;
+        t->tv_nsec = now_ns%1000000000LL;
+    }
+
+    void sleepUntil(const struct timespec *deadline){
+        long long wake_ns = deadline->tv_sec*1000000000LL + deadline->tv_nsec;
+        std::unique_lock<std::mutex> lock(mutex);
+        if (wake_ns <= now_ns)
+            return;
+        sleeping.insert(wake_ns);
+        advance();
+        woken.wait(lock, [this, wake_ns]{ return now_ns >= wake_ns; });
+    }
+
+    void attach(){
+        std::lock_guard<std::mutex> lock(mutex);
+        threads++;
+    }
+
+    void detach(){
+        std::lock_guard<std::mutex> lock(mutex);
+        threads--;
+        advance();
+    }
+
+    bool isVirtual(){ return true; }
+
+private:
+    //Moves time to the earliest deadline if nobody is awake. Needs the mutex.
+    void advance(){
+        if (sleeping.empty() || (int)sleeping.size() < threads)
+            return;
+        now_ns = *sleeping.begin();
+        sleeping.erase(sleeping.begin(), sleeping.upper_bound(now_ns));
+        jumps++;
+        woken.notify_all();
+    }
+};
+
+//Returns the clock in use. Only change it before any thread is started.
+inline ClockSource *&clockSource(){
+    static MonotonicClock monotonic;
+    static ClockSource   *source = &monotonic;
+    return source;
+}
+
+inline void setClockSource(ClockSource *source){
+    clockSource() = source;
+}
+
+inline void clockNow(struct timespec *t){
+    clockSource()->now(t);
+}
+
+inline void clockSleepUntil(const struct timespec *deadline){
+    clockSource()->sleepUntil(deadline);
+}
+
+//Sleeps for usec microseconds. Replaces usleep().
+inline void clockSleep(long usec){
+    struct timespec deadline;
+    clockNow(&deadline);
+    deadline.tv_sec  += usec/1000000;
+    deadline.tv_nsec += (usec%1000000)*1000;
+    if (deadline.tv_nsec >= 1000000000L){
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    clockSleepUntil(&deadline);
+}
+
+//Joins a thread that sleeps on the clock. The caller stops counting as a sleeper while it
+//waits, so virtual time keeps moving for the thread it waits for, and then takes over the
+//place of that thread. Detaching at the end of the thread instead would let time run on for
+//the other threads until the caller gets back.
+inline void clockJoin(std::thread *thread){
+    if (!thread->joinable())
+        return;
+    clockSource()->detach();
+    thread->join();
+}
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+#include <time.h>
+#include <exception>
+#include <coroutine>
+#include "hal.h"
+#include "scheduler.h"
+
+//Cooperative coroutine tasks for behaviours that read best as a sequence of steps.
+//A task is written like the old blocking code, but instead of sleeping or spinning on a
+//sensor it co_awaits one of the awaitables below. Whoever owns the task calls stepTask()
+//once per tick; the task only resumes when what it is waiting for has happened, so the
+//rest of the tick (sensors, vision, telemetry) keeps running in between.
+//Needs C++20 (g++ 10 with -fcoroutines, or g++ 11 and later).
+
+//What a suspended task is waiting for.
+enum WakeKind{
+    WAKE_NEXT_TICK,    //Resume on the next step.
+    WAKE_SENSOR_BELOW, //Resume when read_analog(channel) < threshold.
+    WAKE_TIME          //Resume once the clock reaches deadline.
+};
+
+//Structure to store the condition a task is waiting for.
+struct WakeCondition{
+    WakeKind        kind;
+    int             channel;
+    int             threshold;
+    struct timespec deadline;
+};
+
+//Checks the condition. Called once per step.
+//Pictures aren't awaited here: they go through takePicture() in main.cpp, which records and
+//numbers them, and the owner of the task takes them as part of its tick.
+inline bool wakeConditionMet(const WakeCondition *condition){
+    switch (condition->kind){
+        case WAKE_SENSOR_BELOW:
+            return HAL::read_analog(condition->channel) < condition->threshold;
+        case WAKE_TIME: {
+            struct timespec now;
+            clockNow(&now);
+            return diffNanoseconds(&now, &condition->deadline) >= 0;
+        }
+        default:
+            return true;
+    }
+}
+
+//Coroutine type of a behaviour.
+struct Task{
+    struct promise_type{
+        WakeCondition wake;
+
+        Task get_return_object(){
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void(){}
+        void unhandled_exception(){ std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+
+    Task() : handle(nullptr) {}
+    explicit Task(std::coroutine_handle<promise_type> h) : handle(h) {
+        handle.promise().wake.kind = WAKE_NEXT_TICK;
+    }
+    Task(Task &&other) noexcept : handle(other.handle) { other.handle = nullptr; }
+    Task &operator=(Task &&other) noexcept {
+        if (this != &other){
+            if (handle)
+                handle.destroy();
+            handle       = other.handle;
+            other.handle = nullptr;
+        }
+        return *this;
+    }
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+    ~Task(){
+        if (handle)
+            handle.destroy();
+    }
+};
+
+//Resumes the task if what it waits for has happened. Returns true once the task has finished.
+inline bool stepTask(Task *task){
+    if (!task->handle || task->handle.done())
+        return true;
+    if (!wakeConditionMet(&task->handle.promise().wake))
+        return false;
+    task->handle.resume();
+    return task->handle.done();
+}
+
+//Awaitable that stores its wake condition in the promise of the suspended task.
+struct WakeAwaiter{
+    WakeCondition condition;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<Task::promise_type> handle) const noexcept {
+        handle.promise().wake = condition;
+    }
+    void await_resume() const noexcept {}
+};
+
+//co_await yieldTick(): gives the rest of this tick back.
+inline WakeAwaiter yieldTick(){
+    WakeAwaiter awaiter = {{WAKE_NEXT_TICK, 0, 0, {0, 0}}};
+    return awaiter;
+}
+
+//co_await sensorBelow(F_SENSOR, x): waits until the analog reading drops below x.
+inline WakeAwaiter sensorBelow(int channel, int threshold){
+    WakeAwaiter awaiter = {{WAKE_SENSOR_BELOW, channel, threshold, {0, 0}}};
+    return awaiter;
+}
+
+//co_await sleepFor(us): waits at least us microseconds.
+inline WakeAwaiter sleepFor(int64_t duration_us){
+    WakeAwaiter awaiter = {{WAKE_TIME, 0, 0, {0, 0}}};
+    clockNow(&awaiter.condition.deadline);
+    addNanoseconds(&awaiter.condition.deadline, duration_us*NSEC_PER_USEC);
+    return awaiter;
+}
+
+#endif
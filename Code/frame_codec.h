@@ -0,0 +1,635 @@
+#ifndef FRAME_CODEC_H
+#define FRAME_CODEC_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "clock.h"
+#include "frame_recorder.h"
+#include "scheduler.h"
+
+//Compressed frame logs: a stream of frames, each a FrameRecord followed by its picture,
+//encoded to fit many runs on the SD card.
+//
+//A picture is coded one plane at a time (R, G and B, or the luminance), as the difference
+//with the previous picture (delta frame) or with the pixel on the left (key frame, every
+//keyframe_interval frames, so a stream can be read from any key frame). The camera library
+//works the luminance out as the mean of R, G and B, so a colour stream doesn't keep it.
+//The differences are then Rice coded, RICE_BLOCK at a time: the camera noise leaves small
+//differences, which take a few bits each, and the black background and the parts of the
+//picture that didn't change take 4 bits per block. A frame the coding would make bigger is
+//stored as it is, so a frame never takes more than its raw size plus its FramePacket.
+//
+//A tolerance above the camera noise (about 25) lets the coding ignore the noise: it changes
+//no component by more than the tolerance, and with the components after the first predicted
+//from the change of the first (FRAME_CROSS) the dark background collapses to 4 bits per block.
+//The rows and columns given as FrameExactLines, the ones the control code reads, are kept
+//without loss and coded after the others, so a replay of such a stream still makes the same
+//decisions. A tolerance of 0 keeps every pixel, noise included. A luminance stream is smaller
+//but loses the colours (the red lines).
+//
+//Rice code of a block: 4 bits b, then for every difference d, zigzagged to v (0, -1, 1, -2
+//... become 0, 1, 2, 3 ...):
+//    b <  RICE_RAW    v >> b zeros, a one, and the b low bits of v;
+//    b == RICE_RAW    the 8 bits of v;
+//    b == RICE_ZEROS  nothing, every difference is 0.
+//Streams of version 1 were run-length coded instead (FRAME_RLE): a control byte c, then
+//    c <  128  c + 1 bytes, copied as they are;
+//    c >= 128  one byte, repeated c - 128 + RLE_MIN_RUN times.
+
+const char     FRAME_STREAM_MAGIC[8] = {'F', 'R', 'A', 'M', 'E', 'Z', 'I', 'P'};
+const uint32_t FRAME_STREAM_VERSION  = 3;
+const int      RLE_MIN_RUN           = 3;
+const int      RLE_MAX_LITERAL       = 128;
+const int      RICE_BLOCK            = 64;     //Differences coded with the same parameter.
+const uint32_t RICE_MAX_PARAMETER    = 7;
+const uint32_t RICE_RAW              = 8;
+const uint32_t RICE_ZEROS            = 9;
+const int      FRAME_EXACT_LINES     = 8;      //Most rows, and most columns, kept without loss.
+const int      ENCODE_QUEUE          = 8;      //Frames waiting for the encoder before new ones are dropped.
+const long     ENCODE_WAKEUP_US      = 50000;  //Longest sleep of the encoder thread.
+const size_t   STREAM_BUFFER         = 1 << 20;
+
+//Types of frame.
+const uint32_t FRAME_DELTA = 1; //Coded as the difference with the previous picture.
+const uint32_t FRAME_RLE   = 2; //Run-length coded (version 1).
+const uint32_t FRAME_RICE  = 4; //Rice coded (stored as it is otherwise).
+const uint32_t FRAME_CROSS = 8; //The components after the first predicted with the change of the first.
+
+//Structure at the start of a stream.
+struct FrameStreamHeader{
+    char     magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;          //As in capturePicture().
+    uint32_t keyframe_interval;
+    uint32_t tolerance;         //Max. error of a component. 0: lossless.
+    uint32_t reserved;
+    int64_t  start_ns;
+};
+
+//Structure following the FrameStreamHeader from version 3: the rows and columns kept without
+//loss whatever the tolerance, such as the ones the control code reads, so that a replay of a
+//lossy stream can still be exact.
+struct FrameExactLines{
+    uint32_t rows;
+    uint32_t columns;
+    uint16_t row[FRAME_EXACT_LINES];
+    uint16_t column[FRAME_EXACT_LINES];
+};
+
+//Structure following the FrameRecord of every frame in a stream.
+struct FramePacket{
+    uint32_t size;  //Bytes of coded picture that follow.
+    uint32_t type;  //FRAME_DELTA, FRAME_RLE, FRAME_RICE and FRAME_CROSS flags.
+};
+
+//Size of the code of n bytes, at most: the run-length code of version 1 or the Rice code.
+inline size_t rleBound(size_t n){
+    return n + (n + RLE_MAX_LITERAL - 1)/RLE_MAX_LITERAL;
+}
+
+inline size_t riceBound(size_t n){
+    return n + (n + 2*RICE_BLOCK - 1)/(2*RICE_BLOCK) + 1;
+}
+
+//Structure to store the bits being written, the first ones in the high bits of a byte.
+struct BitWriter{
+    uint8_t *out;
+    uint64_t bits;  //The low `count` bits are waiting to be written.
+    int      count;
+};
+
+//Writes the n low bits of value, n <= 32.
+inline void putBits(BitWriter *writer, uint32_t value, int n){
+    writer->bits   = (writer->bits << n) | value;
+    writer->count += n;
+    while (writer->count >= 8){
+        writer->count -= 8;
+        *writer->out++ = (uint8_t)(writer->bits >> writer->count);
+    }
+}
+
+//Structure to store the bits being read.
+struct BitReader{
+    const uint8_t *in;
+    const uint8_t *end;
+    uint64_t       bits;
+    int            count;
+};
+
+//Reads n bits, n <= 32. Returns false at the end of the code.
+inline bool getBits(BitReader *reader, int n, uint32_t *value){
+    while (reader->count < n){
+        if (reader->in == reader->end)
+            return false;
+        reader->bits   = (reader->bits << 8) | *reader->in++;
+        reader->count += 8;
+    }
+    reader->count -= n;
+    *value = (uint32_t)(reader->bits >> reader->count) & (uint32_t)((1ULL << n) - 1);
+    return true;
+}
+
+//A difference (mod 256) as 0, 1, 2, 3 ... for 0, -1, 1, -2 ..., so that small ones are small.
+inline uint32_t zigzag(uint8_t difference){
+    int d = (int8_t)difference;
+    return d >= 0 ? 2*d : -2*d - 1;
+}
+
+inline uint8_t unzigzag(uint32_t v){
+    return (uint8_t)((v & 1) ? -(int)((v + 1)/2) : (int)(v/2));
+}
+
+//Rice codes n bytes into out, which must have room for riceBound(n) bytes. The parameter of
+//a block is the one of LOCO-I, from the mean of the block. Returns the size of the code.
+inline size_t riceEncode(const uint8_t *in, size_t n, uint8_t *out){
+    BitWriter writer = {out, 0, 0};
+    uint32_t  values[RICE_BLOCK];
+    for (size_t start = 0; start < n; start += RICE_BLOCK){
+        uint32_t count = (uint32_t)(n - start < (size_t)RICE_BLOCK ? n - start : RICE_BLOCK);
+        uint32_t sum   = 0;
+        for (uint32_t i = 0; i < count; i++){
+            values[i] = zigzag(in[start + i]);
+            sum      += values[i];
+        }
+        if (sum == 0){
+            putBits(&writer, RICE_ZEROS, 4);
+            continue;
+        }
+        uint32_t k = 0;
+        while ((count << k) < sum && k < RICE_MAX_PARAMETER)
+            k++;
+        uint32_t bits = count*(1 + k);
+        for (uint32_t i = 0; i < count; i++)
+            bits += values[i] >> k;
+        if (bits >= 8*count){
+            putBits(&writer, RICE_RAW, 4);
+            for (uint32_t i = 0; i < count; i++)
+                putBits(&writer, values[i], 8);
+            continue;
+        }
+        putBits(&writer, k, 4);
+        for (uint32_t i = 0; i < count; i++){
+            uint32_t zeros = values[i] >> k;
+            for (; zeros >= 24; zeros -= 24)
+                putBits(&writer, 0, 24);
+            putBits(&writer, (1u << k) | (values[i] & ((1u << k) - 1)), zeros + 1 + k);
+        }
+    }
+    if (writer.count > 0)
+        putBits(&writer, 0, 8 - writer.count);
+    return writer.out - out;
+}
+
+//Decodes size bytes of Rice code into exactly n bytes. Returns false if the code is damaged.
+inline bool riceDecode(const uint8_t *in, size_t size, uint8_t *out, size_t n){
+    BitReader reader = {in, in + size, 0, 0};
+    for (size_t start = 0; start < n; start += RICE_BLOCK){
+        size_t   count = n - start < (size_t)RICE_BLOCK ? n - start : RICE_BLOCK;
+        uint32_t k;
+        if (!getBits(&reader, 4, &k) || k > RICE_ZEROS)
+            return false;
+        if (k == RICE_ZEROS){
+            memset(out + start, 0, count);
+            continue;
+        }
+        for (size_t i = 0; i < count; i++){
+            uint32_t v, bit;
+            if (k == RICE_RAW){
+                if (!getBits(&reader, 8, &v))
+                    return false;
+            }
+            else {
+                uint32_t high = 0;
+                while (true){
+                    if (!getBits(&reader, 1, &bit))
+                        return false;
+                    if (bit)
+                        break;
+                    if (++high > 255)
+                        return false;
+                }
+                if (!getBits(&reader, k, &v))
+                    return false;
+                v |= high << k;
+                if (v > 255)
+                    return false;
+            }
+            out[start + i] = unzigzag(v);
+        }
+    }
+    return true;
+}
+
+//Decodes size bytes of run-length code into exactly n bytes. Returns false if the code is damaged.
+inline bool rleDecode(const uint8_t *in, size_t size, uint8_t *out, size_t n){
+    const uint8_t *end  = in + size;
+    size_t         done = 0;
+    while (in < end){
+        uint8_t control = *in++;
+        if (control < 128){
+            size_t count = control + 1;
+            if (count > (size_t)(end - in) || done + count > n)
+                return false;
+            memcpy(out + done, in, count);
+            in   += count;
+            done += count;
+        }
+        else {
+            size_t count = control - 128 + RLE_MIN_RUN;
+            if (in == end || done + count > n)
+                return false;
+            memset(out + done, *in++, count);
+            done += count;
+        }
+    }
+    return done == n;
+}
+
+//Places the pixels in their planes: the ones on the exact lines last, so that their noise
+//doesn't spread to the Rice blocks of the others. Leaves position empty if there are no
+//lines, and returns how many pixels are kept without loss.
+inline size_t exactPositions(const FrameExactLines *exact, int width, int height, std::vector<uint32_t> *position){
+    size_t pixels = (size_t)width*height;
+    std::vector<uint8_t> on_line(pixels, 0);
+    for (uint32_t i = 0; i < exact->rows && i < (uint32_t)FRAME_EXACT_LINES; i++)
+        if (exact->row[i] < height)
+            memset(&on_line[(size_t)exact->row[i]*width], 1, width);
+    for (uint32_t i = 0; i < exact->columns && i < (uint32_t)FRAME_EXACT_LINES; i++)
+        for (int row = 0; row < height && exact->column[i] < width; row++)
+            on_line[(size_t)row*width + exact->column[i]] = 1;
+    size_t kept = std::count(on_line.begin(), on_line.end(), 1);
+    position->clear();
+    if (kept == 0)
+        return 0;
+    position->resize(pixels);
+    uint32_t next[2] = {0, (uint32_t)(pixels - kept)};
+    for (size_t i = 0; i < pixels; i++)
+        (*position)[i] = next[on_line[i]]++;
+    return kept;
+}
+
+//Codes a picture of `pixels` pixels, row by row, of `channels` channels. Every component is
+//predicted, from the one on its left in a key frame or from the previous picture otherwise.
+//With a tolerance, the components after the first also change like the first one did
+//(FRAME_CROSS): where the picture moves, R, G and B change together. Only a difference of
+//more than the tolerance is kept: the component then keeps its predicted value, which is at
+//most the tolerance away. position (NULL for row by row) gives the place of every pixel in
+//its plane, from exactPositions(): the tolerance is 0 for the last `kept` places, and those
+//pixels aren't used to predict others, which would take their noise. reference is
+//the previous picture as the decoder will see it, and is replaced by this one. planes
+//(pixels*channels bytes) is scratch space, and out must have room for
+//riceBound(pixels*channels) bytes. Returns the size of the code and sets *type.
+inline size_t encodePicture(const uint8_t *picture, uint8_t *reference, int width, size_t pixels, int channels,
+                            int tolerance, const uint32_t *position, size_t kept, bool key, uint8_t *planes,
+                            uint8_t *out, uint32_t *type){
+    size_t size  = pixels*channels;
+    bool   cross = tolerance > 0;
+    int    left[4];
+    for (size_t i = 0; i < pixels; i++){
+        if (i%width == 0)
+            memset(left, 0, sizeof(left));
+        const uint8_t *in  = picture + i*channels;
+        uint8_t       *ref = reference + i*channels;
+        size_t         place     = position != NULL ? position[i] : i;
+        bool           exact     = place >= pixels - kept;
+        int            max_error = exact ? 0 : tolerance;
+        int            change    = 0; //Of the first component.
+        for (int c = 0; c < channels; c++){
+            int base      = key ? left[c] : ref[c];
+            int predicted = base + change;
+            predicted = predicted < 0 ? 0 : (predicted > 255 ? 255 : predicted);
+            int diff = in[c] - predicted;
+            if (diff >= -max_error && diff <= max_error)
+                diff = 0;
+            planes[c*pixels + place] = (uint8_t)diff;
+            ref[c] = (uint8_t)(predicted + diff);
+            if (!exact)
+                left[c] = ref[c];
+            if (c == 0 && cross && !exact)
+                change = ref[0] - base;
+        }
+    }
+    *type = (key ? 0 : FRAME_DELTA) | (cross ? FRAME_CROSS : 0);
+    size_t coded = riceEncode(planes, size, out);
+    if (coded < size){
+        *type |= FRAME_RICE;
+        return coded;
+    }
+    memcpy(out, planes, size);
+    return size;
+}
+
+//Decodes a picture coded by encodePicture() into reference, which holds the previous picture.
+//position and kept are the ones it was coded with. Returns false if the code is damaged.
+inline bool decodePicture(const uint8_t *code, size_t code_size, uint32_t type, uint8_t *reference, int width,
+                          size_t pixels, int channels, const uint32_t *position, size_t kept, uint8_t *planes){
+    size_t size = pixels*channels;
+    if (type & FRAME_RICE){
+        if (!riceDecode(code, code_size, planes, size))
+            return false;
+    }
+    else if (type & FRAME_RLE){
+        if (!rleDecode(code, code_size, planes, size))
+            return false;
+    }
+    else {
+        if (code_size != size)
+            return false;
+        memcpy(planes, code, size);
+    }
+    int left[4];
+    for (size_t i = 0; i < pixels; i++){
+        if (i%width == 0)
+            memset(left, 0, sizeof(left));
+        uint8_t *out    = reference + i*channels;
+        size_t   place  = position != NULL ? position[i] : i;
+        bool     exact  = place >= pixels - kept;
+        int      change = 0;
+        for (int c = 0; c < channels; c++){
+            int base      = (type & FRAME_DELTA) ? out[c] : left[c];
+            int predicted = base;
+            if (type & FRAME_CROSS){
+                predicted += change;
+                predicted  = predicted < 0 ? 0 : (predicted > 255 ? 255 : predicted);
+            }
+            out[c] = (uint8_t)(predicted + planes[c*pixels + place]);
+            if (!exact)
+                left[c] = out[c];
+            if (c == 0 && !exact)
+                change = out[0] - base;
+        }
+    }
+    return true;
+}
+
+//==== Writing ====================================================================================
+
+//Structure to store a stream being written and its encoder thread.
+//The control loop fills frames in a queue of ENCODE_QUEUE slots, each laid out like a record of
+//frame_recorder.h (a FrameRecord followed by the picture), and the encoder thread codes and
+//writes them. If the queue is full the frame is dropped, so the control loop never waits for
+//the encoder. On a virtual clock frames are coded as they are committed instead: the simulated
+//robot waits for nothing, and would only drop frames.
+struct FrameEncoder{
+    FILE                   *file;
+    int                     width;
+    int                     height;
+    int                     channels;
+    int                     tolerance;
+    std::vector<uint32_t>   position;   //Of every pixel in its plane (exactPositions()).
+    size_t                  kept;       //Pixels kept without loss, at the end of the planes.
+    uint32_t                keyframe_interval;
+    size_t                  slot_size;
+    std::vector<uint8_t>    slots;
+    std::atomic<uint32_t>   queued;     //Frames committed. Written by the control loop.
+    std::atomic<uint32_t>   encoded;    //Frames coded. Written by the encoder.
+    std::vector<uint8_t>    reference;
+    std::vector<uint8_t>    planes;
+    std::vector<uint8_t>    code;
+    std::mutex              mutex;
+    std::condition_variable wakeup;
+    std::atomic<bool>       running;
+    bool                    inline_coding;
+    std::thread             thread;
+    long                    dropped;
+    long                    write_errors;
+    uint64_t                raw_bytes;
+    uint64_t                coded_bytes;
+    int64_t                 max_encode_ns;
+    double                  total_encode_ns;
+};
+
+//Codes one queued frame and writes it.
+inline void encodeFrame(FrameEncoder *encoder, FrameRecord *record){
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start); //The cost in CPU time, even on a virtual clock.
+    size_t   pixels = (size_t)encoder->width*encoder->height;
+    bool     key    = record->frame%encoder->keyframe_interval == 0;
+    FramePacket packet;
+    packet.size = (uint32_t)encodePicture(framePixels(record), encoder->reference.data(), encoder->width, pixels,
+                                          encoder->channels, encoder->tolerance,
+                                          encoder->position.empty() ? NULL : encoder->position.data(), encoder->kept, key, encoder->planes.data(),
+                                          encoder->code.data(), &packet.type);
+    if (fwrite(record, sizeof(FrameRecord), 1, encoder->file) != 1 ||
+        fwrite(&packet, sizeof(packet), 1, encoder->file) != 1 ||
+        fwrite(encoder->code.data(), packet.size, 1, encoder->file) != 1)
+        encoder->write_errors++;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    int64_t elapsed = diffNanoseconds(&end, &start);
+    if (elapsed > encoder->max_encode_ns)
+        encoder->max_encode_ns = elapsed;
+    encoder->total_encode_ns += elapsed;
+    encoder->raw_bytes       += pixels*encoder->channels;
+    encoder->coded_bytes     += sizeof(FrameRecord) + sizeof(packet) + packet.size;
+}
+
+//Returns queue slot `frame`.
+inline FrameRecord *encoderSlot(FrameEncoder *encoder, uint32_t frame){
+    return (FrameRecord *)(encoder->slots.data() + (frame%ENCODE_QUEUE)*encoder->slot_size);
+}
+
+//Codes the frames queued so far.
+inline void drainEncoder(FrameEncoder *encoder){
+    uint32_t queued = encoder->queued.load(std::memory_order_acquire);
+    uint32_t next   = encoder->encoded.load(std::memory_order_relaxed);
+    while (next != queued){
+        encodeFrame(encoder, encoderSlot(encoder, next));
+        next++;
+        encoder->encoded.store(next, std::memory_order_release);
+    }
+}
+
+//Body of the encoder thread. It waits in real time, even on a virtual clock (see frame_recorder.h).
+inline void frameEncodeLoop(FrameEncoder *encoder){
+    while (encoder->running.load()){
+        drainEncoder(encoder);
+        std::unique_lock<std::mutex> lock(encoder->mutex);
+        encoder->wakeup.wait_for(lock, std::chrono::microseconds(ENCODE_WAKEUP_US), [encoder]{
+            return !encoder->running.load() || encoder->queued.load() != encoder->encoded.load();
+        });
+    }
+    drainEncoder(encoder);
+}
+
+//Creates a stream and starts the encoder thread. exact can be NULL. Returns false, after
+//printing why, if the file can't be made.
+inline bool openFrameEncoder(FrameEncoder *encoder, const char *file, int width, int height, int channels,
+                             int tolerance, uint32_t keyframe_interval, const FrameExactLines *exact = NULL){
+    encoder->file = fopen(file, "wb");
+    if (encoder->file == NULL){
+        fprintf(stderr, "Recorder: can't create %s (%s)\n", file, strerror(errno));
+        return false;
+    }
+    setvbuf(encoder->file, NULL, _IOFBF, STREAM_BUFFER);
+    size_t size = (size_t)width*height*channels;
+    encoder->width             = width;
+    encoder->height            = height;
+    encoder->channels          = channels;
+    encoder->tolerance         = tolerance;
+    encoder->keyframe_interval = keyframe_interval > 0 ? keyframe_interval : 1;
+    encoder->slot_size         = (sizeof(FrameRecord) + size + 63) & ~(size_t)63;
+    encoder->slots.assign(encoder->slot_size*ENCODE_QUEUE, 0);
+    encoder->reference.assign(size, 0);
+    encoder->planes.assign(size, 0);
+    encoder->code.assign(riceBound(size), 0);
+    FrameExactLines lines;
+    memset(&lines, 0, sizeof(lines));
+    if (exact != NULL && tolerance > 0)
+        lines = *exact;
+    encoder->kept = exactPositions(&lines, width, height, &encoder->position);
+    encoder->queued.store(0);
+    encoder->encoded.store(0);
+    encoder->dropped         = 0;
+    encoder->write_errors    = 0;
+    encoder->raw_bytes       = 0;
+    encoder->coded_bytes     = 0;
+    encoder->max_encode_ns   = 0;
+    encoder->total_encode_ns = 0;
+
+    FrameStreamHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FRAME_STREAM_MAGIC, sizeof(FRAME_STREAM_MAGIC));
+    header.version           = FRAME_STREAM_VERSION;
+    header.width             = width;
+    header.height            = height;
+    header.channels          = channels;
+    header.keyframe_interval = encoder->keyframe_interval;
+    header.tolerance         = tolerance;
+    struct timespec now;
+    clockNow(&now);
+    header.start_ns = (int64_t)now.tv_sec*1000000000LL + now.tv_nsec;
+    fwrite(&header, sizeof(header), 1, encoder->file);
+    fwrite(&lines, sizeof(lines), 1, encoder->file);
+
+    encoder->inline_coding = clockSource()->isVirtual();
+    encoder->running.store(true);
+    if (!encoder->inline_coding)
+        encoder->thread = std::thread(frameEncodeLoop, encoder);
+    return true;
+}
+
+//Returns the slot to fill for the next frame, or NULL if the encoder is too far behind.
+//Like beginFrame(), the picture goes to framePixels() of the slot.
+inline FrameRecord *beginEncodedFrame(FrameEncoder *encoder){
+    uint32_t queued = encoder->queued.load(std::memory_order_relaxed);
+    if (queued - encoder->encoded.load(std::memory_order_acquire) >= (uint32_t)ENCODE_QUEUE){
+        encoder->dropped++;
+        return NULL;
+    }
+    FrameRecord *record = encoderSlot(encoder, queued);
+    record->magic = FRAME_RECORD_MAGIC;
+    record->frame = queued;
+    return record;
+}
+
+//Hands the slot returned by beginEncodedFrame() to the encoder.
+inline void commitEncodedFrame(FrameEncoder *encoder, FrameRecord *record){
+    encoder->queued.store(record->frame + 1, std::memory_order_release);
+    if (encoder->inline_coding)
+        drainEncoder(encoder);
+    else
+        encoder->wakeup.notify_one();
+}
+
+//Codes the frames left, stops the encoder thread and closes the stream.
+inline void closeFrameEncoder(FrameEncoder *encoder){
+    {
+        std::lock_guard<std::mutex> lock(encoder->mutex);
+        encoder->running.store(false);
+    }
+    encoder->wakeup.notify_one();
+    if (encoder->thread.joinable())
+        encoder->thread.join();
+    drainEncoder(encoder);
+    if (fclose(encoder->file) != 0)
+        encoder->write_errors++;
+    uint32_t frames = encoder->encoded.load();
+    printf("Recorder: %u frames, %.1f MB (%.1fx smaller than raw), %ld dropped, %ld write errors\n",
+           frames, encoder->coded_bytes/1e6, encoder->coded_bytes > 0 ? (double)encoder->raw_bytes/encoder->coded_bytes : 0,
+           encoder->dropped, encoder->write_errors);
+    printf("Recorder: encoding %.2f ms per frame, %.2f ms max\n",
+           frames > 0 ? encoder->total_encode_ns/frames/1e6 : 0, encoder->max_encode_ns/1e6);
+}
+
+//==== Reading ====================================================================================
+
+//Structure to store a stream being read. The frames are read in order, one at a time,
+//so a stream of any length needs the memory of two pictures.
+struct FrameStream{
+    FILE                 *file;
+    FrameStreamHeader     header;
+    FrameExactLines       exact;     //None before version 3.
+    std::vector<uint32_t> position;  //Of every pixel in its plane (exactPositions()).
+    size_t                kept;      //Pixels kept without loss, at the end of the planes.
+    FrameRecord           record;    //Frame read last.
+    std::vector<uint8_t>  picture;   //Its picture, row by row.
+    std::vector<uint8_t>  planes;
+    std::vector<uint8_t>  code;
+    bool                  have_key;  //A key frame was read, so delta frames can be decoded.
+};
+
+//Opens a stream. Returns false if it isn't one.
+inline bool openFrameStream(FrameStream *stream, const char *file){
+    stream->file = fopen(file, "rb");
+    if (stream->file == NULL)
+        return false;
+    if (fread(&stream->header, sizeof(stream->header), 1, stream->file) != 1 ||
+        memcmp(stream->header.magic, FRAME_STREAM_MAGIC, sizeof(FRAME_STREAM_MAGIC)) != 0 ||
+        stream->header.version < 1 || stream->header.version > FRAME_STREAM_VERSION ||
+        stream->header.channels < 1 || stream->header.channels > 4){
+        fclose(stream->file);
+        return false;
+    }
+    memset(&stream->exact, 0, sizeof(stream->exact));
+    if (stream->header.version >= 3 && fread(&stream->exact, sizeof(stream->exact), 1, stream->file) != 1){
+        fclose(stream->file);
+        return false;
+    }
+    stream->kept = exactPositions(&stream->exact, stream->header.width, stream->header.height, &stream->position);
+    setvbuf(stream->file, NULL, _IOFBF, STREAM_BUFFER);
+    size_t size = (size_t)stream->header.width*stream->header.height*stream->header.channels;
+    stream->picture.assign(size, 0);
+    stream->planes.assign(size, 0);
+    stream->code.assign(std::max(rleBound(size), riceBound(size)), 0);
+    stream->have_key = false;
+    return true;
+}
+
+//Reads the next frame into stream->record and stream->picture. Returns false at the end of the
+//stream, or where it is cut short or damaged.
+inline bool readFrame(FrameStream *stream){
+    FramePacket packet;
+    if (fread(&stream->record, sizeof(FrameRecord), 1, stream->file) != 1 ||
+        fread(&packet, sizeof(packet), 1, stream->file) != 1)
+        return false;
+    if (stream->record.magic != FRAME_RECORD_MAGIC || packet.size > stream->code.size() ||
+        fread(stream->code.data(), packet.size, 1, stream->file) != 1)
+        return false;
+    if ((packet.type & FRAME_DELTA) && !stream->have_key)
+        return false;
+    size_t pixels = (size_t)stream->header.width*stream->header.height;
+    if (!decodePicture(stream->code.data(), packet.size, packet.type, stream->picture.data(), stream->header.width,
+                       pixels, stream->header.channels,
+                       stream->position.empty() ? NULL : stream->position.data(), stream->kept,
+                       stream->planes.data()))
+        return false;
+    stream->have_key = true;
+    return true;
+}
+
+inline void closeFrameStream(FrameStream *stream){
+    fclose(stream->file);
+}
+
+#endif
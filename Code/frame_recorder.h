@@ -0,0 +1,395 @@
+#ifndef FRAME_RECORDER_H
+#define FRAME_RECORDER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "hal.h"
+#include "clock.h"
+#include "profiler.h"
+
+//Records every frame of a run into a log file, with what the control code made of it.
+//The file is allocated up front for `capacity` frames and memory-mapped, so appending a
+//frame is copying it into memory: no system call and no waiting for the SD card. A
+//background thread does the I/O. It faults in the pages just ahead of the write position,
+//starts the writeback of the frames behind it, and drops the frames that are already on the
+//card from memory. When the log is full, further frames are counted and dropped. The log
+//takes at most FRAME_DISK_SHARE of the free space of the card, whatever capacity is asked for.
+//
+//Layout: a FrameLogHeader padded to FRAME_LOG_ALIGN bytes, then `capacity` records of
+//record_size bytes, each a FrameRecord followed by width*height*channels bytes of pixels
+//(row by row, see capturePicture()). A record is valid once its magic is set, which is done last, so a log
+//cut short by a crash can still be read up to the last complete frame.
+
+const char     FRAME_LOG_MAGIC[8]  = {'F', 'R', 'A', 'M', 'E', 'L', 'O', 'G'};
+const uint32_t FRAME_LOG_VERSION   = 1;
+const uint32_t FRAME_RECORD_MAGIC  = 0x46524D31; //"FRM1"
+const size_t   FRAME_LOG_ALIGN     = 4096;
+const long     FRAME_FLUSH_PERIOD_US = 50000;   //Period of the background thread.
+const int      FRAME_PREFAULT      = 4;         //Records kept faulted in ahead of the write position.
+const double   FRAME_DISK_SHARE    = 0.5;       //Most of the free space of the card a log takes.
+
+//Structure at the start of the log.
+struct FrameLogHeader{
+    char     magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+    uint32_t record_size;
+    uint32_t capacity;
+    uint64_t frames;       //Records complete, as of the last flush.
+    int64_t  start_ns;     //Clock time the log was opened.
+};
+
+//Structure at the start of every record.
+struct FrameRecord{
+    uint32_t magic;
+    uint32_t frame;              //Index in the log.
+    int64_t  time_ns;            //Clock time of the picture.
+    int32_t  state;              //State of the state machine.
+    int32_t  total_white_pixels; //ImageData of the picture.
+    int32_t  white_pixels1;
+    int32_t  white_pixels2;
+    float    error1;
+    float    error2;
+    int16_t  left_dc;            //Motor command posted after the picture.
+    int16_t  right_dc;
+    int32_t  picture;            //Number of the picture since the start, counting the ones dropped.
+};
+
+//Structure to store an open log being written.
+struct FrameRecorder{
+    int                   fd;
+    uint8_t              *map;
+    size_t                map_size;
+    FrameLogHeader       *header;
+    uint32_t              record_size;
+    uint32_t              capacity;
+    std::atomic<uint32_t> committed;  //Records complete. Written by the control loop.
+    uint32_t              next;       //Record being filled. Only used by the control loop.
+    long                  dropped;    //Frames that didn't fit.
+    uint32_t              flushed;    //Records handed to the kernel. Only used by the flusher.
+    uint32_t              released;   //Records on the card and out of memory. Only used by the flusher.
+    std::atomic<bool>     running;
+    std::thread           flusher;
+};
+
+//Offset of a record in the file.
+inline size_t frameRecordOffset(const FrameRecorder *recorder, uint32_t index){
+    return FRAME_LOG_ALIGN + (size_t)index*recorder->record_size;
+}
+
+//Pixels of a record.
+inline uint8_t *framePixels(FrameRecord *record){
+    return (uint8_t *)(record + 1);
+}
+
+//Makes the pages of records [first, last) writable without a page fault.
+inline void prefaultFrames(FrameRecorder *recorder, uint32_t first, uint32_t last){
+    if (last > recorder->capacity)
+        last = recorder->capacity;
+    if (first >= last)
+        return;
+    size_t   start = frameRecordOffset(recorder, first) & ~(FRAME_LOG_ALIGN - 1);
+    size_t   end   = frameRecordOffset(recorder, last);
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(recorder->map + start, end - start, MADV_POPULATE_WRITE) == 0)
+        return;
+#endif
+    //Older kernels: a read fault at least brings the pages in.
+    for (size_t offset = start; offset < end; offset += FRAME_LOG_ALIGN)
+        (void)*(volatile uint8_t *)(recorder->map + offset);
+}
+
+//Writes the frame count in the header and hands the new records to the kernel.
+//Records two flushes behind are waited for and dropped from memory, which keeps a long
+//recording from filling the RAM of the Pi.
+inline void flushFrames(FrameRecorder *recorder){
+    uint32_t committed = recorder->committed.load(std::memory_order_acquire);
+    if (committed > recorder->flushed){
+        size_t start = frameRecordOffset(recorder, recorder->flushed);
+        size_t end   = frameRecordOffset(recorder, committed);
+        sync_file_range(recorder->fd, start, end - start, SYNC_FILE_RANGE_WRITE);
+        uint32_t done = recorder->flushed;
+        if (done > recorder->released){
+            size_t from = frameRecordOffset(recorder, recorder->released) & ~(FRAME_LOG_ALIGN - 1);
+            size_t to   = frameRecordOffset(recorder, done) & ~(FRAME_LOG_ALIGN - 1);
+            if (to > from){
+                sync_file_range(recorder->fd, from, to - from,
+                                SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+                madvise(recorder->map + from, to - from, MADV_DONTNEED);
+                posix_fadvise(recorder->fd, from, to - from, POSIX_FADV_DONTNEED);
+            }
+            recorder->released = done;
+        }
+        recorder->flushed        = committed;
+        recorder->header->frames = committed;
+    }
+    prefaultFrames(recorder, committed, committed + FRAME_PREFAULT);
+}
+
+//Body of the background thread. It sleeps in real time, even on a virtual clock: it only
+//moves data, so it must not hold the simulated time back.
+inline void frameFlushLoop(FrameRecorder *recorder){
+    while (recorder->running.load()){
+        flushFrames(recorder);
+        std::this_thread::sleep_for(std::chrono::microseconds(FRAME_FLUSH_PERIOD_US));
+    }
+}
+
+//Creates a log for `capacity` frames and starts the background thread. Returns false, after
+//printing why, if the file can't be made.
+inline bool openFrameRecorder(FrameRecorder *recorder, const char *file, int width, int height, int channels,
+                              uint32_t capacity){
+    recorder->record_size = (uint32_t)((sizeof(FrameRecord) + (size_t)width*height*channels + 63) & ~(size_t)63);
+    recorder->fd          = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (recorder->fd < 0){
+        fprintf(stderr, "Recorder: can't create %s (%s)\n", file, strerror(errno));
+        return false;
+    }
+    struct statvfs disk;
+    if (fstatvfs(recorder->fd, &disk) == 0){
+        uint64_t room = (uint64_t)((double)disk.f_bavail*disk.f_frsize*FRAME_DISK_SHARE);
+        uint64_t fits = room > FRAME_LOG_ALIGN ? (room - FRAME_LOG_ALIGN)/recorder->record_size : 0;
+        if (fits < capacity){
+            printf("Recorder: room for %llu of %u frames on the card\n", (unsigned long long)fits, capacity);
+            capacity = (uint32_t)fits;
+        }
+    }
+    recorder->capacity = capacity;
+    recorder->map_size = FRAME_LOG_ALIGN + (size_t)capacity*recorder->record_size;
+    int error = posix_fallocate(recorder->fd, 0, recorder->map_size);
+    if (error != 0){
+        fprintf(stderr, "Recorder: can't allocate %zu MB for %s (%s)\n", recorder->map_size >> 20, file,
+                strerror(error));
+        close(recorder->fd);
+        return false;
+    }
+    void *map = mmap(NULL, recorder->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, recorder->fd, 0);
+    if (map == MAP_FAILED){
+        fprintf(stderr, "Recorder: can't map %s (%s)\n", file, strerror(errno));
+        close(recorder->fd);
+        return false;
+    }
+    recorder->map    = (uint8_t *)map;
+    recorder->header = (FrameLogHeader *)map;
+    memcpy(recorder->header->magic, FRAME_LOG_MAGIC, sizeof(FRAME_LOG_MAGIC));
+    recorder->header->version     = FRAME_LOG_VERSION;
+    recorder->header->width       = width;
+    recorder->header->height      = height;
+    recorder->header->channels    = channels;
+    recorder->header->record_size = recorder->record_size;
+    recorder->header->capacity    = capacity;
+    recorder->header->frames      = 0;
+    struct timespec now;
+    clockNow(&now);
+    recorder->header->start_ns = (int64_t)now.tv_sec*1000000000LL + now.tv_nsec;
+    recorder->committed.store(0);
+    recorder->next     = 0;
+    recorder->dropped  = 0;
+    recorder->flushed  = 0;
+    recorder->released = 0;
+    prefaultFrames(recorder, 0, FRAME_PREFAULT);
+    recorder->running.store(true);
+    recorder->flusher = std::thread(frameFlushLoop, recorder);
+    return true;
+}
+
+//Returns the record to fill for the next frame, or NULL if the log is full.
+//The frame is only part of the log once commitFrame() is called.
+inline FrameRecord *beginFrame(FrameRecorder *recorder){
+    if (recorder->next >= recorder->capacity){
+        recorder->dropped++;
+        return NULL;
+    }
+    FrameRecord *record = (FrameRecord *)(recorder->map + frameRecordOffset(recorder, recorder->next));
+    record->magic = 0;
+    record->frame = recorder->next;
+    return record;
+}
+
+//Copies the current picture of the camera to pixels, row by row: RGB with 3 channels, RGB and
+//the luminance worked out by the camera library with 4, luminance with 1.
+inline void capturePicture(uint8_t *pixels, int width, int height, int channels){
+    for (int row = 0; row < height; row++)
+        for (int col = 0; col < width; col++){
+            if (channels == 1){
+                *pixels++ = (uint8_t)HAL::get_pixel(row, col, 3); //Luminance
+                continue;
+            }
+            for (int color = 0; color < channels; color++)
+                *pixels++ = (uint8_t)HAL::get_pixel(row, col, color);
+        }
+}
+
+//Structure to store the thread that copies the pictures out of the camera library.
+//get_pixel() is the only way to the picture, and a colour picture is 307200 calls: too long
+//for the control loop, so it hands the copy to this thread and only waits for it before the
+//next take_picture(), which replaces the picture. The control loop sleeps between ticks, so
+//the copy is usually over by then. Reading pixels at the same time as the control loop is
+//safe, since take_picture() is the only call that changes the picture.
+//On a virtual clock the thread counts as awake while it copies, so time stands still until
+//the copy is over, like it would if the copy took no time.
+struct PictureCopier{
+    std::mutex              mutex;
+    std::condition_variable wakeup;
+    std::condition_variable copied;
+    uint8_t                *pixels;   //Where the picture being copied goes. NULL when there is none.
+    int                     width;
+    int                     height;
+    int                     channels;
+    bool                    running;
+    std::thread             thread;
+};
+
+//Body of the copying thread.
+inline void pictureCopyLoop(PictureCopier *copier){
+    profileThread("recorder");
+    std::unique_lock<std::mutex> lock(copier->mutex);
+    while (true){
+        copier->wakeup.wait(lock, [copier]{ return copier->pixels != NULL || !copier->running; });
+        if (copier->pixels == NULL)
+            return;
+        lock.unlock();
+        {
+            ProfileScope profile(PHASE_RECORD);
+            capturePicture(copier->pixels, copier->width, copier->height, copier->channels);
+        }
+        lock.lock();
+        copier->pixels = NULL;
+        clockSource()->detach();
+        copier->copied.notify_all();
+    }
+}
+
+//Starts the copying thread, for pictures of `channels` channels (see capturePicture()).
+inline void startPictureCopier(PictureCopier *copier, int width, int height, int channels){
+    copier->pixels   = NULL;
+    copier->width    = width;
+    copier->height   = height;
+    copier->channels = channels;
+    copier->running  = true;
+    copier->thread   = std::thread(pictureCopyLoop, copier);
+}
+
+//Waits until the picture handed over last is copied.
+inline void waitPictureCopy(PictureCopier *copier){
+    std::unique_lock<std::mutex> lock(copier->mutex);
+    copier->copied.wait(lock, [copier]{ return copier->pixels == NULL; });
+}
+
+//Hands the copy of the current picture to pixels over to the thread. The previous copy must be over.
+inline void copyPicture(PictureCopier *copier, uint8_t *pixels){
+    std::lock_guard<std::mutex> lock(copier->mutex);
+    clockSource()->attach();
+    copier->pixels = pixels;
+    copier->wakeup.notify_one();
+}
+
+//Waits for the copy in progress and stops the thread.
+inline void stopPictureCopier(PictureCopier *copier){
+    waitPictureCopy(copier);
+    {
+        std::lock_guard<std::mutex> lock(copier->mutex);
+        copier->running = false;
+    }
+    copier->wakeup.notify_one();
+    if (copier->thread.joinable())
+        copier->thread.join();
+}
+
+//Adds the record returned by beginFrame() to the log.
+inline void commitFrame(FrameRecorder *recorder, FrameRecord *record){
+    std::atomic_thread_fence(std::memory_order_release);
+    record->magic = FRAME_RECORD_MAGIC;
+    recorder->next++;
+    recorder->committed.store(recorder->next, std::memory_order_release);
+}
+
+//Stops the background thread, writes everything and trims the file to the frames recorded.
+inline void closeFrameRecorder(FrameRecorder *recorder){
+    recorder->running.store(false);
+    if (recorder->flusher.joinable())
+        recorder->flusher.join();
+    uint32_t frames = recorder->committed.load();
+    recorder->header->frames = frames;
+    size_t used = frameRecordOffset(recorder, frames);
+    msync(recorder->map, recorder->map_size, MS_SYNC);
+    munmap(recorder->map, recorder->map_size);
+    if (ftruncate(recorder->fd, used) != 0)
+        fprintf(stderr, "Recorder: can't trim the log (%s)\n", strerror(errno));
+    fsync(recorder->fd);
+    close(recorder->fd);
+    printf("Recorder: %u frames (%zu MB), %ld dropped\n", frames, used >> 20, recorder->dropped);
+}
+
+//==== Reading ====================================================================================
+
+//Structure to store a log opened for reading.
+struct FrameLog{
+    int                   fd;
+    const uint8_t        *map;
+    size_t                map_size;
+    const FrameLogHeader *header;
+    uint32_t              frames;   //Valid records.
+};
+
+//Opens a log. A log whose header wasn't updated before a crash is read up to its last valid record.
+inline bool openFrameLog(FrameLog *log, const char *file){
+    log->fd = open(file, O_RDONLY);
+    if (log->fd < 0)
+        return false;
+    struct stat info;
+    if (fstat(log->fd, &info) != 0 || (size_t)info.st_size < FRAME_LOG_ALIGN){
+        close(log->fd);
+        return false;
+    }
+    log->map_size = info.st_size;
+    void *map = mmap(NULL, log->map_size, PROT_READ, MAP_SHARED, log->fd, 0);
+    if (map == MAP_FAILED){
+        close(log->fd);
+        return false;
+    }
+    log->map    = (const uint8_t *)map;
+    log->header = (const FrameLogHeader *)map;
+    if (memcmp(log->header->magic, FRAME_LOG_MAGIC, sizeof(FRAME_LOG_MAGIC)) != 0 ||
+        log->header->version != FRAME_LOG_VERSION || log->header->record_size < sizeof(FrameRecord)){
+        munmap(map, log->map_size);
+        close(log->fd);
+        return false;
+    }
+    size_t room = (log->map_size - FRAME_LOG_ALIGN)/log->header->record_size;
+    uint32_t frames = 0;
+    while (frames < room){
+        const FrameRecord *record = (const FrameRecord *)(log->map + FRAME_LOG_ALIGN + (size_t)frames*log->header->record_size);
+        if (record->magic != FRAME_RECORD_MAGIC || record->frame != frames)
+            break;
+        frames++;
+    }
+    log->frames = frames;
+    return true;
+}
+
+//Returns record `index` of a log opened with openFrameLog().
+inline const FrameRecord *frameLogRecord(const FrameLog *log, uint32_t index){
+    return (const FrameRecord *)(log->map + FRAME_LOG_ALIGN + (size_t)index*log->header->record_size);
+}
+
+inline void closeFrameLog(FrameLog *log){
+    munmap((void *)log->map, log->map_size);
+    close(log->fd);
+}
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef FSM_H
+#define FSM_H
+
+#include <stdio.h>
+#include <time.h>
+#include "scheduler.h"
+#include "trace.h"
+
+//Table-driven finite state machine.
+//Each state has a tick function that does one control step and returns straight away with
+//an event: FSM_STAY to keep running the same state, or an event that is looked up in the
+//transition table to find the next state. A state can also have a guard, which runs before
+//the tick and can skip it (e.g. to stop when an obstacle is ahead), and an enter function,
+//which runs once when the state becomes current.
+
+const int FSM_STAY       = 0;  //Event returned by a tick that wants to stay in the same state.
+const int FSM_MAX_STATES = 32;
+
+//Structure to store the description of one state.
+struct StateInfo{
+    const char *name;
+    int         quadrant;  //Quadrant the state belongs to.
+    bool      (*guard)();  //Returns false to skip the tick. Can be NULL.
+    void      (*enter)();  //Can be NULL.
+    int       (*tick)();   //Returns FSM_STAY or an event.
+};
+
+//Structure to store one row of the transition table.
+struct Transition{
+    int from;
+    int event;
+    int to;
+};
+
+//Structure to store the state machine and how long it spent in each state.
+struct StateMachine{
+    const StateInfo  *states;
+    int               state_count;
+    const Transition *transitions;
+    int               transition_count;
+    void            (*quadrant_changed)(int quadrant); //Called when the quadrant changes. Can be NULL.
+    bool              verbose;                         //Print every transition.
+    int               current;
+    long              ticks_in_state;                  //Ticks since the current state was entered.
+    struct timespec   entered;
+    long              ticks[FSM_MAX_STATES];
+    long              entries[FSM_MAX_STATES];
+    long long         time_ns[FSM_MAX_STATES];
+};
+
+//Makes `state` the current state, accounting for the time spent in the previous one.
+inline void changeState(StateMachine *machine, int state){
+    struct timespec now;
+    clockNow(&now);
+    int previous = machine->current;
+    if (previous >= 0)
+        machine->time_ns[previous] += diffNanoseconds(&now, &machine->entered);
+    if (machine->verbose)
+        printf("FSM: %s -> %s\n", previous >= 0 ? machine->states[previous].name : "start",
+               machine->states[state].name);
+
+    trace(TRACE_STATE, state, previous);
+    machine->current        = state;
+    machine->ticks_in_state = 0;
+    machine->entered        = now;
+    machine->entries[state]++;
+    if (machine->quadrant_changed &&
+        (previous < 0 || machine->states[previous].quadrant != machine->states[state].quadrant)){
+        trace(TRACE_QUADRANT, machine->states[state].quadrant);
+        machine->quadrant_changed(machine->states[state].quadrant);
+    }
+    if (machine->states[state].enter)
+        machine->states[state].enter();
+}
+
+//Sets up a machine and enters its initial state.
+inline void initStateMachine(StateMachine *machine, const StateInfo *states, int state_count,
+                             const Transition *transitions, int transition_count,
+                             void (*quadrant_changed)(int), bool verbose, int initial_state){
+    machine->states           = states;
+    machine->state_count      = state_count;
+    machine->transitions      = transitions;
+    machine->transition_count = transition_count;
+    machine->quadrant_changed = quadrant_changed;
+    machine->verbose          = verbose;
+    machine->current          = -1;
+    for (int i = 0; i < FSM_MAX_STATES; i++){
+        machine->ticks[i]   = 0;
+        machine->entries[i] = 0;
+        machine->time_ns[i] = 0;
+    }
+    changeState(machine, initial_state);
+}
+
+//Runs one tick of the current state and follows the transition for the event it returns.
+inline void stepStateMachine(StateMachine *machine){
+    const StateInfo *state = &machine->states[machine->current];
+    machine->ticks_in_state++;
+    machine->ticks[machine->current]++;
+    if (state->guard && !state->guard())
+        return;
+    int event = state->tick();
+    if (event == FSM_STAY)
+        return;
+    trace(TRACE_EVENT, event, machine->current);
+    for (int i = 0; i < machine->transition_count; i++){
+        const Transition *transition = &machine->transitions[i];
+        if (transition->from == machine->current && transition->event == event){
+            changeState(machine, transition->to);
+            return;
+        }
+    }
+    fprintf(stderr, "FSM: no transition from %s for event %d\n", state->name, event);
+}
+
+//Prints ticks, entries and time spent in every state that was used.
+inline void printStateTimes(const StateMachine *machine){
+    struct timespec now;
+    clockNow(&now);
+    for (int i = 0; i < machine->state_count; i++){
+        if (machine->entries[i] == 0)
+            continue;
+        long long time_ns = machine->time_ns[i];
+        if (i == machine->current)
+            time_ns += diffNanoseconds(&now, &machine->entered);
+        printf("%-18s Q%-2d entries: %5ld ticks: %7ld time: %9.3f s\n", machine->states[i].name,
+               machine->states[i].quadrant, machine->entries[i], machine->ticks[i], time_ns/1e9);
+    }
+}
+
+#endif
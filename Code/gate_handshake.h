@@ -0,0 +1,163 @@
+#ifndef GATE_HANDSHAKE_H
+#define GATE_HANDSHAKE_H
+
+#include <stdio.h>
+#include <time.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <thread>
+#include "hal.h"
+#include "scheduler.h"
+
+//Opens the first gate in the background.
+//The exchange with the gate server (connect, send "Please", receive the password, send it
+//back) is started right after init() on a thread of its own, so it overlaps with the rest of
+//the startup instead of blocking the robot with the motors stopped. The Q1 state only polls
+//the future. An attempt that fails or takes longer than attempt_timeout_us is retried from
+//the start: a new connection, and "Please" sent again, since a server that lost the answer
+//never sends it. The library calls can't be interrupted, so a timed-out attempt is abandoned:
+//connect_to_server() opens a new socket and the old thread stays blocked on the old one, which
+//the library can't close. It checks that it was abandoned before each call, so it never uses
+//the socket of the next attempt. The handshake fails after max_attempts failures or timeouts.
+
+enum HandshakeStatus{
+    HANDSHAKE_PENDING,
+    HANDSHAKE_DONE,
+    HANDSHAKE_FAILED //All attempts failed or timed out.
+};
+
+//Outcome of one attempt.
+struct HandshakeResult{
+    bool            ok;
+    struct timespec finished;
+};
+
+//Structure to store the state of the handshake.
+struct GateHandshake{
+    char                               *ip;
+    int                                port;
+    char                               *please;
+    int                                max_attempts;
+    int64_t                            attempt_timeout_us;
+    int                                attempts;
+    HandshakeStatus                    status;
+    std::future<HandshakeResult>       result;               //Of the current attempt.
+    std::shared_ptr<std::atomic<bool>> abandoned;            //Set when the current attempt times out.
+    struct timespec                    started;              //Start of the first attempt.
+    struct timespec                    attempt_started;
+    struct timespec                    finished;
+    struct timespec                    needed;               //First time the robot had to wait for it.
+    bool                               was_needed;
+};
+
+//Body of the thread of one attempt. The library returns negative values on errors.
+inline void handshakeAttempt(char *ip, int port, char *please, std::shared_ptr<std::atomic<bool>> abandoned,
+                             std::promise<HandshakeResult> done){
+    char message[24] = "";
+    HandshakeResult result;
+    result.ok = !abandoned->load() && HAL::connect_to_server(ip, port) >= 0 &&
+                !abandoned->load() && HAL::send_to_server(please) >= 0 &&
+                !abandoned->load() && HAL::receive_from_server(message) >= 0 && message[0] != '\0' &&
+                !abandoned->load() && HAL::send_to_server(message) >= 0;
+    clockNow(&result.finished);
+    done.set_value(result);
+}
+
+//Starts a new attempt, abandoning the previous one if it is still running.
+inline void startHandshakeAttempt(GateHandshake *handshake){
+    if (handshake->abandoned)
+        handshake->abandoned->store(true);
+    std::promise<HandshakeResult> done;
+    handshake->result    = done.get_future();
+    handshake->abandoned = std::make_shared<std::atomic<bool>>(false);
+    handshake->attempts++;
+    clockNow(&handshake->attempt_started);
+    std::thread(handshakeAttempt, handshake->ip, handshake->port, handshake->please, handshake->abandoned,
+                std::move(done)).detach();
+}
+
+//Starts the handshake. Call it as early as possible.
+inline void startGateHandshake(GateHandshake *handshake, char *ip, int port, char *please,
+                               int max_attempts, int64_t attempt_timeout_us){
+    handshake->ip                 = ip;
+    handshake->port               = port;
+    handshake->please             = please;
+    handshake->max_attempts       = max_attempts;
+    handshake->attempt_timeout_us = attempt_timeout_us;
+    handshake->attempts           = 0;
+    handshake->status             = HANDSHAKE_PENDING;
+    handshake->was_needed         = false;
+    handshake->abandoned.reset();
+    startHandshakeAttempt(handshake);
+    handshake->started = handshake->attempt_started;
+}
+
+//Checks the handshake without blocking, retrying failed or stuck attempts.
+inline HandshakeStatus pollGateHandshake(GateHandshake *handshake){
+    if (handshake->status != HANDSHAKE_PENDING)
+        return handshake->status;
+    struct timespec now;
+    clockNow(&now);
+    if (!handshake->was_needed){
+        handshake->needed     = now;
+        handshake->was_needed = true;
+    }
+
+    //Outcome of the attempt so far: 0 still going, 1 failed, 2 done. It goes past the journal
+    //(see hal.h), since it depends on when the thread of the attempt got to it.
+    HandshakeResult result = {false, now};
+    int outcome = 0;
+    if (handshake->result.valid() &&
+        handshake->result.wait_for(std::chrono::seconds(0)) == std::future_status::ready){
+        result  = handshake->result.get();
+        outcome = result.ok ? 2 : 1;
+    }
+    journalObserve(&outcome, &result.finished);
+
+    if (outcome == 2){
+        handshake->status   = HANDSHAKE_DONE;
+        handshake->finished = result.finished;
+        return HANDSHAKE_DONE;
+    }
+    if (outcome == 0){
+        if (diffNanoseconds(&now, &handshake->attempt_started)/NSEC_PER_USEC <= handshake->attempt_timeout_us)
+            return HANDSHAKE_PENDING;
+        fprintf(stderr, "Gate handshake: attempt %d timed out\n", handshake->attempts);
+    }
+    else
+        fprintf(stderr, "Gate handshake: attempt %d failed\n", handshake->attempts);
+    if (handshake->attempts >= handshake->max_attempts){
+        handshake->abandoned->store(true);
+        handshake->status   = HANDSHAKE_FAILED;
+        handshake->finished = now;
+    }
+    else
+        startHandshakeAttempt(handshake);
+    return handshake->status;
+}
+
+//Returns the microseconds since the handshake finished.
+inline int64_t handshakeAge(const GateHandshake *handshake){
+    struct timespec now;
+    clockNow(&now);
+    return diffNanoseconds(&now, &handshake->finished)/NSEC_PER_USEC;
+}
+
+//Prints how long the handshake took and how much of it was hidden behind the startup.
+inline void printGateHandshake(const GateHandshake *handshake){
+    if (handshake->status == HANDSHAKE_PENDING){
+        printf("Gate handshake: not finished, %d attempts\n", handshake->attempts);
+        return;
+    }
+    double total_s  = diffNanoseconds(&handshake->finished, &handshake->started)/1e9;
+    double hidden_s = total_s;
+    if (handshake->was_needed && diffNanoseconds(&handshake->needed, &handshake->finished) < 0)
+        hidden_s = diffNanoseconds(&handshake->needed, &handshake->started)/1e9;
+    printf("Gate handshake: %s after %d attempts, %.3f s, %.3f s overlapped with startup\n",
+           handshake->status == HANDSHAKE_DONE ? "done" : "failed", handshake->attempts, total_s, hidden_s);
+}
+
+#endif
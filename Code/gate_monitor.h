@@ -0,0 +1,168 @@
+#ifndef GATE_MONITOR_H
+#define GATE_MONITOR_H
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "hal.h"
+#include "scheduler.h"
+#include "gate_predictor.h"
+
+//Watches the front sensor for the second gate from a thread of its own.
+//The thread samples at a fixed rate instead of spinning on read_analog(), and tracks the
+//gate with hysteresis: it counts as closed once the reading reaches close_threshold and as
+//open again only when it drops below open_threshold, so noise around a single threshold
+//can't produce false edges. When a closed -> open edge is seen, `opened` is set and any
+//thread blocked in waitForGateOpening() is woken up.
+//If a GatePredictor is given, every edge is also fed to it, so the gate's cycle is learnt
+//while the robot approaches and waits.
+
+const int GATE_READINGS = 5; //Readings of the sensor averaged into a sample, against its noise.
+
+//Structure to store the state of the gate monitor.
+struct GateMonitor{
+    int                     channel;
+    int                     readings;        //Readings averaged into one sample.
+    long                    period_us;
+    int                     close_threshold; //Sample >= this: gate closed.
+    int                     open_threshold;  //Sample < this: gate open. Lower than close_threshold.
+    std::atomic<bool>       running;
+    std::atomic<bool>       opened;          //Set on the first closed -> open edge.
+    std::atomic<int>        last_sample;
+    bool                    closed;          //Only used by the monitor thread.
+    GatePredictor          *predictor;       //Can be NULL. Protected by mutex.
+    long                    samples;
+    std::thread             thread;
+    std::mutex              mutex;
+    std::condition_variable edge;
+};
+
+//Body of the monitor thread.
+inline void gateMonitorLoop(GateMonitor *monitor){
+    Scheduler sampling;
+    initScheduler(&sampling, monitor->period_us, 0, -1);
+    bool first = true;
+    while (monitor->running.load()){
+        int total = 0;
+        for (int i = 0; i < monitor->readings; i++)
+            total += HAL::read_analog(monitor->channel);
+        int sample = total/monitor->readings;
+        monitor->last_sample.store(sample);
+        monitor->samples++;
+
+        struct timespec now;
+        clockNow(&now);
+        if (!monitor->closed && sample >= monitor->close_threshold){
+            monitor->closed = true;
+            //A gate that is closed on the first sample didn't close now: not a real edge.
+            if (monitor->predictor && !first){
+                std::lock_guard<std::mutex> lock(monitor->mutex);
+                gateEdge(monitor->predictor, false, &now);
+            }
+        }
+        else if (monitor->closed && sample < monitor->open_threshold){
+            monitor->closed = false;
+            std::lock_guard<std::mutex> lock(monitor->mutex);
+            if (monitor->predictor)
+                gateEdge(monitor->predictor, true, &now);
+            monitor->opened.store(true);
+            monitor->edge.notify_all();
+        }
+        first = false;
+        waitForTick(&sampling);
+    }
+}
+
+//Starts watching the gate. Only an edge seen after this call sets `opened`, so a gate that is
+//already open must close and open again, like the old pair of busy loops required.
+inline void startGateMonitor(GateMonitor *monitor, int channel, int readings, long period_us,
+                             int close_threshold, int open_threshold, GatePredictor *predictor = NULL){
+    monitor->channel         = channel;
+    monitor->readings        = readings > 0 ? readings : 1;
+    monitor->period_us       = period_us;
+    monitor->close_threshold = close_threshold;
+    monitor->open_threshold  = open_threshold;
+    monitor->closed          = false;
+    monitor->samples         = 0;
+    monitor->predictor       = predictor;
+    if (predictor)
+        restartGatePredictor(predictor);
+    monitor->last_sample.store(0);
+    monitor->opened.store(false);
+    monitor->running.store(true);
+    clockSource()->attach();
+    monitor->thread = std::thread(gateMonitorLoop, monitor);
+}
+
+//Stops the monitor thread.
+inline void stopGateMonitor(GateMonitor *monitor){
+    monitor->running.store(false);
+    clockJoin(&monitor->thread);
+}
+
+//Blocks until the gate opens or timeout_us passes. Returns false on timeout.
+//On a virtual clock it checks once per sampling period instead, since blocking on the
+//condition variable would stop time for the monitor thread too.
+inline bool waitForGateOpening(GateMonitor *monitor, int64_t timeout_us){
+    if (clockSource()->isVirtual()){
+        struct timespec deadline, now;
+        clockNow(&deadline);
+        addNanoseconds(&deadline, timeout_us*NSEC_PER_USEC);
+        do {
+            if (monitor->opened.load())
+                return true;
+            clockSleep(monitor->period_us);
+            clockNow(&now);
+        } while (diffNanoseconds(&now, &deadline) < 0);
+        return monitor->opened.load();
+    }
+    std::unique_lock<std::mutex> lock(monitor->mutex);
+    return monitor->edge.wait_for(lock, std::chrono::microseconds(timeout_us),
+                                  [monitor]{ return monitor->opened.load(); });
+}
+
+//Body of gateClearToGo().
+inline bool gateClear(GateMonitor *monitor, long margin_us, long default_margin_us, long pass_us){
+    std::lock_guard<std::mutex> lock(monitor->mutex);
+    const GatePredictor *predictor = monitor->predictor;
+    if (monitor->last_sample.load() >= monitor->open_threshold)
+        return false;
+
+    struct timespec now, opened;
+    clockNow(&now);
+    bool known = predictor->open && predictor->seen_open;
+    if (known)
+        opened = predictor->last_open;
+    struct timespec predicted;
+    if (predictGateOpening(predictor, &predicted) && diffNanoseconds(&now, &predicted) >= 0 &&
+        (!known || diffNanoseconds(&opened, &predicted) > 0)){
+        //The sensor only clears once the gate is well out of the way, so the prediction
+        //usually comes first.
+        opened = predicted;
+        known  = true;
+    }
+    if (!known)
+        return false; //Arrived while it was open: its closing time is unknown.
+
+    double open_for_s = diffNanoseconds(&now, &opened)/1e9;
+    if (!gateModelKnown(predictor))
+        return open_for_s*1e6 >= default_margin_us;
+    if (open_for_s*1e6 < margin_us)
+        return false;
+    return (predictor->open_s - open_for_s)*1e6 >= pass_us;
+}
+
+//Returns true when it is time to go through the gate: the sensor is clear, the gate opened
+//(seen, or predicted by the model) at least margin_us ago, and the model doesn't expect it
+//to close within pass_us. Without a model, default_margin_us is used and the time left
+//can't be checked. Needs a predictor. The answer depends on the monitor thread, so it goes
+//past the journal (see hal.h).
+inline bool gateClearToGo(GateMonitor *monitor, long margin_us, long default_margin_us, long pass_us){
+    int clear = gateClear(monitor, margin_us, default_margin_us, pass_us);
+    journalObserve(&clear, NULL);
+    return clear != 0;
+}
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef GATE_PREDICTOR_H
+#define GATE_PREDICTOR_H
+
+#include <stdio.h>
+#include <time.h>
+#include <stdint.h>
+#include "scheduler.h"
+
+//Learns the open/close cycle of the second gate from the edges the gate monitor sees.
+//The period (open to open) and how long the gate stays open are tracked with an
+//exponential moving average; intervals far from the current estimate are rejected as
+//noise. With a model, the next opening can be predicted from the last closing, and the
+//time left before the gate closes again can be estimated while it is open.
+//Intervals shorter than GATE_MIN_INTERVAL are sensor noise and never learnt. After
+//GATE_MAX_MISSES outliers in a row the estimate is taken to be wrong (a model saved by an
+//earlier run, or a noisy first interval) and starts again from the last interval.
+//The model is kept in a small text file between runs, since the gate runs on a fixed cycle.
+//Only a plausible model is saved or loaded: both times known, open shorter than the period.
+//Edge times are differenced in int64_t nanoseconds (a gate cycle is longer than the 2.1 s a
+//32-bit long holds) and only the averages are kept in seconds.
+
+const double GATE_OUTLIER      = 0.5; //Intervals further than this fraction from the estimate are rejected.
+const double GATE_MIN_INTERVAL = 0.5; //s. Shortest period or open time of a real gate.
+const int    GATE_MAX_MISSES   = 3;   //Outliers in a row after which the estimate starts again.
+
+//Structure to store the model of the gate.
+struct GatePredictor{
+    double          smoothing;  //Weight of a new interval in the averages.
+    double          period_s;   //Open to open. 0 if unknown.
+    double          open_s;     //Open to close. 0 if unknown.
+    int             cycles;     //Intervals measured in this run.
+    long            rejected;
+    int             period_misses; //Outliers in a row.
+    int             open_misses;
+    bool            open;       //Last edge seen was an opening.
+    bool            seen_open;
+    bool            seen_close;
+    struct timespec last_open;
+    struct timespec last_close;
+};
+
+//Sets up an empty model.
+inline void initGatePredictor(GatePredictor *predictor, double smoothing){
+    predictor->smoothing     = smoothing;
+    predictor->period_s      = 0;
+    predictor->open_s        = 0;
+    predictor->cycles        = 0;
+    predictor->rejected      = 0;
+    predictor->period_misses = 0;
+    predictor->open_misses   = 0;
+    predictor->open          = false;
+    predictor->seen_open     = false;
+    predictor->seen_close    = false;
+}
+
+//Forgets the edges of a previous wait but keeps the model.
+inline void restartGatePredictor(GatePredictor *predictor){
+    predictor->open       = false;
+    predictor->seen_open  = false;
+    predictor->seen_close = false;
+}
+
+//Returns true if both the period and the open time are known and make a possible gate.
+inline bool gateModelKnown(const GatePredictor *predictor){
+    return predictor->period_s >= GATE_MIN_INTERVAL && predictor->open_s >= GATE_MIN_INTERVAL &&
+           predictor->open_s < predictor->period_s;
+}
+
+//Blends a measured interval into an average, unless it is noise or looks like an outlier.
+//misses counts the outliers in a row of that average.
+inline void learnInterval(GatePredictor *predictor, double *average, int *misses, double interval_s){
+    if (interval_s < GATE_MIN_INTERVAL){
+        predictor->rejected++;
+        return;
+    }
+    if (*average <= 0){
+        *average = interval_s;
+        return;
+    }
+    if (interval_s < *average*(1 - GATE_OUTLIER) || interval_s > *average*(1 + GATE_OUTLIER)){
+        predictor->rejected++;
+        if (++*misses >= GATE_MAX_MISSES){
+            *average = interval_s;
+            *misses  = 0;
+        }
+        return;
+    }
+    *misses   = 0;
+    *average += predictor->smoothing*(interval_s - *average);
+}
+
+//Records an edge seen at time `at`.
+inline void gateEdge(GatePredictor *predictor, bool opened, const struct timespec *at){
+    int64_t since_open_ns = predictor->seen_open ? diffNanoseconds(at, &predictor->last_open) : 0;
+    if (opened){
+        if (predictor->seen_open){
+            learnInterval(predictor, &predictor->period_s, &predictor->period_misses, (double)since_open_ns/NSEC_PER_SEC);
+            predictor->cycles++;
+        }
+        predictor->last_open = *at;
+        predictor->seen_open = true;
+    }
+    else {
+        if (predictor->seen_open && predictor->open)
+            learnInterval(predictor, &predictor->open_s, &predictor->open_misses, (double)since_open_ns/NSEC_PER_SEC);
+        predictor->last_close = *at;
+        predictor->seen_close = true;
+    }
+    predictor->open = opened;
+}
+
+//Predicts when the gate opens after the last closing. Returns false without a model.
+inline bool predictGateOpening(const GatePredictor *predictor, struct timespec *at){
+    if (!gateModelKnown(predictor) || !predictor->seen_close)
+        return false;
+    *at = predictor->last_close;
+    addNanoseconds(at, (int64_t)((predictor->period_s - predictor->open_s)*NSEC_PER_SEC));
+    return true;
+}
+
+//Reads a model saved by saveGateModel(). Returns false, and keeps the model as it is, if there
+//is none or it isn't plausible.
+inline bool loadGateModel(GatePredictor *predictor, const char *file_name){
+    FILE *file = fopen(file_name, "r");
+    if (file == NULL)
+        return false;
+    GatePredictor loaded = *predictor;
+    bool read = fscanf(file, "%lf %lf", &loaded.period_s, &loaded.open_s) == 2;
+    fclose(file);
+    if (!read || !gateModelKnown(&loaded)){
+        printf("Gate model: ignoring %s, it isn't a possible gate\n", file_name);
+        return false;
+    }
+    predictor->period_s = loaded.period_s;
+    predictor->open_s   = loaded.open_s;
+    return true;
+}
+
+//Saves the model for the next run, if it is plausible.
+inline void saveGateModel(const GatePredictor *predictor, const char *file_name){
+    if (!gateModelKnown(predictor)){
+        printf("Gate model: not saved, it isn't a possible gate\n");
+        return;
+    }
+    FILE *file = fopen(file_name, "w");
+    if (file == NULL){
+        perror("saveGateModel");
+        return;
+    }
+    fprintf(file, "%f %f\n", predictor->period_s, predictor->open_s);
+    fclose(file);
+}
+
+//Prints the model.
+inline void printGatePredictor(const GatePredictor *predictor){
+    printf("Gate model: period %.3f s, open %.3f s, %d cycles measured, %ld rejected\n",
+           predictor->period_s, predictor->open_s, predictor->cycles, predictor->rejected);
+}
+
+#endif
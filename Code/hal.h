@@ -0,0 +1,188 @@
+#ifndef HAL_H
+#define HAL_H
+
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include "E101.h"
+
+//Hardware abstraction layer over E101.h.
+//The control code calls every library function through HAL (HAL::take_picture(),
+//HAL::set_motor(L_MOTOR, 40), ...). HAL is a policy chosen when compiling:
+//  - E101Policy (default): static inline functions that forward to libE101. They compile to
+//    the same direct calls as before, so the robot build pays nothing for the layer.
+//  - SimPolicy (-DHAL_SIM): forwards to the HalBackend installed with setHalBackend(), such
+//    as a simulator. Nothing from libE101 is referenced, so it links without the library.
+//Either way the inputs (pictures, ADC and digital readings) go past the HalJournal installed
+//with setHalJournal(), if any, to be recorded for replay (see journal.h). Without one this
+//costs a test of a pointer per call.
+
+//Forwards to libE101.
+struct E101Policy{
+    static void stop(int motor)                                    { ::stop(motor); }
+    static int  init()                                             { return ::init(); }
+    static int  take_picture()                                     { return ::take_picture(); }
+    static int  save_picture(char fn[5])                           { return ::save_picture(fn); }
+    static char get_pixel(int row, int col, int color)             { return ::get_pixel(row, col, color); }
+    static int  set_pixel(int row, int col, char red, char green, char blue){
+        return ::set_pixel(row, col, red, green, blue);
+    }
+    static void convert_camera_to_screen()                         { ::convert_camera_to_screen(); }
+    static int  open_screen_stream()                               { return ::open_screen_stream(); }
+    static int  close_screen_stream()                              { return ::close_screen_stream(); }
+    static int  update_screen()                                    { return ::update_screen(); }
+    static int  display_picture(int delay_sec, int delay_usec)     { return ::display_picture(delay_sec, delay_usec); }
+    static int  set_motor(int motor, int speed)                    { return ::set_motor(motor, speed); }
+    static int  sleep1(int sec, int usec)                          { return ::sleep1(sec, usec); }
+    static int  select_IO(int chan, int direct)                    { return ::select_IO(chan, direct); }
+    static int  write_digital(int chan, char level)                { return ::write_digital(chan, level); }
+    static int  read_digital(int chan)                             { return ::read_digital(chan); }
+    static int  read_analog(int in_ch_adc)                         { return ::read_analog(in_ch_adc); }
+    static int  set_PWM(int chan, int value)                       { return ::set_PWM(chan, value); }
+    static int  set_PWM_frequency(int chan, int freq)              { return ::set_PWM_frequency(chan, freq); }
+    static int  set_servo(int chan, int value)                     { return ::set_servo(chan, value); }
+    static int  connect_to_server(char server_addr[15], int port)  { return ::connect_to_server(server_addr, port); }
+    static int  send_to_server(char message[24])                   { return ::send_to_server(message); }
+    static int  receive_from_server(char message[24])              { return ::receive_from_server(message); }
+};
+
+//Interface of a replacement for the hardware.
+//The camera, the sensors, the motors and sleep1() must be provided; everything else has a
+//default that does nothing and succeeds. The default gate server answers at once.
+class HalBackend{
+public:
+    virtual ~HalBackend(){}
+
+    virtual int  take_picture() = 0;
+    virtual char get_pixel(int row, int col, int color) = 0;
+    virtual int  set_motor(int motor, int speed) = 0;
+    virtual int  read_digital(int chan) = 0;
+    virtual int  read_analog(int in_ch_adc) = 0;
+    virtual int  sleep1(int sec, int usec) = 0;
+
+    virtual void stop(int motor)                                   { set_motor(motor, 0); }
+    virtual int  init()                                            { return 0; }
+    virtual int  save_picture(char[5])                             { return 0; }
+    virtual int  set_pixel(int, int, char, char, char)             { return 0; }
+    virtual void convert_camera_to_screen()                        {}
+    virtual int  open_screen_stream()                              { return 0; }
+    virtual int  close_screen_stream()                             { return 0; }
+    virtual int  update_screen()                                   { return 0; }
+    virtual int  display_picture(int, int)                         { return 0; }
+    virtual int  select_IO(int, int)                               { return 0; }
+    virtual int  write_digital(int, char)                          { return 0; }
+    virtual int  set_PWM(int, int)                                 { return 0; }
+    virtual int  set_PWM_frequency(int, int)                       { return 0; }
+    virtual int  set_servo(int, int)                               { return 0; }
+    virtual int  connect_to_server(char[15], int)                  { return 0; }
+    virtual int  send_to_server(char[24])                          { return 0; }
+    virtual int  receive_from_server(char message[24])             { strcpy(message, "open"); return 0; }
+};
+
+//Backend used by SimPolicy.
+inline HalBackend *&halBackend(){
+    static HalBackend *backend = NULL;
+    return backend;
+}
+
+inline void setHalBackend(HalBackend *backend){
+    halBackend() = backend;
+}
+
+//Forwards to the installed HalBackend.
+struct SimPolicy{
+    static void stop(int motor)                                    { halBackend()->stop(motor); }
+    static int  init()                                             { return halBackend()->init(); }
+    static int  take_picture()                                     { return halBackend()->take_picture(); }
+    static int  save_picture(char fn[5])                           { return halBackend()->save_picture(fn); }
+    static char get_pixel(int row, int col, int color)             { return halBackend()->get_pixel(row, col, color); }
+    static int  set_pixel(int row, int col, char red, char green, char blue){
+        return halBackend()->set_pixel(row, col, red, green, blue);
+    }
+    static void convert_camera_to_screen()                         { halBackend()->convert_camera_to_screen(); }
+    static int  open_screen_stream()                               { return halBackend()->open_screen_stream(); }
+    static int  close_screen_stream()                              { return halBackend()->close_screen_stream(); }
+    static int  update_screen()                                    { return halBackend()->update_screen(); }
+    static int  display_picture(int delay_sec, int delay_usec)     { return halBackend()->display_picture(delay_sec, delay_usec); }
+    static int  set_motor(int motor, int speed)                    { return halBackend()->set_motor(motor, speed); }
+    static int  sleep1(int sec, int usec)                          { return halBackend()->sleep1(sec, usec); }
+    static int  select_IO(int chan, int direct)                    { return halBackend()->select_IO(chan, direct); }
+    static int  write_digital(int chan, char level)                { return halBackend()->write_digital(chan, level); }
+    static int  read_digital(int chan)                             { return halBackend()->read_digital(chan); }
+    static int  read_analog(int in_ch_adc)                         { return halBackend()->read_analog(in_ch_adc); }
+    static int  set_PWM(int chan, int value)                       { return halBackend()->set_PWM(chan, value); }
+    static int  set_PWM_frequency(int chan, int freq)              { return halBackend()->set_PWM_frequency(chan, freq); }
+    static int  set_servo(int chan, int value)                     { return halBackend()->set_servo(chan, value); }
+    static int  connect_to_server(char server_addr[15], int port)  { return halBackend()->connect_to_server(server_addr, port); }
+    static int  send_to_server(char message[24])                   { return halBackend()->send_to_server(message); }
+    static int  receive_from_server(char message[24])              { return halBackend()->receive_from_server(message); }
+};
+
+//Receives what the control code reads and decides, to record it or check it against a recording.
+class HalJournal{
+public:
+    virtual ~HalJournal(){}
+    virtual void picture() = 0;
+    virtual void analog(int chan, int value) = 0;
+    virtual void digital(int chan, int value) = 0;
+    virtual void command(int left_dc, int right_dc) = 0; //Motor command of the control code.
+    virtual void tick() = 0;                             //Start of a tick of the control loop.
+    //Something the control code learnt from another thread, with a time if it isn't NULL.
+    //A replay puts back what was learnt in the run.
+    virtual void observe(int *value, struct timespec *time) = 0;
+};
+
+inline HalJournal *&halJournal(){
+    static HalJournal *journal = NULL;
+    return journal;
+}
+
+inline void setHalJournal(HalJournal *journal){
+    halJournal() = journal;
+}
+
+inline void journalCommand(int left_dc, int right_dc){
+    if (halJournal() != NULL)
+        halJournal()->command(left_dc, right_dc);
+}
+
+inline void journalTick(){
+    if (halJournal() != NULL)
+        halJournal()->tick();
+}
+
+inline void journalObserve(int *value, struct timespec *time){
+    if (halJournal() != NULL)
+        halJournal()->observe(value, time);
+}
+
+//Passes the inputs of Policy to the journal.
+template <typename Policy>
+struct Journaled : Policy{
+    static int take_picture(){
+        int rc = Policy::take_picture();
+        if (halJournal() != NULL)
+            halJournal()->picture();
+        return rc;
+    }
+    static int read_digital(int chan){
+        int value = Policy::read_digital(chan);
+        if (halJournal() != NULL)
+            halJournal()->digital(chan, value);
+        return value;
+    }
+    static int read_analog(int in_ch_adc){
+        int value = Policy::read_analog(in_ch_adc);
+        if (halJournal() != NULL)
+            halJournal()->analog(in_ch_adc, value);
+        return value;
+    }
+};
+
+#ifdef HAL_SIM
+typedef Journaled<SimPolicy> HAL;
+#else
+typedef Journaled<E101Policy> HAL;
+#endif
+
+#endif
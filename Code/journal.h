@@ -0,0 +1,189 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <thread>
+#include <vector>
+#include "hal.h"
+#include "clock.h"
+
+//Input journal of a run: everything the control thread read, in order, so that the run can be
+//replayed offline (sim/replay_hal.cpp) and give the same decisions bit for bit.
+//It holds every clock reading, ADC and digital reading and picture of the control thread
+//(the thread that opened the journal), what it learnt from the other threads (gate monitor,
+//gate handshake), the motor commands the control code posted, and the start of every tick.
+//The pictures themselves are in the frame recording made alongside it. The other threads
+//themselves aren't journaled.
+//
+//Events are kept in memory, JOURNAL_CAPACITY of them (16 MB, over 20 minutes at 40 Hz), so
+//journaling costs a store per event, and are written when the journal is closed.
+
+const char     JOURNAL_MAGIC[8]  = {'J', 'O', 'U', 'R', 'N', 'A', 'L', '1'};
+const uint32_t JOURNAL_VERSION   = 1;
+const size_t   JOURNAL_CAPACITY  = 1 << 20;
+
+//Types of event.
+enum JournalEventType{
+    EVENT_CLOCK,   //time_ns: time read.
+    EVENT_ANALOG,  //channel, value.
+    EVENT_DIGITAL, //channel, value.
+    EVENT_PICTURE, //value: number of the picture since the start (FrameRecord::picture).
+    EVENT_COMMAND, //value: left duty cycle << 16 | right duty cycle (16 bits each).
+    EVENT_OBSERVE, //value, time_ns: learnt from another thread (see HalJournal::observe()).
+    EVENT_TICK,    //value: number of the tick.
+};
+
+//Structure to store an event.
+struct JournalEvent{
+    uint8_t  type;
+    uint8_t  channel;
+    uint16_t reserved;
+    int32_t  value;
+    int64_t  time_ns;
+};
+
+//Structure at the start of a journal file.
+struct JournalHeader{
+    char     magic[8];
+    uint32_t version;
+    uint32_t virtual_clock; //Recorded on a virtual clock (the simulator).
+    uint64_t events;
+    uint64_t dropped;       //Events past JOURNAL_CAPACITY: the journal stops short of the run.
+};
+
+//Packs a motor command into an event value.
+inline int32_t packCommand(int left_dc, int right_dc){
+    return (int32_t)(((uint32_t)(uint16_t)(int16_t)left_dc << 16) | (uint16_t)(int16_t)right_dc);
+}
+
+inline int commandLeft(int32_t value){
+    return (int16_t)(uint16_t)((uint32_t)value >> 16);
+}
+
+inline int commandRight(int32_t value){
+    return (int16_t)(uint16_t)value;
+}
+
+inline int64_t timespecNs(const struct timespec *t){
+    return (int64_t)t->tv_sec*1000000000LL + t->tv_nsec;
+}
+
+//Records the journal. It is both the HalJournal and the clock, which it puts in front of the
+//clock in use when it is opened.
+class JournalWriter : public HalJournal, public ClockSource{
+public:
+    std::vector<JournalEvent> events;
+    ClockSource              *inner;
+    std::thread::id           control_thread;
+    uint32_t                  pictures;
+    uint32_t                  ticks;
+    uint64_t                  dropped;
+
+    JournalWriter(){
+        inner    = NULL;
+        pictures = 0;
+        ticks    = 0;
+        dropped  = 0;
+    }
+
+    void now(struct timespec *t){
+        inner->now(t);
+        if (std::this_thread::get_id() == control_thread)
+            add(EVENT_CLOCK, 0, 0, timespecNs(t));
+    }
+    void sleepUntil(const struct timespec *deadline){ inner->sleepUntil(deadline); }
+    void attach(){ inner->attach(); }
+    void detach(){ inner->detach(); }
+    bool isVirtual(){ return inner->isVirtual(); }
+
+    void picture(){
+        if (std::this_thread::get_id() == control_thread)
+            add(EVENT_PICTURE, 0, pictures++, 0);
+    }
+    void analog(int chan, int value){
+        if (std::this_thread::get_id() == control_thread)
+            add(EVENT_ANALOG, chan, value, 0);
+    }
+    void digital(int chan, int value){
+        if (std::this_thread::get_id() == control_thread)
+            add(EVENT_DIGITAL, chan, value, 0);
+    }
+    void command(int left_dc, int right_dc){
+        if (std::this_thread::get_id() == control_thread)
+            add(EVENT_COMMAND, 0, packCommand(left_dc, right_dc), 0);
+    }
+    void tick(){
+        if (std::this_thread::get_id() == control_thread)
+            add(EVENT_TICK, 0, ticks++, 0);
+    }
+    void observe(int *value, struct timespec *time){
+        if (std::this_thread::get_id() == control_thread)
+            add(EVENT_OBSERVE, 0, *value, time != NULL ? timespecNs(time) : 0);
+    }
+
+private:
+    void add(int type, int channel, int32_t value, int64_t time_ns){
+        if (events.size() >= events.capacity()){
+            dropped++;
+            return;
+        }
+        JournalEvent event = {(uint8_t)type, (uint8_t)channel, 0, value, time_ns};
+        events.push_back(event);
+    }
+};
+
+//Starts journaling the calling thread. Call it before any other thread is started and before
+//anything reads the clock, so the replay starts from the same point.
+inline void openJournal(JournalWriter *journal){
+    journal->events.reserve(JOURNAL_CAPACITY);
+    journal->control_thread = std::this_thread::get_id();
+    journal->inner          = clockSource();
+    setClockSource(journal);
+    setHalJournal(journal);
+}
+
+//Stops journaling and writes the journal to file. Returns false, after printing why, if it can't.
+inline bool closeJournal(JournalWriter *journal, const char *file){
+    setHalJournal(NULL);
+    setClockSource(journal->inner);
+    FILE *out = fopen(file, "wb");
+    if (out == NULL){
+        fprintf(stderr, "Journal: can't create %s (%s)\n", file, strerror(errno));
+        return false;
+    }
+    JournalHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    header.version       = JOURNAL_VERSION;
+    header.virtual_clock = journal->inner->isVirtual();
+    header.events        = journal->events.size();
+    header.dropped       = journal->dropped;
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              fwrite(journal->events.data(), sizeof(JournalEvent), journal->events.size(), out) == journal->events.size();
+    ok = fclose(out) == 0 && ok;
+    if (!ok)
+        fprintf(stderr, "Journal: can't write %s\n", file);
+    printf("Journal: %u ticks, %zu events, %llu dropped\n", journal->ticks, journal->events.size(),
+           (unsigned long long)journal->dropped);
+    return ok;
+}
+
+//Reads a journal. Returns false if the file isn't one.
+inline bool loadJournal(const char *file, JournalHeader *header, std::vector<JournalEvent> *events){
+    FILE *in = fopen(file, "rb");
+    if (in == NULL)
+        return false;
+    bool ok = fread(header, sizeof(*header), 1, in) == 1 &&
+              memcmp(header->magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) == 0 && header->version == JOURNAL_VERSION;
+    if (ok){
+        events->resize(header->events);
+        ok = fread(events->data(), sizeof(JournalEvent), header->events, in) == header->events;
+    }
+    fclose(in);
+    return ok;
+}
+
+#endif
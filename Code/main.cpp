@@ -1,9 +1,34 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include "E101.h"
+#include <string.h>
+#include <math.h>
+#include <signal.h>
+#include "hal.h"
+#include "tuning.h"
+#include "scheduler.h"
+#include "pid.h"
+#include "speed_planner.h"
+#include "motor_driver.h"
+#include "motor_mailbox.h"
+#include "fsm.h"
+#include "coroutine.h"
+#include "gate_monitor.h"
+#include "gate_handshake.h"
+#include "frame_recorder.h"
+#include "frame_codec.h"
+#include "journal.h"
+#include "profiler.h"
+#include "trace.h"
 
-const int INITIAL_QUADRANT = 1; //Use this to skip quadrants when testing.
+const int  INITIAL_QUADRANT  = 1;     //Use this to skip quadrants when testing. -1 runs the TEST state. QUADRANT in the environment overrides it.
+const bool PRINT_TRANSITIONS = true;  //Prints every state change.
+
+//Control loop timing constants
+const long   CONTROL_PERIOD_US = 25000; //Period of the control loops (40 Hz).
+const double CONTROL_PERIOD_S  = CONTROL_PERIOD_US/1e6;
+const int    RT_PRIORITY       = 0;     //SCHED_FIFO priority (1 to 99). 0 keeps the default scheduler.
+const int    CONTROL_CPU       = -1;    //Core to pin the control loop to. -1 lets the kernel choose.
 
 //Sensors and motor constants
 const int F_SENSOR = 6; //Front sensor pin
@@ -17,13 +42,37 @@ const int R_MOTOR  = 1; //Right motor
   cause the H-bridge to get stuck, so MAX_DUTY_CYCLE is set to 254 instead. */
 const int MAX_DUTY_CYCLE  = 254; // Motor uses 100% capacity
 const int MIN_DUTY_CYCLE  = 30;  // Actually might be even lower than that.
-const int BASE_DUTY_CYCLE = 40;  //Duty cycle when error is zero.
+const int BASE_DUTY_CYCLE = TUNABLE(BASE_DUTY_CYCLE, 40); //Duty cycle used for turns and in Q4.
+const int MOTOR_DEADBAND  = 20;  //#todo measure. Wheels don't turn at all below this.
+const int MOTOR_SLEW_RATE = 1200; //Max. change of duty cycle per second (-40 to 40 takes 67ms).
+const long MOTOR_PERIOD_US   = 10000;  //Period of the motor output thread (100 Hz).
+const long MOTOR_FAILSAFE_US = 500000; //Motors stop if the control code posts nothing for this long.
+
+//Speed planning constants
+const int    MAX_BASE_DUTY_CYCLE = 80;  //#todo tune. Base duty cycle on clear straights.
+const int    JUNCTION_DUTY_CYCLE = 28;  //Base duty cycle on transversals (was 0.7*BASE_DUTY_CYCLE).
+const double ACCELERATION        = 80;  //Max. increase of the base duty cycle per second.
+const double DECELERATION        = 250; //Max. decrease of the base duty cycle per second.
+const double ERROR_SLOWDOWN      = 0.6; //Slowdown when the track is at the edge of the picture.
+const double CURVE_SLOWDOWN      = 0.8; //Slowdown when the track leaves the picture ahead.
+const double FRONT_FILTER        = 0.5; //Weight of a new front reading in the low-pass filter.
+const int    FRONT_CLEAR         = 150; //Front readings below this don't slow down.
 
 //Error calculation constants
-const int KP   = 30; //BASE_DUTY_CYCLE + KP cannot go past 254.
-const int KD   = 0;
-const int KPQ4 = 12;
-const int KDQ4 = 0;
+const double KP   = TUNABLE(KP, 30); //Quadrants 1 and 2. BASE_DUTY_CYCLE + KP cannot go past 254.
+const double KI   = TUNABLE(KI, 0); //Removes the steady offset on long curves. 0 until tuned.
+const double KD   = TUNABLE(KD, 0); //Derivative is in error percentage per second. 0 until tuned.
+const int    KPQ3 = 30;
+const double KIQ3 = 0;   //No integral in Q3: the track changes direction too often.
+const double KDQ3 = TUNABLE(KDQ3, 0);
+const double KPQ4 = TUNABLE(KPQ4, 12);
+const double KIQ4 = 0;
+const double KDQ4 = TUNABLE(KDQ4, 0);
+const double DERIVATIVE_FILTER = 0.3; //Low-pass weight of new derivative samples.
+const double MAX_INTEGRAL      = 10;  //Max. duty cycle correction coming from the integral.
+const PIDGains Q12_GAINS = {KP,   KI,   KD,   DERIVATIVE_FILTER, MAX_INTEGRAL};
+const PIDGains Q3_GAINS  = {KPQ3, KIQ3, KDQ3, DERIVATIVE_FILTER, MAX_INTEGRAL};
+const PIDGains Q4_GAINS  = {KPQ4, KIQ4, KDQ4, DERIVATIVE_FILTER, MAX_INTEGRAL};
 
 //Image processing constants
 const int PIC_WIDTH       = 320;
@@ -32,37 +81,65 @@ const int ROW             = PIC_HEIGHT-50;
 const int ROW_AHEAD       = 50;  //Used when we need to scan a row ahead of the ROW value.
 const int MIN_H_TRACK_WID = 30;  //Mininum number of white pixels for a track in a horizontal scan.
 const int MIN_V_TRACK_WID = 35;  //Mininum number of white pixels for a track in a vertical scan.
-const int TRANSVERSAL     = 290; //Mininum number of white pixels for a transversal line.
-const int PASSAGE         = 170; //Mininum number of white pixels for a left or right passage.
+const int TRANSVERSAL     = TUNABLE(TRANSVERSAL, 290); //Mininum number of white pixels for a transversal line.
+const int PASSAGE         = TUNABLE(PASSAGE, 170); //Mininum number of white pixels for a left or right passage.
 const int RED             = 0;
 const int GREEN           = 1;
 const int BLUE            = 2;
 const int LUM             = 3;   //Luminosity = (red value + green value + blue value)/3
 const int BASE_LUM_THRESH = 105;
 const bool AUTO_THRESHOLD = false; //If true, calculates luminosity threshold automatically before starting.
-const int MAX_BLK_NOISE   = 5;   //Max. number of consecutive black pixels inside a track.
+const int MAX_BLK_NOISE   = TUNABLE(MAX_BLK_NOISE, 5); //Max. number of consecutive black pixels inside a track.
 const int RED_THRESHOLD   = 135; //Value for which the component of a pixel will be considered red.
 const int GREEN_THRESHOLD = 100; //Value for which the component of a pixel will be considered green.
 const int BLUE_THRESHOLD  = 100; //Value for which the component of a pixel will be considered blue. 
 const int MIN_RED_COUNTER = 70;  //Number of reddish pixels a line must have to be considered red.
 
 //Distance control constants
-const int MIN_DISTANCE   = 250; //#todo Test and find a minimum distance to use in Q4. 250 is approx. 10cm.
+const int MIN_DISTANCE   = TUNABLE(MIN_DISTANCE, 250); //#todo Test and find a minimum distance to use in Q4. 250 is approx. 10cm.
 const int TURN_TIME_SEC  = 1;
 const int TURN_TIME_MSEC = 500000;
 const int TURN_TIME_TOT  = 1500000; //Microseconds
 
+//Quadrant 4 constants
+const int  Q4_MIN_DISTANCE   = TUNABLE(Q4_MIN_DISTANCE, 200);
+const int  BIGGER_DISTANCE   = TUNABLE(BIGGER_DISTANCE, 155); //If reading is lower than this, stops turning.
+const int  INTERNAL_DISTANCE = TUNABLE(INTERNAL_DISTANCE, 220); //If reading is lower than this, increases turning speed. (helps with U-turn)
+const long GATE_SLEEP        = 256666; //Microseconds, each of the three steps of the approach to the gate.
+const int  GATE_DISTANCE     = 180;    //Higher values requires the robot to be closer.
+const long TURN_SLEEP        = 150000; //Microseconds, used when it doesn't detect walls or when it detects both.
+const long GATE_SAMPLE_US    = 5000;     //Sampling period of the gate monitor (200 Hz).
+const int  GATE_HYSTERESIS   = 20;       //Gate counts as open again only below GATE_DISTANCE - GATE_HYSTERESIS.
+const long GATE_WAIT_TIMEOUT = 20000000; //Microseconds. Longest wait for the gate before the fallback.
+const long GATE_MARGIN       = 300000;   //Microseconds after the (predicted) opening to go, once the cycle is known.
+const long GATE_PASS_TIME    = 1200000;  //Microseconds the gate must stay open to get through it.
+const double GATE_SMOOTHING  = 0.3;      //Weight of a new cycle in the gate model.
+const char GATE_MODEL_FILE[] = "gate2_model.txt";
+const uint32_t RECORD_CAPACITY = 2400; //Frames a raw recording has room for (60 s, 740 MB), unless the card is fuller. See readRecordFile().
+const uint32_t KEYFRAME_INTERVAL = 40; //Frames between key frames of a compressed recording (1 s).
+const int      RECORD_TOLERANCE  = 25; //Max. error of a colour component in a compressed recording, above the camera noise. 0 is lossless.
+const FrameExactLines RECORD_EXACT = {3, 2, {ROW, ROW_AHEAD, ROW-20}, {0, PIC_WIDTH-1}}; //Lines the control code reads, kept without loss for replay.
+
 //Gates and Network constants
 char       PLEASE[]       = "Please";        //If set to "const", the compiler will complain...
-char       IP[]           = "130.195.6.196"; //If set to "const", the compiler will complain...
-const int  PORT           = 1024;
+char       IP[16]         = "130.195.6.196"; //If set to "const", the compiler will complain...
+const int  PORT           = 1024;           //GATE_IP and GATE_PORT in the environment override both (e.g. for tools/mock_gate_server).
 const int  GATE_TIMER     = 1500000; //Microseconds
+const int  HANDSHAKE_ATTEMPTS = 3;
+const long HANDSHAKE_TIMEOUT  = 3000000; //Microseconds an attempt may take before it counts as timed out.
 //const int  GATE2_DISTANCE = 200; //#todo find out what value to use.
 
 //Fields
-int    lum_threshold;
-long   previous_time;  //Used to calculate Kd.
-double previous_error; //Used to calculate Kd.
+int       lum_threshold;
+Scheduler control_loop; //Keeps every control loop on CONTROL_PERIOD_US.
+PID       track_pid;    //Line following in Q1 to Q3. Gains are switched when Q3 starts.
+PID       wall_pid;     //Wall following in Q4.
+MotorDriver  left_motor;   //Only used by the motor output thread.
+MotorDriver  right_motor;  //Only used by the motor output thread.
+MotorMailbox motor_mailbox;
+SpeedPlanner speed_planner = {JUNCTION_DUTY_CYCLE, MAX_BASE_DUTY_CYCLE, ACCELERATION, DECELERATION,
+                              ERROR_SLOWDOWN, CURVE_SLOWDOWN, FRONT_FILTER, FRONT_CLEAR, MIN_DISTANCE,
+                              JUNCTION_DUTY_CYCLE, 0};
 
 //Structure to store error data about tracks after image analysis. 
 struct ImageData{
@@ -80,16 +157,112 @@ struct Readings{
     int    min;
 };
 
+//Structure to store the sensor readings taken at the start of every tick.
+struct SensorSnapshot{
+    int  front;
+    bool left_wall;
+    bool right_wall;
+};
+
+//Formats of recording (RECORD_FORMAT in the environment).
+enum RecordFormat{
+    NO_RECORDING,
+    RECORD_RAW,       //frame_recorder.h: every picture as it is.
+    RECORD_COLOUR,    //frame_codec.h: compressed, RGB (the luminance is their mean).
+    RECORD_LUMINANCE, //frame_codec.h: compressed, luminance only.
+};
+
+//Fields shared between the states
+StateMachine   robot;
+SensorSnapshot sensors;
+ImageData      h_data;
+ImageData      previous_h_data;
+int            pix_on_left;
+int            pix_on_right;
+bool           turn_left = false;
+Task           gate2_task;
+GateMonitor    gate_monitor;
+GatePredictor  gate_predictor;
+GateHandshake  gate_handshake;
+int            server_port = PORT;
+int            start_quadrant = INITIAL_QUADRANT;
+FrameRecorder  recorder;
+FrameEncoder   encoder;
+int            recording = NO_RECORDING;
+PictureCopier  copier;
+FrameRecord   *pending_frame = NULL; //Picture taken this tick, described at the end of it.
+FrameRecord   *copied_frame  = NULL; //Picture described, added once it is copied.
+int            pictures      = 0;    //Pictures taken since the start.
+int            last_left_dc;         //Last motor command posted.
+int            last_right_dc;
+JournalWriter  journal;
+char           journal_file[256];
+char           trace_file[256] = ""; //Empty when not tracing.
+
+//Adds the picture described last to the recording, once the copier is done with it.
+void commitCopiedFrame(){
+    if (copied_frame == NULL)
+        return;
+    ProfileScope profile(PHASE_RECORD);
+    waitPictureCopy(&copier);
+    if (recording == RECORD_RAW)
+        commitFrame(&recorder, copied_frame);
+    else
+        commitEncodedFrame(&encoder, copied_frame);
+    copied_frame = NULL;
+}
+
+//Writes what was made of the picture taken last in its record. The record is added to the
+//recording with the next picture, when its copy is surely over.
+void recordFrame(){
+    if (pending_frame == NULL)
+        return;
+    ProfileScope profile(PHASE_RECORD);
+    FrameRecord *record = pending_frame;
+    pending_frame = NULL;
+    record->total_white_pixels = h_data.total_white_pixels;
+    record->white_pixels1      = h_data.white_pixels1;
+    record->white_pixels2      = h_data.white_pixels2;
+    record->error1             = (float)h_data.error1;
+    record->error2             = (float)h_data.error2;
+    record->left_dc            = (int16_t)last_left_dc;
+    record->right_dc           = (int16_t)last_right_dc;
+    copied_frame = record;
+}
+
+//Takes a picture and loads it to the memory. When recording, every picture is copied (for
+//replay) by the copier thread while the tick goes on, and described at the end of the tick.
+void takePicture(){
+    recordFrame(); //A second picture in the same tick.
+    commitCopiedFrame();
+    {
+        ProfileScope profile(PHASE_CAPTURE);
+        HAL::take_picture();
+    }
+    struct timespec now;
+    clockNow(&now); //Also when not recording, so a replay reads the clock as often as the run did.
+    int picture = pictures++;
+    if (recording == NO_RECORDING)
+        return;
+    pending_frame = recording == RECORD_RAW ? beginFrame(&recorder) : beginEncodedFrame(&encoder);
+    if (pending_frame == NULL)
+        return;
+    pending_frame->time_ns = timespecNs(&now);
+    pending_frame->state   = robot.current;
+    pending_frame->picture = picture;
+    copyPicture(&copier, framePixels(pending_frame));
+}
+
 //Establishes a threshold for the luminosity based on the minimum and maximum values
 //of pixels in a picture taken by the robot, or uses the BASE_LUM_THRESHOLD.
 void setLumThreshold(){
     lum_threshold = BASE_LUM_THRESH;
     if (AUTO_THRESHOLD){
-        take_picture();
+        takePicture();
         int min = 255;
         int max = 0;
         for (int x = 0; x <PIC_WIDTH; x++){
-            int luminosity = get_pixel(ROW,x,LUM);
+            int luminosity = HAL::get_pixel(ROW,x,LUM);
             if(luminosity > max)
                 max = luminosity;
             if (luminosity < min)
@@ -102,7 +275,7 @@ void setLumThreshold(){
 //Reads left digital sensor and returns true if an obstacle is close.
 bool leftWall(){
     bool is_close        = false;
-    int  digital_reading = read_digital(L_SENSOR);
+    int  digital_reading = HAL::read_digital(L_SENSOR);
     if (digital_reading == 0)
         is_close = true;
     return is_close;
@@ -111,7 +284,7 @@ bool leftWall(){
 //Reads right digital sensor and returns true if an obstacle is close.
 bool rightWall(){
     bool is_close        = false;
-    int  digital_reading = read_digital(R_SENSOR);
+    int  digital_reading = HAL::read_digital(R_SENSOR);
     if (digital_reading == 0)
         is_close = true;
     return is_close;
@@ -127,9 +300,9 @@ Readings readAnalogSensor(int sensor, int number_of_readings){
     int    max_reading     = 0;
     int    min_reading     = 2000;
     double average_reading = 0;
-    
+    ProfileScope profile(PHASE_SENSORS);
     for (int i = 0; i < number_of_readings; i++){
-        adc_reading     = read_analog(sensor);
+        adc_reading     = HAL::read_analog(sensor);
         average_reading = (i*average_reading + adc_reading)/(i+1); //calculates average as it goes.
         if (adc_reading > max_reading){
             max_reading = adc_reading;
@@ -144,26 +317,27 @@ Readings readAnalogSensor(int sensor, int number_of_readings){
 
 //Analyses a picture horizontally and returns corresponding error signals and number of white pixels.
 ImageData getHorizontalData(int y){
+    ProfileScope profile(PHASE_HORIZONTAL);
     //y is the vertical coordinate of the row to be analyzed in the picture.
     //Pixels in the LEFT side of the image are assigned NEGATIVE values.
     //Pixels in the RIGHT side of the image are assigned POSITIVE values.
     int    pixel_value        = -PIC_WIDTH/2; //Value of the first pixel.
     int    track_number       = 0;
-    double error[]            = {0,0}; //error[0] for first track detected, error[1] for second.
+    double error[]            = {0,0,0}; //error[0] for first track detected, error[1] for second, error[2] for any other (dropped).
     int    total_white_pixels = 0;
-    int    white_counter[]    = {0,0};
+    int    white_counter[]    = {0,0,0};
     int    black_counter      = 0;
     double noise_correction   = 0; //To account for small number of black pixels inside a track.
     for (int x = 0; x < PIC_WIDTH; x++){
-        int luminosity = get_pixel(y, x, LUM); //Gets luminosity (whiteness) of pixel.
+        int luminosity = HAL::get_pixel(y, x, LUM); //Gets luminosity (whiteness) of pixel.
         if (luminosity > lum_threshold){
             //Pixel is assumed to be white.
             white_counter[track_number]++;
             total_white_pixels++;
             error[track_number] += pixel_value;
             if (black_counter > 0){
-                int lum1 = get_pixel(y,x-1, LUM);
-                int lum2 = get_pixel(y,x-2, LUM);
+                int lum1 = HAL::get_pixel(y,x-1, LUM);
+                int lum2 = HAL::get_pixel(y,x-2, LUM);
                 if(lum1 > lum_threshold && lum2 > lum_threshold){
                     //Noise detected by the presence of black pixels inside the track
                     //is only incorporated if previous two pictures are also white.
@@ -188,11 +362,16 @@ ImageData getHorizontalData(int y){
                     error[track_number]         = 0;
                     white_counter[track_number] = 0;
                 }
-                else{
+                else if (track_number < 2){
                     //It is the right end of a track.
                     //Start getting error for a possible second track in the picture
                     track_number++;
                 }
+                else{
+                    //Third track or more: only its white pixels count.
+                    error[track_number]         = 0;
+                    white_counter[track_number] = 0;
+                }
             }
         }
         pixel_value++;
@@ -215,9 +394,10 @@ ImageData getHorizontalData(int y){
 
 //Returns number of white pixels in a vertical scan.
 int verticalWhitePix(int x){
+    ProfileScope profile(PHASE_VERTICAL);
     int v_white_counter = 0;
     for (int y = 0; y < PIC_HEIGHT; y++){
-        int luminosity = get_pixel(y, x, LUM); //Gets luminosity (whiteness) of pixel.
+        int luminosity = HAL::get_pixel(y, x, LUM); //Gets luminosity (whiteness) of pixel.
         if (luminosity > lum_threshold)
             v_white_counter++;
     }
@@ -226,12 +406,13 @@ int verticalWhitePix(int x){
 
 //Checks if there is a red line in the picture.
 bool isRedLine(){
+    ProfileScope profile(PHASE_RED_LINE);
     bool result      = false;
     int  red_counter = 0;
     for (int x = 0; x < PIC_WIDTH; x++){
-        int red_value   = get_pixel(ROW, x, RED);
-        int green_value = get_pixel(ROW, x, GREEN);
-        int blue_value  = get_pixel(ROW, x, BLUE);
+        int red_value   = HAL::get_pixel(ROW, x, RED);
+        int green_value = HAL::get_pixel(ROW, x, GREEN);
+        int blue_value  = HAL::get_pixel(ROW, x, BLUE);
         if (red_value > RED_THRESHOLD &&
             green_value < GREEN_THRESHOLD &&
             blue_value < BLUE_THRESHOLD)
@@ -242,553 +423,822 @@ bool isRedLine(){
     return result;
 }
 
+//Posts a command for both motors. The motor output thread applies it.
+void drive(int left_dc, int right_dc){
+    ProfileScope profile(PHASE_ACTUATION);
+    postMotorCommand(&motor_mailbox, left_dc, right_dc);
+    trace(TRACE_MOTOR, left_dc, right_dc);
+    journalCommand(left_dc, right_dc);
+    last_left_dc  = left_dc;
+    last_right_dc = right_dc;
+}
+
+//Waits for the next tick of the control loop. To wait for longer, use
+//waitTicks(&control_loop, duration_us, journalTick).
+void nextTick(){
+    waitForTick(&control_loop);
+    journalTick();
+}
+
+//Scans a row ahead of ROW and updates the base duty cycle from the tracking error, how much
+//the track bends between both rows, how close the next junction is and the front distance.
+double updateSpeed(ImageData h_data, int front_reading){
+    ImageData ahead     = getHorizontalData(ROW_AHEAD);
+    double    error     = h_data.error1/(PIC_WIDTH/2.0);
+    double    curvature = 0;
+    if (ahead.white_pixels1 < MIN_H_TRACK_WID)
+        curvature = 1; //The track leaves the picture before reaching the row ahead.
+    else if (h_data.white_pixels1 >= MIN_H_TRACK_WID)
+        curvature = fabs(ahead.error1 - h_data.error1)/(PIC_WIDTH/2.0);
+    //A single track ahead has at most 2*MIN_H_TRACK_WID white pixels; a passage is PASSAGE wide.
+    double junction = (ahead.total_white_pixels - 2.0*MIN_H_TRACK_WID)/(PASSAGE - 2.0*MIN_H_TRACK_WID);
+    return planSpeed(&speed_planner, error, curvature, junction, front_reading, CONTROL_PERIOD_S);
+}
+
+//Slows down towards JUNCTION_DUTY_CYCLE while crossing a transversal and returns the duty cycle.
+int junctionSpeed(int front_reading){
+    return (int)planSpeed(&speed_planner, 0, 0, 1, front_reading, CONTROL_PERIOD_S);
+}
+
+//Drives both motors with a differential correction around the base duty cycle.
+//Both duty cycles are kept within MIN_DUTY_CYCLE..MAX_DUTY_CYCLE. If one of them would fall
+//out of that range, the excess is moved to the other motor so the difference between them
+//(i.e. how sharply the robot turns) is preserved.
+void applyCorrection(int base_duty_cycle, double duty_cycle_correction){
+    double left_dc  = base_duty_cycle + duty_cycle_correction;
+    double right_dc = base_duty_cycle - duty_cycle_correction;
+    if (left_dc < MIN_DUTY_CYCLE){
+        right_dc += MIN_DUTY_CYCLE - left_dc;
+        left_dc   = MIN_DUTY_CYCLE;
+    }
+    else if (right_dc < MIN_DUTY_CYCLE){
+        left_dc  += MIN_DUTY_CYCLE - right_dc;
+        right_dc  = MIN_DUTY_CYCLE;
+    }
+    if (left_dc > MAX_DUTY_CYCLE)
+        left_dc = MAX_DUTY_CYCLE;
+    if (right_dc > MAX_DUTY_CYCLE)
+        right_dc = MAX_DUTY_CYCLE;
+
+    drive((int)left_dc, (int)right_dc); //Final duty cycle must be an int.
+}
+
 //Follows a white track according to the error provided.
 void followTrack(ImageData image_data){
-    //Still need to implement derivative and determine value for KD.
     double error_percentage      = image_data.error1/(PIC_WIDTH/2.0);
-    double derivative            = 0;
-    double duty_cycle_correction = error_percentage*KP + derivative*KD;
-
-    set_motor(L_MOTOR,BASE_DUTY_CYCLE+(int)duty_cycle_correction); //Final duty cycle must be an int.
-    set_motor(R_MOTOR,BASE_DUTY_CYCLE-(int)duty_cycle_correction);
+    double duty_cycle_correction = updatePID(&track_pid, error_percentage);
+    applyCorrection((int)speed_planner.speed, duty_cycle_correction);
 }
 
 //Controls the position of the robot in the walled maze.
 void q4Control(double current_state){
-    //Still need to implement derivative and determine value for KD.
     //current_state values:
     //    -100 <= current_state  < 0    Robot is far from left wall.
     //            current_state == 0    Robot is in the middle of the path.
     //       0 <  current_state <= 100  Robot is far from right wall.
+    double error_percentage      = current_state/100.0;
+    double duty_cycle_correction = updatePID(&wall_pid, error_percentage);
+    applyCorrection((int)speed_planner.speed, duty_cycle_correction);
+}
+
+//==== State machine ==============================================================================
+//Every state function below does one control step and returns. The loops in main() used to
+//block inside each behaviour (lost-track spins, transversal crossings, gate waits, Q4 turns);
+//now each of those is a state, and main() gets control back on every tick.
+
+//Events returned by the state functions.
+enum Event{
+    STAY = FSM_STAY,
+    DONE,
+    FOUND_TRACK,
+    LOST_TRACK,
+    TRANSVERSAL_FOUND,
+    PASSAGE_BOTH_SIDES,
+    RED_LINE_FOUND,
+    WALL_ON_LEFT,
+    WALL_ON_RIGHT,
+    DEAD_END
+};
+
+const char *const EVENT_NAMES[] = {"STAY", "DONE", "FOUND_TRACK", "LOST_TRACK", "TRANSVERSAL_FOUND",
+                                   "PASSAGE_BOTH_SIDES", "RED_LINE_FOUND", "WALL_ON_LEFT", "WALL_ON_RIGHT",
+                                   "DEAD_END"};
+
+//Decisions taken at junctions in Q3, for the trace.
+enum JunctionDecision{
+    JUNCTION_TRANSVERSAL,
+    JUNCTION_AHEAD,       //Passage, but the track goes on.
+    JUNCTION_BOTH_SIDES,
+    JUNCTION_RIGHT,
+    JUNCTION_LEFT,
+    JUNCTION_NONE,        //Passage, but no track on either side.
+    JUNCTION_DECISIONS
+};
+
+const char *const JUNCTION_NAMES[] = {"transversal", "ahead", "both sides", "right", "left", "none"};
+
+//States. The order must match the states[] table.
+enum State{
+    Q1_OPEN_GATE,
+    Q1_GATE_WAIT,
+    Q2_FOLLOW,
+    Q2_SEARCH,
+    Q2_CROSS,
+    Q3_FOLLOW,
+    Q3_PASSAGE_NUDGE,
+    Q3_CROSS,
+    Q3_TURN_LEFT,
+    Q3_SEARCH,
+    Q3_CROSS_RED,
+    Q4_DRIVE,
+    Q4_TURN_RIGHT,
+    Q4_TURN_LEFT,
+    Q4_REVERSE_TURN,
+    Q4_GATE,
+    TEST,
+    STATE_COUNT
+};
+
+//Returns true once the current state has been running for at least duration_us.
+bool stateElapsed(long duration_us){
+    return robot.ticks_in_state*CONTROL_PERIOD_US >= duration_us;
+}
+
+//Returns true on the first tick of the state and then once every period_us.
+bool stateEvery(long period_us){
+    long period_ticks = (period_us + CONTROL_PERIOD_US - 1)/CONTROL_PERIOD_US;
+    return (robot.ticks_in_state - 1)%period_ticks == 0;
+}
+
+//Reads the sensors once per tick, before the current state runs.
+void sampleSensors(){
+    ProfileScope profile(PHASE_SENSORS);
+    sensors.front      = HAL::read_analog(F_SENSOR);
+    sensors.left_wall  = leftWall();
+    sensors.right_wall = rightWall();
+    trace(TRACE_SENSORS, sensors.front, sensors.left_wall | sensors.right_wall << 1);
+}
+
+//Guard for line following states: stops while there is an obstacle ahead.
+bool collisionGuard(){
+    if (sensors.front > MIN_DISTANCE){
+        drive(0, 0);
+        resetSpeed(&speed_planner);
+        return false;
+    }
+    return true;
+}
+
+//Sets up controllers and speed limits when a quadrant starts.
+void startQuadrant(int quad){
+    setProfileQuadrant(quad);
+    if (quad == 3){
+        setPIDGains(&track_pid, Q3_GAINS);
+    }
+    else if (quad == 4){
+        setSpeedLimits(&speed_planner, MIN_DUTY_CYCLE, BASE_DUTY_CYCLE);
+        speed_planner.front_stop = Q4_MIN_DISTANCE;
+        resetSpeed(&speed_planner);
+    }
+}
+
+//Stops both motors when entering a state.
+void stopMotors(){
+    drive(0, 0);
+}
+
+//==== QUADRANT 1&2 ===============================================================================
+//Goal: open gate and follow single track until Quad 3
+
+int openGate(){
+    //The handshake was started by main() and may well be finished by now.
+    switch (pollGateHandshake(&gate_handshake)){
+        case HANDSHAKE_DONE:
+            return DONE;
+        case HANDSHAKE_FAILED:
+            fprintf(stderr, "Gate 1: no answer from the server, going once the way is clear.\n");
+            return DONE;
+        default:
+            return STAY;
+    }
+}
+
+int waitForGate1(){
+    //The gate takes GATE_TIMER to open, counted from the end of the handshake.
+    if (handshakeAge(&gate_handshake) < GATE_TIMER)
+        return STAY;
+    //Without an answer the gate may be shut (or opened by someone else): wait for it to clear.
+    if (gate_handshake.status == HANDSHAKE_FAILED && sensors.front >= GATE_DISTANCE - GATE_HYSTERESIS)
+        return STAY;
+    return DONE;
+}
+
+int followQ2(){
+    takePicture(); //Take a picture and loads it to the memory.
+    h_data = getHorizontalData(ROW);
+    updateSpeed(h_data, sensors.front);
     
-    double error_percentage = current_state/100.0;
-    
-    //long   time             = get current time...
-    double error_variation  = 1.0;//*(error_percentage - previous_error)/(time - previous_time);
-    //previous_time           = time;
-    //previous_error          = error
-    
-    double duty_cycle_correction = error_percentage*KPQ4 + error_variation*KDQ4;
+    if(h_data.total_white_pixels >= TRANSVERSAL){
+        //Found a transversal track.
+        //Robot is reaching Quadrant 3; Q2_CROSS controls the transition.
+        return TRANSVERSAL_FOUND;
+    }
+    else if(h_data.white_pixels1 >= MIN_H_TRACK_WID){
+        //Follow the detected track.
+        followTrack(h_data);
+        previous_h_data = h_data;
+        return STAY;
+    }
+    //Lost track; must use data from previous picture to find it.
+    return LOST_TRACK;
+}
 
-    set_motor(L_MOTOR,BASE_DUTY_CYCLE+(int)duty_cycle_correction); //Final duty cycle must be an int.
-    set_motor(R_MOTOR,BASE_DUTY_CYCLE-(int)duty_cycle_correction);
+int searchQ2(){
+    if(previous_h_data.error1 < 0){
+        //Track was on the left side before it was lost.
+        drive((int)-BASE_DUTY_CYCLE, (int) BASE_DUTY_CYCLE);
+    }
+    else if(previous_h_data.error1 > 0){
+        //Track was on the right side before it was lost.
+        drive((int) BASE_DUTY_CYCLE, (int)-BASE_DUTY_CYCLE);
+    }
+    else {
+        //Inconclusive and highly unlike to happen, go back.
+        drive((int)-BASE_DUTY_CYCLE, (int)-BASE_DUTY_CYCLE);
+    }
+    takePicture();
+    h_data = getHorizontalData(ROW);
+    if(h_data.white_pixels1 >= MIN_H_TRACK_WID){
+        //Found a track.
+        resetSpeed(&speed_planner);
+        followTrack(h_data);
+        previous_h_data = h_data;
+        return FOUND_TRACK;
+    }
+    return STAY;
 }
 
-//==== Main =======================================================================================
-int main(){
-    int       quad = INITIAL_QUADRANT; //Flag to change quadrants.
-    int       front_reading;
-    ImageData h_data;
-    ImageData previous_h_data;
+int crossQ2(){
+    //Slow down
+    junctionSpeed(sensors.front);
+    takePicture();
+    h_data = getHorizontalData(ROW);
+    if(h_data.total_white_pixels < TRANSVERSAL){
+        //Crossed the transversal: Quadrant 3 starts.
+        return DONE;
+    }
+    //Gets error of a region ahead of the transversal
+    ImageData ahead = getHorizontalData(ROW_AHEAD);
+    if(ahead.white_pixels1 >= MIN_H_TRACK_WID){
+        followTrack(ahead);
+        previous_h_data = ahead;
+    }
+    else{
+        //Didn't find a track ahead.
+        //This is very unlikely in Q2, it might have missed the first transversal.
+        drive((int) BASE_DUTY_CYCLE, (int)-BASE_DUTY_CYCLE);
+    }
+    return STAY;
+}
+
+//==== QUADRANT 3 =================================================================================
+//Goal: finish the maze of white tracks.
+
+int followQ3(){
+    takePicture(); //Take a picture and loads it to the memory.
     
-    init();
-    select_IO(L_SENSOR, 1); //Sets digital sensor channel to input mode.
-    select_IO(R_SENSOR, 1);
+    if (isRedLine() && (sensors.left_wall || sensors.right_wall)){ //Remove the walls conditions if you have problems.
+        //Robot is reaching Quadrant 4.
+        return RED_LINE_FOUND;
+    }
     
-    setLumThreshold();
-
-    //==== QUADRANT 1&2 ===========================================================================
-    while(quad == 1 || quad == 2){
-        //Quadrant 1 and 2
-        //Goal: open gate and follow single track until Quad 3
-        front_reading = readAnalogSensor(F_SENSOR, 1).average;
-        
-        if (front_reading>MIN_DISTANCE || quad == 1){
-            //Avoid collisions.
-            set_motor(L_MOTOR,0);
-            set_motor(R_MOTOR,0);
-            if (quad == 1){
-                char message[24];
-                connect_to_server(IP, PORT);
-                send_to_server(PLEASE);
-                receive_from_server(message);
-                send_to_server(message);
-                quad = 2;
-                usleep(GATE_TIMER);
-            }
+    h_data = getHorizontalData(ROW);
+    updateSpeed(h_data, sensors.front);
+    
+    if(h_data.total_white_pixels >= TRANSVERSAL){
+        //This is a transversal track
+        //The best option in this case is always to take the path to the left
+        trace(TRACE_JUNCTION, JUNCTION_TRANSVERSAL, h_data.total_white_pixels);
+        return TRANSVERSAL_FOUND;
+    }
+    else if(h_data.total_white_pixels >= PASSAGE){
+        //Tries to get track ahead.
+        previous_h_data = h_data;
+        h_data          = getHorizontalData(ROW_AHEAD);
+        if (h_data.white_pixels1 >= MIN_H_TRACK_WID){
+            trace(TRACE_JUNCTION, JUNCTION_AHEAD, previous_h_data.total_white_pixels);
+            followTrack(h_data);
+            previous_h_data = h_data;
         }
-        else {
-            take_picture(); //Take a picture and loads it to the memory.
-            h_data = getHorizontalData(ROW);
-            
-            if(h_data.total_white_pixels >= TRANSVERSAL){
-                //Found a transversal track.
-                //Robot is reaching Quadrant 3; the loop bellow controls the transition.
-                //Slow down
-                set_motor(L_MOTOR,(int)BASE_DUTY_CYCLE*0.7);
-                set_motor(R_MOTOR,(int)BASE_DUTY_CYCLE*0.7);
-                while(h_data.total_white_pixels >= TRANSVERSAL){
-                    //Gets error of a region ahead of the transversal
-                    previous_h_data = h_data;
-                    h_data = getHorizontalData(ROW_AHEAD);
-                    if(h_data.white_pixels1 >= MIN_H_TRACK_WID){
-                        followTrack(h_data);
-                        previous_h_data = h_data;
-                    }
-                    else{
-                        //Didn't find a track ahead.
-                        //This is very unlikely in Q2, it might have missed the first transversal.
-                        set_motor(L_MOTOR,(int) BASE_DUTY_CYCLE);
-                        set_motor(R_MOTOR,(int)-BASE_DUTY_CYCLE);
-                    }
-                    take_picture();
-                    h_data = getHorizontalData(ROW);
-                }
-                quad = 3; //Flag to start Q3
+        else{
+            drive(0, 0);
+            pix_on_left  = verticalWhitePix(0);
+            pix_on_right = verticalWhitePix(PIC_WIDTH-1);
+            if (pix_on_right >= MIN_V_TRACK_WID && pix_on_left >= MIN_V_TRACK_WID){
+                trace(TRACE_JUNCTION, JUNCTION_BOTH_SIDES, previous_h_data.total_white_pixels);
+                return PASSAGE_BOTH_SIDES;
             }
-            else if(h_data.white_pixels1 >= MIN_H_TRACK_WID){
-                //Follow the detected track.
-                followTrack(h_data);
-                previous_h_data = h_data;
+            if (pix_on_right >= MIN_V_TRACK_WID){
+                trace(TRACE_JUNCTION, JUNCTION_RIGHT, previous_h_data.total_white_pixels);
+                drive((int) BASE_DUTY_CYCLE, (int)-BASE_DUTY_CYCLE);
             }
-            else {
-                //Lost track; must use data from previous picture to find it.
-                set_motor(L_MOTOR,0);
-                set_motor(R_MOTOR,0);
-                while(h_data.white_pixels1 < MIN_H_TRACK_WID){
-                    if(previous_h_data.error1 < 0){
-                        //Track was on the left side before it was lost.
-                        set_motor(L_MOTOR,(int)-BASE_DUTY_CYCLE);
-                        set_motor(R_MOTOR,(int) BASE_DUTY_CYCLE);
-                    }
-                    else if(previous_h_data.error1 > 0){
-                        //Track was on the right side before it was lost.
-                        set_motor(L_MOTOR,(int) BASE_DUTY_CYCLE);
-                        set_motor(R_MOTOR,(int)-BASE_DUTY_CYCLE);
-                    }
-                    else {
-                        //Inconclusive and highly unlike to happen, go back.
-                        set_motor(L_MOTOR,(int)-BASE_DUTY_CYCLE);
-                        set_motor(R_MOTOR,(int)-BASE_DUTY_CYCLE);
-                    }
-                    take_picture();
-                    h_data = getHorizontalData(ROW);
-                }
-                //Found a track.
-                followTrack(h_data);
-                previous_h_data = h_data;
+            else if (pix_on_left >= MIN_V_TRACK_WID){
+                trace(TRACE_JUNCTION, JUNCTION_LEFT, previous_h_data.total_white_pixels);
+                drive((int)-BASE_DUTY_CYCLE, (int) BASE_DUTY_CYCLE);
             }
+            else
+                trace(TRACE_JUNCTION, JUNCTION_NONE, previous_h_data.total_white_pixels);
         }
+        return STAY;
+    }
+    else if(h_data.white_pixels1 >= MIN_H_TRACK_WID){
+        //Follow the detected track.
+        followTrack(h_data);
+        previous_h_data = h_data;
+        return STAY;
+    }
+    return LOST_TRACK;
+}
+
+//Passages on both sides: turn left for a moment, then start turning right.
+void enterPassageNudge(){
+    drive((int)-BASE_DUTY_CYCLE, (int) BASE_DUTY_CYCLE);
+}
+
+int passageNudge(){
+    if (stateElapsed(100000)){
+        drive((int) BASE_DUTY_CYCLE, (int)-BASE_DUTY_CYCLE);
+        return DONE;
     }
+    return STAY;
+}
+
+int crossQ3(){
+    //Advances until losing sight of transversal.
+    int junction_dc = junctionSpeed(sensors.front);
+    drive(junction_dc, junction_dc);
+    takePicture();
+    h_data          = getHorizontalData(ROW);
+    previous_h_data = h_data;
+    if (h_data.white_pixels1 < TRANSVERSAL)
+        return DONE;
+    return STAY;
+}
+
+int turnLeftQ3(){
+    //Tries to get track slightly ahead, turning left until finding a new track.
+    takePicture();
+    h_data = getHorizontalData(ROW-20);
+    if (h_data.white_pixels1 >= MIN_H_TRACK_WID){
+        resetSpeed(&speed_planner);
+        followTrack(h_data);
+        previous_h_data = h_data;
+        return FOUND_TRACK;
+    }
+    drive((int)-BASE_DUTY_CYCLE, (int) BASE_DUTY_CYCLE);
+    return STAY;
+}
+
+//Uses the vertical scans of the picture where the track was lost to choose the direction.
+void enterSearchQ3(){
+    drive(0, 0);
+    pix_on_left  = verticalWhitePix(0);
+    pix_on_right = verticalWhitePix(PIC_WIDTH-1);
+}
+
+int searchQ3(){
+    //Turns to some direction until finding a track and having it on the central area of the image.
+    //Note: try different values for the abs(error1) condition if robot is turning past the track or stops turning before it is centered.
     
-    //==== QUADRANT 3 =============================================================================
-    bool red_line;
-    while(quad == 3){
-        //Goal: finish the maze of white tracks.
-        front_reading = readAnalogSensor(F_SENSOR, 1).average;
-        
-        if (front_reading>MIN_DISTANCE){
-            //Avoid collisions.
-            set_motor(L_MOTOR,0);
-            set_motor(R_MOTOR,0);
+    //If robot turns to the wrong side in a corner, there might be a problem with the results from verticalWhitePix().
+    //With the camera too close to the ground, the images are too "zoomed" and vertical scans become more unreliable.
+    //Try removing the block of ifs that relies on vertical scans if it is not working well.
+    if(previous_h_data.error1 > 0 && pix_on_left < MIN_V_TRACK_WID && pix_on_right >= MIN_V_TRACK_WID){
+        //Guaranteed to be on the right.
+        drive((int) BASE_DUTY_CYCLE, (int)-BASE_DUTY_CYCLE);
+    }
+    else if(previous_h_data.error1 < 0 && pix_on_left >= MIN_V_TRACK_WID && pix_on_right < MIN_V_TRACK_WID){
+        //Guaranteed to be on the left.
+        drive((int)-BASE_DUTY_CYCLE, (int) BASE_DUTY_CYCLE);
+    }
+    else if(previous_h_data.error1 < 0 && pix_on_left < MIN_V_TRACK_WID && pix_on_right >= MIN_V_TRACK_WID){
+        //Likely to be on the right.
+        drive((int) BASE_DUTY_CYCLE, (int)-BASE_DUTY_CYCLE);
+    }
+    else if(previous_h_data.error1 > 0 && pix_on_left >= MIN_V_TRACK_WID && pix_on_right < MIN_V_TRACK_WID){
+        //Likely to be on the left.
+        drive((int)-BASE_DUTY_CYCLE, (int) BASE_DUTY_CYCLE);
+    }
+    //Try this if the robot is turning to the wrong direction on the last transversal.
+    else if(pix_on_left >= MIN_V_TRACK_WID && pix_on_right >= MIN_V_TRACK_WID){
+        //Possibly the second transversal.
+        drive((int)-BASE_DUTY_CYCLE, (int) BASE_DUTY_CYCLE);
+    }
+    //This part doesn't rely on vertical scans.
+    else {
+        //Ideally, it shouldn't come to this in corners: the vertical scans should be able to
+        //tell the direction to follow...
+        //It's hard to tell which way to go in this case, it will follow previous_h_data.
+        if(previous_h_data.error1 < 0){
+            //Track was on the left side before it was lost.
+            drive((int)-BASE_DUTY_CYCLE, (int) BASE_DUTY_CYCLE);
+        }
+        else if(previous_h_data.error1 > 0){
+            //Track was on the right side before it was lost.
+            drive((int) BASE_DUTY_CYCLE, (int)-BASE_DUTY_CYCLE);
         }
         else {
-            take_picture(); //Take a picture and loads it to the memory.
-            
-            red_line = isRedLine();
-            if (red_line && (leftWall() || rightWall())){ //Remove the walls conditions if you have problems.
-                //Robot is reaching Quadrant 4.
-                while(red_line){
-                    //Wait for it to cross the red line before switching to quad 4 loop.
-                    if (leftWall() && !rightWall())
-                        q4Control(50);
-                    else if (!leftWall() && rightWall())
-                        q4Control(-50);
-                    else
-                        q4Control(0);
-                    take_picture();
-                    red_line = isRedLine();
-                }
-                quad = 4;
-                break;
-            }
-            
-            h_data = getHorizontalData(ROW);
-            
-            if(h_data.total_white_pixels >= TRANSVERSAL){
-                //This is a transversal track
-                //The best option in this case is always to take the path to the left
-                
-                while(h_data.white_pixels1 >= TRANSVERSAL){
-                    //Advances until losing sight of transversal.
-                    set_motor(L_MOTOR,(int)BASE_DUTY_CYCLE*0.7);
-                    set_motor(R_MOTOR,(int)BASE_DUTY_CYCLE*0.7);
-                    take_picture();
-                    h_data = getHorizontalData(ROW);
-                    previous_h_data = h_data;
-                }
-                
-                //Tries to get track slightly ahead.
-                h_data = getHorizontalData(ROW-20);
-                while(h_data.white_pixels1 < MIN_H_TRACK_WID){
-                    //Turns left until finding a new track
-                    set_motor(L_MOTOR,(int)-BASE_DUTY_CYCLE);
-                    set_motor(R_MOTOR,(int) BASE_DUTY_CYCLE);
-                    take_picture();
-                    h_data = getHorizontalData(ROW-20);
-                    usleep(100000);
-                }
-                followTrack(h_data);
-                previous_h_data = h_data;
-            }
-            else if(h_data.total_white_pixels >= PASSAGE){
-                //Tries to get track ahead.
-                previous_h_data = h_data;
-                h_data          = getHorizontalData(ROW_AHEAD);
-                if (h_data.white_pixels1 >= MIN_H_TRACK_WID){
-                    followTrack(h_data);
-                    previous_h_data = h_data;
-                }
-                else{
-                    set_motor(L_MOTOR,0);
-                    set_motor(R_MOTOR,0);
-                    int pix_on_left  = verticalWhitePix(0);
-                    int pix_on_right = verticalWhitePix(PIC_WIDTH-1);
-                    if (pix_on_right >= MIN_V_TRACK_WID && pix_on_left >= MIN_V_TRACK_WID){
-                        set_motor(L_MOTOR,(int)-BASE_DUTY_CYCLE);
-                        set_motor(R_MOTOR,(int) BASE_DUTY_CYCLE);
-                        usleep(100000);
-                    }
-                    if (pix_on_right >= MIN_V_TRACK_WID){
-                        set_motor(L_MOTOR,(int) BASE_DUTY_CYCLE);
-                        set_motor(R_MOTOR,(int)-BASE_DUTY_CYCLE);
-                        //usleep(75000);
-                    }
-                    else if (pix_on_left >= MIN_V_TRACK_WID){
-                        set_motor(L_MOTOR,(int)-BASE_DUTY_CYCLE);
-                        set_motor(R_MOTOR,(int) BASE_DUTY_CYCLE);
-                        //usleep(75000);
-                    }
-                }
-            }
-            else if(h_data.white_pixels1 >= MIN_H_TRACK_WID){
-                //Follow the detected track.
-                followTrack(h_data);
-                previous_h_data = h_data;
-            }
-            else { //h_data.white_pixels1 < MIN_H_TRACK_WID
-                set_motor(L_MOTOR,0);
-                set_motor(R_MOTOR,0);
-            
-                int pix_on_left  = verticalWhitePix(0);
-                int pix_on_right = verticalWhitePix(PIC_WIDTH-1);
-                
-                while(h_data.white_pixels1 < MIN_H_TRACK_WID || abs(h_data.error1) > 100){
-                    //Turns to some direction until finding a track and having it on the central area of the image.
-                    //Note: try different values for the second condition if robot is turning past the track or stops turning before it is centered.
-                    
-                    //If robot turns to the wrong side in a corner, there might be a problem with the results from verticalWhitePix().
-                    //With the camera too close to the ground, the images are too "zoomed" and vertical scans become more unreliable.
-                    //Try removing the block of ifs that relies on vertical scans if it is not working well.
-                    if(previous_h_data.error1 > 0 && pix_on_left < MIN_V_TRACK_WID && pix_on_right >= MIN_V_TRACK_WID){
-                        //Guaranteed to be on the right.
-                        set_motor(L_MOTOR,(int) BASE_DUTY_CYCLE);
-                        set_motor(R_MOTOR,(int)-BASE_DUTY_CYCLE);
-                        //usleep(75000);
-                    }
-                    else if(previous_h_data.error1 < 0 && pix_on_left >= MIN_V_TRACK_WID && pix_on_right < MIN_V_TRACK_WID){
-                        //Guaranteed to be on the left.
-                        set_motor(L_MOTOR,(int)-BASE_DUTY_CYCLE);
-                        set_motor(R_MOTOR,(int) BASE_DUTY_CYCLE);
-                        //usleep(75000);
-                    }
-                    else if(previous_h_data.error1 < 0 && pix_on_left < MIN_V_TRACK_WID && pix_on_right >= MIN_V_TRACK_WID){
-                        //Likely to be on the right.
-                        set_motor(L_MOTOR,(int) BASE_DUTY_CYCLE);
-                        set_motor(R_MOTOR,(int)-BASE_DUTY_CYCLE);
-                        //usleep(75000);
-                    }
-                    else if(previous_h_data.error1 > 0 && pix_on_left >= MIN_V_TRACK_WID && pix_on_right < MIN_V_TRACK_WID){
-                        //Likely to be on the left.
-                        set_motor(L_MOTOR,(int)-BASE_DUTY_CYCLE);
-                        set_motor(R_MOTOR,(int) BASE_DUTY_CYCLE);
-                        //usleep(75000);
-                    }
-                    //Try this if the robot is turning to the wrong direction on the last transversal.
-                    else if(pix_on_left >= MIN_V_TRACK_WID && pix_on_right >= MIN_V_TRACK_WID){
-                        //Possibly the second transversal.
-                        set_motor(L_MOTOR,(int)-BASE_DUTY_CYCLE);
-                        set_motor(R_MOTOR,(int) BASE_DUTY_CYCLE);
-                        //usleep(75000);
-                    }
-                    //This part doesn't rely on vertical scans.
-                    else {
-                        //Ideally, it shouldn't come to this in corners: the vertical scans should be able to
-                        //tell the direction to follow...
-                        //It's hard to tell which way to go in this case, it will follow previous_h_data.
-                        if(previous_h_data.error1 < 0){
-                            //Track was on the left side before it was lost.
-                            set_motor(L_MOTOR,(int)-BASE_DUTY_CYCLE);
-                            set_motor(R_MOTOR,(int) BASE_DUTY_CYCLE);
-                        }
-                        else if(previous_h_data.error1 > 0){
-                            //Track was on the right side before it was lost.
-                            set_motor(L_MOTOR,(int) BASE_DUTY_CYCLE);
-                            set_motor(R_MOTOR,(int)-BASE_DUTY_CYCLE);
-                        }
-                        else {
-                            //Inconclusive, go back. Highly unlikely to happen.
-                            set_motor(L_MOTOR,(int)-BASE_DUTY_CYCLE);
-                            set_motor(R_MOTOR,(int)-BASE_DUTY_CYCLE);
-                        }
-                    }
-                    take_picture();
-                    h_data = getHorizontalData(ROW);
-                }
-                //Back on track, supposedly...
-                followTrack(h_data);
-                previous_h_data = h_data;
-            }
+            //Inconclusive, go back. Highly unlikely to happen.
+            drive((int)-BASE_DUTY_CYCLE, (int)-BASE_DUTY_CYCLE);
         }
     }
+    takePicture();
+    h_data = getHorizontalData(ROW);
+    if (h_data.white_pixels1 >= MIN_H_TRACK_WID && abs(h_data.error1) <= 100){
+        //Back on track, supposedly...
+        resetSpeed(&speed_planner);
+        followTrack(h_data);
+        previous_h_data = h_data;
+        return FOUND_TRACK;
+    }
+    return STAY;
+}
+
+int crossRedLine(){
+    //Wait for it to cross the red line before switching to quad 4.
+    if (sensors.left_wall && !sensors.right_wall)
+        q4Control(50);
+    else if (!sensors.left_wall && sensors.right_wall)
+        q4Control(-50);
+    else
+        q4Control(0);
+    takePicture();
+    if (!isRedLine())
+        return DONE;
+    return STAY;
+}
+
+//==== QUADRANT 4 =================================================================================
+//Goal: finish the walled maze.
+
+int driveQ4(){
+    takePicture();
+    if (isRedLine())
+        return RED_LINE_FOUND;
     
-    //==== QUADRANT 4 =============================================================================
-    bool turn_left         = false;
-    int  min_distance      = 200;
-    int  bigger_distance   = 155; //If reading is lower than this, breaks turning loop.
-    int  internal_distance = 220; //If reading is lower than this, increases turning speed. (helps with U-turn)
-    //int  gate_loops        = 6;   //Each unit makes it sleep for 250000us (6 = 1,5s).
-    int  gate_sleep        = 256666; 
-    int  gate_distance     = 180; //Higher values requires the robot to be closer.
-    int  turn_sleep        = 150000; //Microseconds, used when it doesn't detect walls or when it detects both.
-    
-    bool left_wall;
-    bool right_wall;
-    while(quad == 4){
-        //Quadrant 4
-        //Goal: finish the walled maze.
-        
-        take_picture();
-        if (isRedLine()){
-            //for (int i = 0; i < gate_loops; i++){ //Adjust size to make the robot stop close to the gate.
-            //    //Advance just a little bit and stop before the gate.
-            //    if(read_analog(F_SENSOR) < gate_distance){
-            //        //Failsafe
-            //        break;
-            //    }
-            //    left_wall  = leftWall();
-            //    right_wall = rightWall();
-            //    if (left_wall && !right_wall){ //Right
-            //        set_motor(L_MOTOR,40);
-            //        set_motor(R_MOTOR,30);
-            //    }
-            //    else if(!left_wall && right_wall){ //Left
-            //        set_motor(L_MOTOR,30);
-            //        set_motor(R_MOTOR,40);
-            //    }
-            //    else{ //Straight
-            //        set_motor(L_MOTOR,35);
-            //        set_motor(R_MOTOR,35);
-            //    }
-            //    sleep1(0,gate_sleep);
-            //}
-            
-            
-            left_wall  = leftWall();
-            right_wall = rightWall();
-            if (left_wall && !right_wall){ //Right
-                set_motor(L_MOTOR,35);
-                set_motor(R_MOTOR,25);
-            }
-            else if(!left_wall && right_wall){ //Left
-                set_motor(L_MOTOR,25);
-                set_motor(R_MOTOR,35);
-            }
-            else{ //Straight
-                set_motor(L_MOTOR,35);
-                set_motor(R_MOTOR,35);
-            }
-            usleep(gate_sleep);
-            
-            left_wall  = leftWall();
-            right_wall = rightWall();
-            if (left_wall && !right_wall){ //Right
-                set_motor(L_MOTOR,33);
-                set_motor(R_MOTOR,26);
-            }
-            else if(!left_wall && right_wall){ //Left
-                set_motor(L_MOTOR,26);
-                set_motor(R_MOTOR,36);
-            }
-            else{ //Straight
-                set_motor(L_MOTOR,35);
-                set_motor(R_MOTOR,35);
-            }
-            usleep(gate_sleep);
-            
-            left_wall  = leftWall();
-            right_wall = rightWall();
-            if (left_wall && !right_wall){ //Right
-                set_motor(L_MOTOR,33);
-                set_motor(R_MOTOR,26);
-            }
-            else if(!left_wall && right_wall){ //Left
-                set_motor(L_MOTOR,26);
-                set_motor(R_MOTOR,36);
-            }
-            else{ //Straight
-                set_motor(L_MOTOR,35);
-                set_motor(R_MOTOR,35);
-            }
-            usleep(gate_sleep);
-
-            
-            //Robot should be able to detect the gate now.
-            set_motor(L_MOTOR,0);
-            set_motor(R_MOTOR,0);   
-            while(read_analog(F_SENSOR) < gate_distance) {
-                //Waits for the gate to close (if it is not closed already).
-                //=== Do nothing ===
-            }
-            while(read_analog(F_SENSOR) >= gate_distance) {
-                //Now it waits for it to open again.
-                //=== Do nothing ===
-            }
-            usleep(GATE_TIMER); //Wait just a little more to avoid a collision with a partially open gate.
-            turn_left = true;
+    if (sensors.front < Q4_MIN_DISTANCE){
+        //No wall ahead. Advance.
+        planSpeed(&speed_planner, 0, 0, 0, sensors.front, CONTROL_PERIOD_S);
+        if (sensors.left_wall && sensors.right_wall){
+            //Sets error to zero.
+            q4Control(0);
         }
-        
-        front_reading = read_analog(F_SENSOR);
-        
-        if (front_reading < min_distance){
-            //No wall ahead. Advance.
-            left_wall  = leftWall();
-            right_wall = rightWall();
-            
-            if (left_wall && right_wall){
-                //Sets error to zero.
-                q4Control(0);
-            }
-            else if (!left_wall && !right_wall){
-                //Sets direction a bit to the right to make robot follow the right wall in passages.
-                q4Control(20);
-            }
-            else if (left_wall && !right_wall){
-                q4Control(40);
-            }
-            else if (!left_wall && right_wall){
-                q4Control(-40);
-            }
+        else if (!sensors.left_wall && !sensors.right_wall){
+            //Sets direction a bit to the right to make robot follow the right wall in passages.
+            q4Control(20);
         }
-        else {
-            set_motor(L_MOTOR,0);
-            set_motor(R_MOTOR,0);
-            left_wall  = leftWall();
-            right_wall = rightWall();
-            
-            //The internal distance corresponds to the minimum distance that allows the robot to
-            //safely make the turns, and the bigger distance is the value that guarantees the robot
-            //is not seeing walls ahead of it, i.e., it completed the turn.
-            if (left_wall && !right_wall){
-                //Turns to the right until front sensor stops detecting walls.
-                while (front_reading > bigger_distance){ //#todo find a good value for this bigger distance
-                    int left_dc  = BASE_DUTY_CYCLE;
-                    int right_dc = 10;             
-                    if (front_reading < internal_distance){
-                        left_dc  += 15;
-                        right_dc += 15;
-                    }
-                    set_motor(L_MOTOR,left_dc);
-                    set_motor(R_MOTOR,right_dc);
-                    front_reading = read_analog(F_SENSOR);
-                }
-                turn_left = true; //If bigger_distance is correctly set, this will be changed in the correct time.
-                                  //Decrease bigger_distance if it turns to the right in the other corners.
-            }
-            else if (!left_wall && right_wall){
-                //Turns to the left until front sensor stops detecting walls.
-                while (front_reading > bigger_distance){ //#todo find a good value for this bigger distance
-                    int left_dc  = 10; 
-                    int right_dc = BASE_DUTY_CYCLE;
-                    if (front_reading < internal_distance){
-                        left_dc  += 15;
-                        right_dc += 15;
-                    } 
-                    set_motor(L_MOTOR,left_dc);
-                    set_motor(R_MOTOR,right_dc);
-                    front_reading = read_analog(F_SENSOR);
-                }
-                turn_left = true;
-            }
-            else {
-                while (front_reading > min_distance){
-                    if (turn_left){
-                        set_motor(L_MOTOR,-BASE_DUTY_CYCLE);
-                        set_motor(R_MOTOR,0);
-                    }
-                    else {
-                        set_motor(L_MOTOR,0);
-                        set_motor(R_MOTOR,-BASE_DUTY_CYCLE);
-                    }
-                    usleep(turn_sleep);
-                    front_reading = read_analog(F_SENSOR);
-                }
-            }
-            //
-            //==== Q4 Algorithm 1 turning backwards =============================================================
-            //set_motor(L_MOTOR,0);
-            //set_motor(R_MOTOR,0);
-            //
-            //int alternate = 0;
-            //while (front_reading > min_distance){
-            //    left_wall  = leftWall();
-            //    right_wall = rightWall();
-            //    if(left_wall && right_wall){
-            //        //Slowly go back
-            //        set_motor(L_MOTOR,-BASE_DUTY_CYCLE);
-            //        set_motor(R_MOTOR,-BASE_DUTY_CYCLE);
-            //    }
-            //    else if (!left_wall && !right_wall){
-            //        //Slowly go back alternating the direction.
-            //        if (alternate == 1){ //Turn front to right.
-            //            set_motor(L_MOTOR,0);
-            //            set_motor(R_MOTOR,-BASE_DUTY_CYCLE);
-            //            alternate = 0;
-            //        }
-            //        else if (alternate == -1){ //Turn front to left.
-            //            set_motor(L_MOTOR,-BASE_DUTY_CYCLE);
-            //            set_motor(R_MOTOR,0);
-            //            alternate = 1;
-            //        }
-            //        else{ //Just go back.
-            //            set_motor(L_MOTOR,-BASE_DUTY_CYCLE);
-            //            set_motor(R_MOTOR,-BASE_DUTY_CYCLE);
-            //            alternate = -1;
-            //        }
-            //    }
-            //    else if (left_wall && !right_wall){
-            //        //Go back turning the front to the right
-            //        set_motor(L_MOTOR, 0);
-            //        set_motor(R_MOTOR,-BASE_DUTY_CYCLE-10);
-            //        usleep(turn_sleep);
-            //    }
-            //    else if (!left_wall && right_wall){
-            //        //Go back turning the front to the left
-            //        set_motor(L_MOTOR,-BASE_DUTY_CYCLE-10);
-            //        set_motor(R_MOTOR, 0);
-            //        usleep(turn_sleep);
-            //    }
-            //    front_reading = read_analog(F_SENSOR);
-            //}
+        else if (sensors.left_wall && !sensors.right_wall){
+            q4Control(40);
+        }
+        else if (!sensors.left_wall && sensors.right_wall){
+            q4Control(-40);
         }
+        return STAY;
     }
-    
-    while(quad == -1){
-        //Use this loop for testing stuff.
-        //char pic_name[] = "p";
-        //take_picture();
-        //save_picture(pic_name);
-        //break;
-        
-        while(true){
-            front_reading     = readAnalogSensor(F_SENSOR, 1).average;
-            int left_reading  = read_digital(L_SENSOR);
-            int right_reading = read_digital(R_SENSOR);
-            
-            printf("F: %d, L:%d, R:%d\n", front_reading, left_reading, right_reading);
+    drive(0, 0);
+    resetSpeed(&speed_planner);
+    //The internal distance corresponds to the minimum distance that allows the robot to
+    //safely make the turns, and the bigger distance is the value that guarantees the robot
+    //is not seeing walls ahead of it, i.e., it completed the turn.
+    if (sensors.left_wall && !sensors.right_wall)
+        return WALL_ON_LEFT;
+    else if (!sensors.left_wall && sensors.right_wall)
+        return WALL_ON_RIGHT;
+    return DEAD_END;
+}
+
+int turnRightQ4(){
+    //Turns to the right until front sensor stops detecting walls.
+    if (sensors.front <= BIGGER_DISTANCE){
+        turn_left = true; //If BIGGER_DISTANCE is correctly set, this will be changed in the correct time.
+                          //Decrease BIGGER_DISTANCE if it turns to the right in the other corners.
+        return DONE;
+    }
+    int left_dc  = BASE_DUTY_CYCLE;
+    int right_dc = 10;
+    if (sensors.front < INTERNAL_DISTANCE){
+        left_dc  += 15;
+        right_dc += 15;
+    }
+    drive(left_dc, right_dc);
+    return STAY;
+}
+
+int turnLeftQ4(){
+    //Turns to the left until front sensor stops detecting walls.
+    if (sensors.front <= BIGGER_DISTANCE){
+        turn_left = true;
+        return DONE;
+    }
+    int left_dc  = 10;
+    int right_dc = BASE_DUTY_CYCLE;
+    if (sensors.front < INTERNAL_DISTANCE){
+        left_dc  += 15;
+        right_dc += 15;
+    }
+    drive(left_dc, right_dc);
+    return STAY;
+}
+
+int reverseTurnQ4(){
+    //Pivots backwards, checking the front sensor once every TURN_SLEEP.
+    if (!stateEvery(TURN_SLEEP))
+        return STAY;
+    if (sensors.front <= Q4_MIN_DISTANCE)
+        return DONE;
+    if (turn_left)
+        drive(-BASE_DUTY_CYCLE, 0);
+    else
+        drive(0, -BASE_DUTY_CYCLE);
+    return STAY;
+}
+
+//Stops at the second gate, waits for it to close and open again, and then goes through.
+//Runs as a coroutine inside the Q4_GATE state, so it reads like the old blocking code but
+//gives the tick back while it waits.
+Task gate2Behaviour(){
+    //The gate monitor learns the gate's cycle from the approach onwards.
+    startGateMonitor(&gate_monitor, F_SENSOR, GATE_READINGS, GATE_SAMPLE_US, GATE_DISTANCE, GATE_DISTANCE - GATE_HYSTERESIS,
+                     &gate_predictor);
+    //Advances in three steps of GATE_SLEEP to stop close to the gate.
+    for (int step = 0; step < 3; step++){
+        if (sensors.left_wall && !sensors.right_wall){ //Right
+            if (step == 0)
+                drive(35, 25);
+            else
+                drive(33, 26);
+        }
+        else if(!sensors.left_wall && sensors.right_wall){ //Left
+            if (step == 0)
+                drive(25, 35);
+            else
+                drive(26, 36);
+        }
+        else{ //Straight
+            drive(35, 35);
         }
+        co_await sleepFor(GATE_SLEEP);
+    }
+    
+    //Robot should be able to detect the gate now.
+    //Goes GATE_MARGIN after the gate opens (or is predicted to open) if it will stay open for
+    //long enough. Until the cycle is known, it waits GATE_TIMER after the opening like before.
+    drive(0, 0);
+    struct timespec start, now;
+    clockNow(&start);
+    bool clear = false;
+    while (!clear){
+        co_await yieldTick();
+        clockNow(&now);
+        if (diffNanoseconds(&now, &start)/NSEC_PER_USEC > GATE_WAIT_TIMEOUT)
+            break;
+        clear = gateClearToGo(&gate_monitor, GATE_MARGIN, GATE_TIMER, GATE_PASS_TIME);
+    }
+    stopGateMonitor(&gate_monitor);
+    if (!clear){
+        //Fallback: the gate was never seen closing and opening. Go as soon as the way is clear.
+        co_await sensorBelow(F_SENSOR, GATE_DISTANCE - GATE_HYSTERESIS);
+        co_await sleepFor(GATE_TIMER); //Wait just a little more to avoid a collision with a partially open gate.
+    }
+    if (gate_predictor.cycles > 0)
+        saveGateModel(&gate_predictor, GATE_MODEL_FILE);
+    turn_left = true;
+}
+
+void enterGate2(){
+    gate2_task = gate2Behaviour();
+}
+
+int runGate2(){
+    if (stepTask(&gate2_task))
+        return DONE;
+    return STAY;
+}
+
+//==== TEST =======================================================================================
+int testSensors(){
+    //Use this state for testing stuff.
+    //char pic_name[] = "p";
+    //take_picture();
+    //save_picture(pic_name);
+    printf("F: %d, L:%d, R:%d\n", sensors.front, !sensors.left_wall, !sensors.right_wall);
+    return STAY;
+}
+
+//==== Tables =====================================================================================
+const StateInfo states[STATE_COUNT] = {
+    //name                 quad  guard           enter              tick
+    {"Q1_OPEN_GATE",        1,   NULL,           stopMotors,        openGate},
+    {"Q1_GATE_WAIT",        1,   NULL,           NULL,              waitForGate1},
+    {"Q2_FOLLOW",           2,   collisionGuard, NULL,              followQ2},
+    {"Q2_SEARCH",           2,   NULL,           stopMotors,        searchQ2},
+    {"Q2_CROSS",            2,   NULL,           NULL,              crossQ2},
+    {"Q3_FOLLOW",           3,   collisionGuard, NULL,              followQ3},
+    {"Q3_PASSAGE_NUDGE",    3,   NULL,           enterPassageNudge, passageNudge},
+    {"Q3_CROSS",            3,   NULL,           NULL,              crossQ3},
+    {"Q3_TURN_LEFT",        3,   NULL,           NULL,              turnLeftQ3},
+    {"Q3_SEARCH",           3,   NULL,           enterSearchQ3,     searchQ3},
+    {"Q3_CROSS_RED",        3,   NULL,           NULL,              crossRedLine},
+    {"Q4_DRIVE",            4,   NULL,           NULL,              driveQ4},
+    {"Q4_TURN_RIGHT",       4,   NULL,           NULL,              turnRightQ4},
+    {"Q4_TURN_LEFT",        4,   NULL,           NULL,              turnLeftQ4},
+    {"Q4_REVERSE_TURN",     4,   NULL,           NULL,              reverseTurnQ4},
+    {"Q4_GATE",             4,   NULL,           enterGate2,        runGate2},
+    {"TEST",               -1,   NULL,           NULL,              testSensors},
+};
+
+const Transition transitions[] = {
+    //from                 event               to
+    {Q1_OPEN_GATE,         DONE,               Q1_GATE_WAIT},
+    {Q1_GATE_WAIT,         DONE,               Q2_FOLLOW},
+    {Q2_FOLLOW,            TRANSVERSAL_FOUND,  Q2_CROSS},
+    {Q2_FOLLOW,            LOST_TRACK,         Q2_SEARCH},
+    {Q2_SEARCH,            FOUND_TRACK,        Q2_FOLLOW},
+    {Q2_CROSS,             DONE,               Q3_FOLLOW},
+    {Q3_FOLLOW,            RED_LINE_FOUND,     Q3_CROSS_RED},
+    {Q3_FOLLOW,            TRANSVERSAL_FOUND,  Q3_CROSS},
+    {Q3_FOLLOW,            PASSAGE_BOTH_SIDES, Q3_PASSAGE_NUDGE},
+    {Q3_FOLLOW,            LOST_TRACK,         Q3_SEARCH},
+    {Q3_PASSAGE_NUDGE,     DONE,               Q3_FOLLOW},
+    {Q3_CROSS,             DONE,               Q3_TURN_LEFT},
+    {Q3_TURN_LEFT,         FOUND_TRACK,        Q3_FOLLOW},
+    {Q3_SEARCH,            FOUND_TRACK,        Q3_FOLLOW},
+    {Q3_CROSS_RED,         DONE,               Q4_DRIVE},
+    {Q4_DRIVE,             RED_LINE_FOUND,     Q4_GATE},
+    {Q4_DRIVE,             WALL_ON_LEFT,       Q4_TURN_RIGHT},
+    {Q4_DRIVE,             WALL_ON_RIGHT,      Q4_TURN_LEFT},
+    {Q4_DRIVE,             DEAD_END,           Q4_REVERSE_TURN},
+    {Q4_TURN_RIGHT,        DONE,               Q4_DRIVE},
+    {Q4_TURN_LEFT,         DONE,               Q4_DRIVE},
+    {Q4_REVERSE_TURN,      DONE,               Q4_DRIVE},
+    {Q4_GATE,              DONE,               Q4_DRIVE},
+};
+const int TRANSITION_COUNT = sizeof(transitions)/sizeof(transitions[0]);
+
+//Returns the state each quadrant starts in.
+int initialState(int quad){
+    switch (quad){
+        case 1:  return Q1_OPEN_GATE;
+        case 2:  return Q2_FOLLOW;
+        case 3:  return Q3_FOLLOW;
+        case 4:  return Q4_DRIVE;
+        default: return TEST;
+    }
+}
+
+//Uses the gate server given by GATE_IP and GATE_PORT, if they are set.
+void readGateServer(){
+    const char *ip   = getenv("GATE_IP");
+    const char *port = getenv("GATE_PORT");
+    if (ip != NULL){
+        strncpy(IP, ip, sizeof(IP) - 1);
+        IP[sizeof(IP) - 1] = '\0';
+    }
+    if (port != NULL)
+        server_port = atoi(port);
+}
+
+//Starts in the quadrant given by QUADRANT, if it is set.
+void readStartQuadrant(){
+    const char *quadrant = getenv("QUADRANT");
+    if (quadrant != NULL)
+        start_quadrant = atoi(quadrant);
+}
+
+//Records the run to the file given by RECORD, if it is set, in the format given by
+//RECORD_FORMAT: "colour" (the default), "luminance" or "raw". RECORD_TOLERANCE overrides the
+//tolerance of the compressed formats (see frame_codec.h) and RECORD_FRAMES the room of a raw
+//recording. The inputs are journaled to the same name with ".inputs" added, so that
+//sim/replay_hal.cpp can replay the run. The replay is exact from a colour recording, as long
+//as the code reads only the lines of RECORD_EXACT, or a raw one.
+void readRecordFile(){
+    const char *file      = getenv("RECORD");
+    const char *format    = getenv("RECORD_FORMAT");
+    const char *tolerance = getenv("RECORD_TOLERANCE");
+    const char *frames    = getenv("RECORD_FRAMES");
+    if (file == NULL)
+        return;
+    if (format != NULL && strcmp(format, "raw") == 0){
+        uint32_t capacity = frames != NULL ? (uint32_t)atol(frames) : RECORD_CAPACITY;
+        if (openFrameRecorder(&recorder, file, PIC_WIDTH, PIC_HEIGHT, 4, capacity))
+            recording = RECORD_RAW;
+    }
+    else {
+        int channels = 3;
+        if (format != NULL && strcmp(format, "luminance") == 0)
+            channels = 1;
+        int max_error = tolerance != NULL ? atoi(tolerance) : RECORD_TOLERANCE;
+        if (openFrameEncoder(&encoder, file, PIC_WIDTH, PIC_HEIGHT, channels, max_error, KEYFRAME_INTERVAL, &RECORD_EXACT))
+            recording = channels == 1 ? RECORD_LUMINANCE : RECORD_COLOUR;
+    }
+    if (recording != NO_RECORDING){
+        startPictureCopier(&copier, PIC_WIDTH, PIC_HEIGHT, recording == RECORD_COLOUR ? 3 : (recording == RECORD_LUMINANCE ? 1 : 4));
+        snprintf(journal_file, sizeof(journal_file), "%s.inputs", file);
+        openJournal(&journal);
+    }
+}
+
+//Traces the run to the file given by TRACE, if it is set (see trace.h and tools/trace_to_json.cpp).
+void readTraceFile(){
+    const char *file = getenv("TRACE");
+    if (file == NULL)
+        return;
+    snprintf(trace_file, sizeof(trace_file), "%s", file);
+    for (int i = 0; i < STATE_COUNT; i++)
+        traceName(TRACE_STATE, i, states[i].name);
+    for (int i = 0; i <= DEAD_END; i++)
+        traceName(TRACE_EVENT, i, EVENT_NAMES[i]);
+    for (int i = 0; i < JUNCTION_DECISIONS; i++)
+        traceName(TRACE_JUNCTION, i, JUNCTION_NAMES[i]);
+    traceThread("control");
+    openTrace();
+}
+
+//Ctrl+C ends the run so the statistics are printed and the motors stopped.
+volatile sig_atomic_t running = 1;
+void stopRunning(int){
+    running = 0;
+}
+
+//==== Main =======================================================================================
+int main(){
+    profileThread("control");
+    HAL::init();
+    readStartQuadrant();
+    readRecordFile();
+    readTraceFile();
+    //Talks to the gate server while the rest of the startup runs.
+    if (initialState(start_quadrant) == Q1_OPEN_GATE){
+        readGateServer();
+        startGateHandshake(&gate_handshake, IP, server_port, PLEASE, HANDSHAKE_ATTEMPTS, HANDSHAKE_TIMEOUT);
+    }
+    HAL::select_IO(L_SENSOR, 1); //Sets digital sensor channel to input mode.
+    HAL::select_IO(R_SENSOR, 1);
+    signal(SIGINT, stopRunning);
+    signal(SIGUSR1, requestProfileDump); //kill -USR1 prints the profile so far.
+    
+    setLumThreshold();
+    initScheduler(&control_loop, CONTROL_PERIOD_US, RT_PRIORITY, CONTROL_CPU);
+    initMotorDriver(&left_motor,  L_MOTOR, MOTOR_SLEW_RATE, MOTOR_DEADBAND);
+    initMotorDriver(&right_motor, R_MOTOR, MOTOR_SLEW_RATE, MOTOR_DEADBAND);
+    startMotorOutput(&motor_mailbox, &left_motor, &right_motor, MOTOR_PERIOD_US, MOTOR_FAILSAFE_US);
+    //The correction is split between both motors, so half of the usable range is available to it.
+    double max_correction = (MAX_DUTY_CYCLE - MIN_DUTY_CYCLE)/2.0;
+    initPID(&track_pid, Q12_GAINS, -max_correction, max_correction);
+    initPID(&wall_pid,  Q4_GAINS,  -max_correction, max_correction);
+    initGatePredictor(&gate_predictor, GATE_SMOOTHING);
+    loadGateModel(&gate_predictor, GATE_MODEL_FILE);
+    
+    sampleSensors();
+    initStateMachine(&robot, states, STATE_COUNT, transitions, TRANSITION_COUNT,
+                     startQuadrant, PRINT_TRANSITIONS, initialState(start_quadrant));
+    while(running){
+        nextTick();
+        if (profileDumpRequested())
+            printProfile();
+        ProfileScope tick_profile(PHASE_TICK);
+        trace(TRACE_TICK_BEGIN, 0, control_loop.ticks);
+        //Runs every tick, whatever the state is.
+        sampleSensors();
+        stepStateMachine(&robot);
+        recordFrame();
+        trace(TRACE_TICK_END, 0);
     }
     
-    stop(L_MOTOR);
-    stop(R_MOTOR);
+    stopGateMonitor(&gate_monitor);
+    stopMotorOutput(&motor_mailbox);
+    HAL::stop(L_MOTOR);
+    HAL::stop(R_MOTOR);
+    printStateTimes(&robot);
+    printSchedulerStats(&control_loop);
+    printProfile();
+    printMotorStats(&left_motor);
+    printMotorStats(&right_motor);
+    printf("Motor failsafe trips: %ld\n", motor_mailbox.failsafe_trips);
+    printGatePredictor(&gate_predictor);
+    recordFrame();
+    commitCopiedFrame();
+    if (recording != NO_RECORDING)
+        stopPictureCopier(&copier);
+    if (recording == RECORD_RAW)
+        closeFrameRecorder(&recorder);
+    else if (recording != NO_RECORDING)
+        closeFrameEncoder(&encoder);
+    if (recording != NO_RECORDING)
+        closeJournal(&journal, journal_file);
+    if (trace_file[0] != '\0')
+        closeTrace(trace_file);
+    if (initialState(start_quadrant) == Q1_OPEN_GATE)
+        printGateHandshake(&gate_handshake);
+    return 0;
 }
@@ -0,0 +1,97 @@
+#ifndef MOTOR_DRIVER_H
+#define MOTOR_DRIVER_H
+
+#include <time.h>
+#include <stdio.h>
+#include "hal.h"
+#include "scheduler.h"
+#include "profiler.h"
+
+//Wrapper around set_motor() for one motor.
+//  - Values that are already on the motor are not written again.
+//  - The duty cycle ramps towards the command at no more than slew_rate per second,
+//    except for 0, which is applied at once so stopping is never delayed.
+//  - Non-zero values smaller than the deadband are raised to it, since the wheels
+//    don't turn at all below that (stiction).
+
+//Structure to store the state of a motor.
+struct MotorDriver{
+    int             motor;       //L_MOTOR or R_MOTOR.
+    double          slew_rate;   //Max. change of duty cycle per second.
+    int             deadband;    //Smallest duty cycle that actually moves the wheel.
+    int             target;      //Last commanded duty cycle.
+    double          output;      //Duty cycle after slew limiting.
+    int             written;     //Last value sent with set_motor().
+    bool            has_written;
+    struct timespec last_update;
+    long            writes;      //Calls to set_motor().
+    long            skipped;     //Updates that didn't need a call to set_motor().
+};
+
+//Sets up a motor, assuming it is stopped.
+inline void initMotorDriver(MotorDriver *driver, int motor, double slew_rate, int deadband){
+    driver->motor       = motor;
+    driver->slew_rate   = slew_rate;
+    driver->deadband    = deadband;
+    driver->target      = 0;
+    driver->output      = 0;
+    driver->written     = 0;
+    driver->has_written = false;
+    driver->writes      = 0;
+    driver->skipped     = 0;
+    clockNow(&driver->last_update);
+}
+
+//Raises non-zero duty cycles inside the deadband to its edge.
+inline int compensateDeadband(int duty_cycle, int deadband){
+    if (duty_cycle > 0 && duty_cycle < deadband)
+        return deadband;
+    if (duty_cycle < 0 && duty_cycle > -deadband)
+        return -deadband;
+    return duty_cycle;
+}
+
+//Moves the output towards the target and writes it to the motor if it changed.
+//Call it regularly (once per tick) so ramps complete even if the command doesn't change.
+inline void serviceMotor(MotorDriver *driver){
+    struct timespec now;
+    clockNow(&now);
+    double dt = diffNanoseconds(&now, &driver->last_update)/(double)NSEC_PER_SEC;
+    driver->last_update = now;
+
+    double max_step = driver->slew_rate*dt;
+    if (driver->target == 0)
+        driver->output = 0;
+    else if (driver->target > driver->output + max_step)
+        driver->output += max_step;
+    else if (driver->target < driver->output - max_step)
+        driver->output -= max_step;
+    else
+        driver->output = driver->target;
+
+    int duty_cycle = compensateDeadband((int)driver->output, driver->deadband);
+    if (driver->has_written && duty_cycle == driver->written){
+        driver->skipped++;
+        return;
+    }
+    {
+        ProfileScope profile(PHASE_SET_MOTOR);
+        HAL::set_motor(driver->motor, duty_cycle);
+    }
+    driver->written     = duty_cycle;
+    driver->has_written = true;
+    driver->writes++;
+}
+
+//Sets a new target duty cycle and applies as much of it as the slew rate allows.
+inline void commandMotor(MotorDriver *driver, int duty_cycle){
+    driver->target = duty_cycle;
+    serviceMotor(driver);
+}
+
+//Prints how many writes were made and how many were avoided.
+inline void printMotorStats(const MotorDriver *driver){
+    printf("Motor %d: %ld writes, %ld skipped\n", driver->motor, driver->writes, driver->skipped);
+}
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef MOTOR_MAILBOX_H
+#define MOTOR_MAILBOX_H
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <thread>
+#include "scheduler.h"
+#include "motor_driver.h"
+
+//Latest-wins mailbox between the control code and the motors.
+//The control code posts (left, right) commands whenever it decides something, and never
+//touches the motors itself. An output thread picks up the newest command at a fixed rate
+//and applies it through the MotorDrivers, so actuation keeps its own timing no matter how
+//long a picture or a network call took. If no command was posted for failsafe_us, the
+//output thread stops the motors.
+//
+//The command and the time it was posted share a single 64 bit word:
+//    bits 63..32  post time in milliseconds (clock.h, wraps every 49 days)
+//    bits 31..16  left duty cycle
+//    bits 15..0   right duty cycle
+//so a post is one atomic store and the output thread can never see half of a command.
+
+//Structure to store the mailbox and its output thread.
+struct MotorMailbox{
+    std::atomic<uint64_t> slot;
+    std::atomic<bool>     running;
+    std::thread           thread;
+    MotorDriver          *left;
+    MotorDriver          *right;
+    long                  period_us;
+    long                  failsafe_us;
+    long                  failsafe_trips; //Times the failsafe stopped moving motors.
+};
+
+//Returns the clock in milliseconds, truncated to 32 bits.
+inline uint32_t monotonicMillis(){
+    struct timespec now;
+    clockNow(&now);
+    return (uint32_t)((int64_t)now.tv_sec*1000 + now.tv_nsec/1000000);
+}
+
+//Posts a new command, replacing any command that wasn't applied yet.
+inline void postMotorCommand(MotorMailbox *mailbox, int left_dc, int right_dc){
+    uint64_t word = ((uint64_t)monotonicMillis() << 32)
+                  | ((uint64_t)(uint16_t)(int16_t)left_dc << 16)
+                  |  (uint64_t)(uint16_t)(int16_t)right_dc;
+    mailbox->slot.store(word, std::memory_order_release);
+}
+
+//Body of the output thread.
+inline void motorOutputLoop(MotorMailbox *mailbox){
+    profileThread("motor");
+    Scheduler output_loop;
+    initScheduler(&output_loop, mailbox->period_us, 0, -1);
+    bool failsafe_active = false;
+    while (mailbox->running.load(std::memory_order_acquire)){
+        uint64_t word     = mailbox->slot.load(std::memory_order_acquire);
+        uint32_t posted   = (uint32_t)(word >> 32);
+        int      left_dc  = (int16_t)(uint16_t)(word >> 16);
+        int      right_dc = (int16_t)(uint16_t)word;
+        uint32_t age_ms   = monotonicMillis() - posted;
+        if ((int64_t)age_ms*1000 > mailbox->failsafe_us){
+            //The control code went quiet: don't keep driving on a stale command.
+            if (!failsafe_active && (left_dc != 0 || right_dc != 0))
+                mailbox->failsafe_trips++;
+            failsafe_active = true;
+            left_dc         = 0;
+            right_dc        = 0;
+        }
+        else {
+            failsafe_active = false;
+        }
+        commandMotor(mailbox->left, left_dc);
+        commandMotor(mailbox->right, right_dc);
+        waitForTick(&output_loop);
+    }
+    commandMotor(mailbox->left, 0);
+    commandMotor(mailbox->right, 0);
+}
+
+//Starts the output thread with both motors stopped.
+inline void startMotorOutput(MotorMailbox *mailbox, MotorDriver *left, MotorDriver *right,
+                             long period_us, long failsafe_us){
+    mailbox->left           = left;
+    mailbox->right          = right;
+    mailbox->period_us      = period_us;
+    mailbox->failsafe_us    = failsafe_us;
+    mailbox->failsafe_trips = 0;
+    postMotorCommand(mailbox, 0, 0);
+    mailbox->running.store(true);
+    clockSource()->attach();
+    mailbox->thread = std::thread(motorOutputLoop, mailbox);
+}
+
+//Stops the output thread, which stops the motors on its way out.
+inline void stopMotorOutput(MotorMailbox *mailbox){
+    mailbox->running.store(false);
+    clockJoin(&mailbox->thread);
+}
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef PID_H
+#define PID_H
+
+#include <time.h>
+#include "scheduler.h"
+
+//PID controller timed with the clock (see clock.h).
+//The derivative goes through a first order low-pass filter, because the errors coming
+//from the camera and the digital wall sensors change in steps. The integral is clamped
+//and stops accumulating while the output is saturated (anti-windup).
+
+const double PID_MAX_DT = 0.5; //Seconds. Longer gaps between updates restart the derivative.
+
+//Structure to store a set of gains, so each quadrant can use its own.
+struct PIDGains{
+    double kp;
+    double ki;
+    double kd;
+    double derivative_filter; //Weight of a new derivative sample, from 0 (frozen) to 1 (no filtering).
+    double integral_limit;    //Max. contribution of the integral term to the output.
+};
+
+//Structure to store the state of a PID controller.
+struct PID{
+    PIDGains        gains;
+    double          out_min;
+    double          out_max;
+    double          integral;
+    double          derivative;     //Filtered derivative of the error, per second.
+    double          previous_error;
+    struct timespec previous_time;
+    bool            has_previous;   //False until the first update after a reset.
+};
+
+//Clears the integral and the derivative history.
+inline void resetPID(PID *pid){
+    pid->integral     = 0;
+    pid->derivative   = 0;
+    pid->has_previous = false;
+}
+
+//Sets the gains and output limits of a controller and resets it.
+inline void initPID(PID *pid, PIDGains gains, double out_min, double out_max){
+    pid->gains   = gains;
+    pid->out_min = out_min;
+    pid->out_max = out_max;
+    resetPID(pid);
+}
+
+//Switches to another set of gains (e.g. when entering another quadrant).
+inline void setPIDGains(PID *pid, PIDGains gains){
+    pid->gains = gains;
+    resetPID(pid);
+}
+
+//Updates the controller with a new error and returns the clamped output.
+inline double updatePID(PID *pid, double error){
+    struct timespec now;
+    clockNow(&now);
+    double dt = 0;
+    if (pid->has_previous)
+        dt = diffNanoseconds(&now, &pid->previous_time)/(double)NSEC_PER_SEC;
+
+    if (dt > 0 && dt <= PID_MAX_DT){
+        double raw_derivative = (error - pid->previous_error)/dt;
+        pid->derivative += pid->gains.derivative_filter*(raw_derivative - pid->derivative);
+    }
+    else {
+        //First sample or the loop stalled (e.g. a recovery spin): no valid derivative.
+        pid->derivative = 0;
+        dt              = 0;
+    }
+
+    double p_term = pid->gains.kp*error;
+    double d_term = pid->gains.kd*pid->derivative;
+    double i_term = pid->gains.ki*pid->integral;
+    double output = p_term + i_term + d_term;
+
+    //Anti-windup: only integrate if it doesn't push an already saturated output further.
+    bool saturated_high = output >= pid->out_max && error > 0;
+    bool saturated_low  = output <= pid->out_min && error < 0;
+    if (pid->gains.ki > 0 && !saturated_high && !saturated_low){
+        pid->integral += error*dt;
+        double integral_max = pid->gains.integral_limit/pid->gains.ki;
+        if (pid->integral > integral_max)
+            pid->integral = integral_max;
+        else if (pid->integral < -integral_max)
+            pid->integral = -integral_max;
+        output = p_term + pid->gains.ki*pid->integral + d_term;
+    }
+
+    pid->previous_error = error;
+    pid->previous_time  = now;
+    pid->has_previous   = true;
+
+    if (output > pid->out_max)
+        output = pid->out_max;
+    else if (output < pid->out_min)
+        output = pid->out_min;
+    return output;
+}
+
+#endif
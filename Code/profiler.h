@@ -0,0 +1,237 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+//Where the time of the control loop goes, phase by phase (capture, each vision function,
+//sensor reads, actuation, ...) and quadrant by quadrant.
+//A ProfileScope around a phase reads a cycle counter when it starts and when it ends and adds
+//the difference to a histogram of the calling thread for that phase and the current quadrant.
+//Nothing is shared between threads on that path and there is no lock, so a phase costs two
+//counter reads and a few increments, under 50 ns: rdtsc on x86, CNTVCT on 64-bit ARM, and
+//CLOCK_MONOTONIC_RAW (from the vDSO) elsewhere, such as on 32-bit Raspberry Pi OS.
+//The counter isn't the clock of clock.h: the profile measures real time even on a virtual or
+//replayed clock, and reading it doesn't go into the journal.
+//
+//The histograms are like HdrHistogram: a value is kept with PROFILE_SUB_BUCKETS steps in every
+//power of two, so percentiles are within about 3%, in a fixed amount of memory, from 1 ns to
+//minutes. printProfile() gives the calls, p50, p99 and max of every phase of every thread.
+
+const int      PROFILE_QUADRANTS   = 5;  //Index 0 is the TEST state (quadrant -1).
+const int      PROFILE_SUB_BITS    = 5;
+const int      PROFILE_SUB_BUCKETS = 1 << PROFILE_SUB_BITS;
+const int      PROFILE_MAGNITUDES  = 40; //Powers of two above PROFILE_SUB_BUCKETS. Longer goes in the last bucket.
+const int      PROFILE_BUCKETS     = PROFILE_SUB_BUCKETS*(PROFILE_MAGNITUDES + 1);
+const uint64_t PROFILE_MAX_TICKS   = ((uint64_t)PROFILE_SUB_BUCKETS << PROFILE_MAGNITUDES) - 1;
+
+//Phases of the loop.
+enum ProfilePhase{
+    PHASE_TICK,       //Everything the control loop does in a tick, waiting for it excluded.
+    PHASE_CAPTURE,    //take_picture()
+    PHASE_HORIZONTAL, //getHorizontalData()
+    PHASE_VERTICAL,   //verticalWhitePix()
+    PHASE_RED_LINE,   //isRedLine()
+    PHASE_SENSORS,    //ADC and digital reads.
+    PHASE_ACTUATION,  //Posting a motor command.
+    PHASE_SET_MOTOR,  //set_motor(), in the motor output thread.
+    PHASE_RECORD,     //Adding a picture to the recording.
+    PHASE_COUNT
+};
+
+const char *const PHASE_NAMES[PHASE_COUNT] = {"tick", "capture", "getHorizontalData", "verticalWhitePix",
+                                              "isRedLine", "sensors", "actuation", "set_motor", "record"};
+
+//Reads the cycle counter.
+inline uint64_t profileTicks(){
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    return (uint64_t)now.tv_sec*1000000000ULL + now.tv_nsec;
+#endif
+}
+
+inline uint64_t profileRawNs(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    return (uint64_t)now.tv_sec*1000000000ULL + now.tv_nsec;
+}
+
+//Structure to store a histogram. Only the thread that owns it writes to it; the counters are
+//atomic (relaxed, so plain loads and stores) only so that it can be printed while it runs.
+struct ProfileHistogram{
+    std::atomic<uint32_t> buckets[PROFILE_BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> max;
+};
+
+//Structure to store the histograms of a thread.
+struct ProfileThread{
+    char             name[16];
+    ProfileHistogram histograms[PROFILE_QUADRANTS][PHASE_COUNT];
+};
+
+//Structure to store the state shared by all threads.
+struct Profiler{
+    std::mutex                   mutex;    //Only taken to add a thread and to print.
+    std::vector<ProfileThread *> threads;
+    std::atomic<int>             quadrant; //Index in ProfileThread::histograms.
+    std::atomic<int>             dump_requested;
+    uint64_t                     start_ticks;
+    uint64_t                     start_ns;
+};
+
+inline Profiler &profiler(){
+    static Profiler instance;
+    return instance;
+}
+
+inline ProfileThread *&profileThreadSlot(){
+    static thread_local ProfileThread *thread = NULL;
+    return thread;
+}
+
+//Names the calling thread in the profile. Threads that don't are named after their number.
+inline ProfileThread *profileThread(const char *name = NULL){
+    ProfileThread *&thread = profileThreadSlot();
+    if (thread == NULL){
+        thread = new ProfileThread();
+        Profiler &state = profiler();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (state.threads.empty()){
+            state.start_ticks = profileTicks();
+            state.start_ns    = profileRawNs();
+        }
+        snprintf(thread->name, sizeof(thread->name), "thread %zu", state.threads.size());
+        state.threads.push_back(thread);
+    }
+    if (name != NULL)
+        snprintf(thread->name, sizeof(thread->name), "%s", name);
+    return thread;
+}
+
+//Sets the quadrant the phases are counted in, from now on and for every thread.
+inline void setProfileQuadrant(int quad){
+    profiler().quadrant.store(quad >= 1 && quad < PROFILE_QUADRANTS ? quad : 0, std::memory_order_relaxed);
+}
+
+//Index of the bucket of a value.
+inline int profileBucket(uint64_t ticks){
+    if (ticks < (uint64_t)PROFILE_SUB_BUCKETS)
+        return (int)ticks;
+    if (ticks > PROFILE_MAX_TICKS)
+        ticks = PROFILE_MAX_TICKS;
+    int magnitude = 63 - __builtin_clzll(ticks) - PROFILE_SUB_BITS; //0 for [SUB_BUCKETS, 2*SUB_BUCKETS).
+    return PROFILE_SUB_BUCKETS*(magnitude + 1) + (int)(ticks >> magnitude) - PROFILE_SUB_BUCKETS;
+}
+
+//Highest value that goes into a bucket.
+inline uint64_t profileBucketValue(int bucket){
+    if (bucket < PROFILE_SUB_BUCKETS)
+        return bucket;
+    int      magnitude = bucket/PROFILE_SUB_BUCKETS - 1;
+    uint64_t sub       = bucket%PROFILE_SUB_BUCKETS + PROFILE_SUB_BUCKETS;
+    return ((sub + 1) << magnitude) - 1;
+}
+
+inline void recordProfile(int phase, uint64_t ticks){
+    ProfileThread *thread = profileThreadSlot();
+    if (thread == NULL)
+        thread = profileThread();
+    ProfileHistogram *histogram = &thread->histograms[profiler().quadrant.load(std::memory_order_relaxed)][phase];
+    std::atomic<uint32_t> *bucket = &histogram->buckets[profileBucket(ticks)];
+    bucket->store(bucket->load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    histogram->count.store(histogram->count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (ticks > histogram->max.load(std::memory_order_relaxed))
+        histogram->max.store(ticks, std::memory_order_relaxed);
+}
+
+//Times a phase, from where it is declared to the end of the block.
+class ProfileScope{
+public:
+    explicit ProfileScope(int phase){
+        this->phase = phase;
+        start       = profileTicks();
+    }
+    ~ProfileScope(){
+        recordProfile(phase, profileTicks() - start);
+    }
+
+private:
+    int      phase;
+    uint64_t start;
+};
+
+//Asks for the profile to be printed, e.g. from a signal handler. Call profileDumpRequested()
+//from the control loop to print it there.
+inline void requestProfileDump(int){
+    profiler().dump_requested.store(1, std::memory_order_relaxed);
+}
+
+inline bool profileDumpRequested(){
+    return profiler().dump_requested.exchange(0, std::memory_order_relaxed) != 0;
+}
+
+//Returns the value under which `fraction` of the histogram falls, in ticks.
+inline uint64_t profilePercentile(const ProfileHistogram *histogram, uint64_t count, double fraction){
+    uint64_t rank = (uint64_t)(fraction*count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    uint64_t max  = histogram->max.load(std::memory_order_relaxed);
+    uint64_t seen = 0;
+    for (int i = 0; i < PROFILE_BUCKETS; i++){
+        seen += histogram->buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+            return profileBucketValue(i) < max ? profileBucketValue(i) : max;
+    }
+    return max;
+}
+
+//Prints calls, p50, p99 and max (in microseconds) of every phase used, per thread and quadrant.
+inline void printProfile(){
+    Profiler &state = profiler();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (state.threads.empty())
+        return;
+    //Counter ticks per ns, measured over the whole run.
+    uint64_t elapsed_ns   = profileRawNs() - state.start_ns;
+    double   ticks_per_ns = elapsed_ns > 0 ? (double)(profileTicks() - state.start_ticks)/elapsed_ns : 1;
+    if (ticks_per_ns <= 0)
+        ticks_per_ns = 1;
+    printf("Profile (us)       thread    Q      calls       p50       p99       max\n");
+    for (size_t t = 0; t < state.threads.size(); t++){
+        ProfileThread *thread = state.threads[t];
+        for (int quad = 0; quad < PROFILE_QUADRANTS; quad++){
+            for (int phase = 0; phase < PHASE_COUNT; phase++){
+                const ProfileHistogram *histogram = &thread->histograms[quad][phase];
+                uint64_t count = histogram->count.load(std::memory_order_relaxed);
+                if (count == 0)
+                    continue;
+                double p50 = profilePercentile(histogram, count, 0.50)/ticks_per_ns/1000;
+                double p99 = profilePercentile(histogram, count, 0.99)/ticks_per_ns/1000;
+                double max = histogram->max.load(std::memory_order_relaxed)/ticks_per_ns/1000;
+                char quadrant[4] = "-";
+                if (quad > 0)
+                    snprintf(quadrant, sizeof(quadrant), "%d", quad);
+                printf("%-18s %-9s %-2s %10llu %9.2f %9.2f %9.2f\n", PHASE_NAMES[phase], thread->name, quadrant,
+                       (unsigned long long)count, p50, p99, max);
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <time.h>
+#include <stdint.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "clock.h"
+
+//Periodic scheduler for the control loops.
+//Every tick has an absolute deadline on the clock (start + n*period), so the time
+//spent processing a tick is not added on top of the sleep like it is with usleep().
+//Nanoseconds are int64_t: long is 32 bits on Raspberry Pi OS and would overflow after 2.1 s.
+
+const int64_t NSEC_PER_SEC  = 1000000000LL;
+const int64_t NSEC_PER_USEC = 1000LL;
+
+//Structure to store the state of a periodic loop.
+struct Scheduler{
+    int64_t         period_ns;
+    struct timespec next_tick;   //Absolute deadline of the next tick.
+    long            ticks;       //Number of ticks completed so far.
+    long            overruns;    //Number of ticks whose deadline had already passed when waited for.
+    long            missed;      //Number of whole periods skipped because of overruns.
+    int64_t         max_late_ns; //Worst lateness seen when an overrun happened.
+};
+
+//Adds a number of nanoseconds to a timespec, keeping tv_nsec normalized.
+inline void addNanoseconds(struct timespec *t, int64_t ns){
+    t->tv_sec  += ns/NSEC_PER_SEC;
+    t->tv_nsec += ns%NSEC_PER_SEC;
+    if (t->tv_nsec >= NSEC_PER_SEC){
+        t->tv_sec++;
+        t->tv_nsec -= NSEC_PER_SEC;
+    }
+}
+
+//Returns a - b in nanoseconds.
+inline int64_t diffNanoseconds(const struct timespec *a, const struct timespec *b){
+    return (int64_t)(a->tv_sec - b->tv_sec)*NSEC_PER_SEC + (a->tv_nsec - b->tv_nsec);
+}
+
+//Sets up a scheduler that ticks every period_us microseconds, starting one period from now.
+//rt_priority > 0 switches the process to SCHED_FIFO with that priority (needs root).
+//cpu >= 0 pins the process to that core.
+//Failing to get real-time priority or the CPU affinity is not fatal: the loop still runs,
+//only with more jitter, so it just prints a warning and returns false.
+inline bool initScheduler(Scheduler *scheduler, long period_us, int rt_priority, int cpu){
+    bool ok = true;
+    scheduler->period_ns   = period_us*NSEC_PER_USEC;
+    scheduler->ticks       = 0;
+    scheduler->overruns    = 0;
+    scheduler->missed      = 0;
+    scheduler->max_late_ns = 0;
+
+    if (rt_priority > 0){
+        struct sched_param param;
+        param.sched_priority = rt_priority;
+        if (sched_setscheduler(0, SCHED_FIFO, &param) != 0){
+            fprintf(stderr, "Scheduler: could not set SCHED_FIFO (%s)\n", strerror(errno));
+            ok = false;
+        }
+    }
+    if (cpu >= 0){
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0){
+            fprintf(stderr, "Scheduler: could not pin to CPU %d (%s)\n", cpu, strerror(errno));
+            ok = false;
+        }
+    }
+
+    clockNow(&scheduler->next_tick);
+    addNanoseconds(&scheduler->next_tick, scheduler->period_ns);
+    return ok;
+}
+
+//Sleeps until the deadline of the next tick.
+//If the deadline has already passed the tick counts as an overrun, and the deadlines
+//that were missed are skipped so the loop doesn't try to catch up with a burst of ticks.
+inline void waitForTick(Scheduler *scheduler){
+    struct timespec now;
+    clockNow(&now);
+    int64_t late_ns = diffNanoseconds(&now, &scheduler->next_tick);
+    if (late_ns > 0){
+        scheduler->overruns++;
+        if (late_ns > scheduler->max_late_ns)
+            scheduler->max_late_ns = late_ns;
+        int64_t skipped = late_ns/scheduler->period_ns;
+        scheduler->missed += skipped;
+        addNanoseconds(&scheduler->next_tick, skipped*scheduler->period_ns);
+    }
+    else {
+        clockSleepUntil(&scheduler->next_tick);
+    }
+    addNanoseconds(&scheduler->next_tick, scheduler->period_ns);
+    scheduler->ticks++;
+}
+
+//Returns the number of ticks needed to cover duration_us microseconds, rounded up.
+inline int64_t ticksFor(const Scheduler *scheduler, int64_t duration_us){
+    return (duration_us*NSEC_PER_USEC + scheduler->period_ns - 1)/scheduler->period_ns;
+}
+
+//Waits for as many ticks as needed to cover duration_us microseconds, calling on_tick (if
+//not NULL) after each one, like the main loop does between its ticks.
+//Use this instead of usleep() inside control loops so the loop stays on its period.
+inline void waitTicks(Scheduler *scheduler, int64_t duration_us, void (*on_tick)() = NULL){
+    int64_t ticks = ticksFor(scheduler, duration_us);
+    for (int64_t i = 0; i < ticks; i++){
+        waitForTick(scheduler);
+        if (on_tick != NULL)
+            on_tick();
+    }
+}
+
+//Prints tick and overrun counters.
+inline void printSchedulerStats(const Scheduler *scheduler){
+    printf("Ticks: %ld, overruns: %ld, missed periods: %ld, worst lateness: %lld us\n",
+           scheduler->ticks, scheduler->overruns, scheduler->missed,
+           (long long)(scheduler->max_late_ns/NSEC_PER_USEC));
+}
+
+#endif
@@ -0,0 +1,63 @@
+//The functions of E101.h, on the simulator. Programs that call the library directly instead of
+//through HAL (main5.cpp, Q4 Variations/main1-4.cpp) link this file in place of -le101:
+//
+//  g++ -std=c++20 -O2 -pthread -funsigned-char -DHAL_SIM -I. -o main5_sim main5.cpp sim/sim_hal.cpp sim/e101_sim.cpp \
+//      -Wl,--wrap=usleep
+//
+//Every function forwards to the backend installed by sim_hal.cpp. The programs also time their
+//turns with usleep(), which has to sleep on the clock of clock.h like sleep1() does. Rather than
+//replacing usleep() for the whole process (and every library in it), this file defines
+//__wrap_usleep(): --wrap=usleep only sends the calls in the objects of this link to it, and
+//without the option the programs keep the real usleep().
+//
+//These programs don't handle SIGINT, so the simulator doesn't raise it at the end of the run
+//(see SimBackend::finish()). Instead the first library call after the end prints the report
+//and exits.
+#include <stdio.h>
+#include <unistd.h>
+#include "../E101.h"
+#include "../clock.h"
+#include "sim_backend.h"
+
+extern SimBackend *sim_backend;
+
+//Ends the program once the run is over.
+static void checkRunOver(){
+    if (sim_backend->result == SIM_RUNNING)
+        return;
+    sim_backend->printReport();
+    fflush(stdout);
+    _exit(0);
+}
+
+void stop(int motor){ halBackend()->stop(motor); checkRunOver(); }
+int  init(){ return halBackend()->init(); }
+int  take_picture(){ int rc = halBackend()->take_picture(); checkRunOver(); return rc; }
+int  save_picture(char fn[5]){ return halBackend()->save_picture(fn); }
+char get_pixel(int row, int col, int color){ return halBackend()->get_pixel(row, col, color); }
+int  set_pixel(int row, int col, char red, char green, char blue){
+    return halBackend()->set_pixel(row, col, red, green, blue);
+}
+void convert_camera_to_screen(){ halBackend()->convert_camera_to_screen(); }
+int  open_screen_stream(){ return halBackend()->open_screen_stream(); }
+int  close_screen_stream(){ return halBackend()->close_screen_stream(); }
+int  update_screen(){ return halBackend()->update_screen(); }
+int  display_picture(int delay_sec, int delay_usec){ return halBackend()->display_picture(delay_sec, delay_usec); }
+int  set_motor(int motor, int speed){ int rc = halBackend()->set_motor(motor, speed); checkRunOver(); return rc; }
+int  sleep1(int sec, int usec){ int rc = halBackend()->sleep1(sec, usec); checkRunOver(); return rc; }
+int  select_IO(int chan, int direct){ return halBackend()->select_IO(chan, direct); }
+int  write_digital(int chan, char level){ return halBackend()->write_digital(chan, level); }
+int  read_digital(int chan){ int rc = halBackend()->read_digital(chan); checkRunOver(); return rc; }
+int  read_analog(int in_ch_adc){ int rc = halBackend()->read_analog(in_ch_adc); checkRunOver(); return rc; }
+int  set_PWM(int chan, int value){ return halBackend()->set_PWM(chan, value); }
+int  set_PWM_frequency(int chan, int freq){ return halBackend()->set_PWM_frequency(chan, freq); }
+int  set_servo(int chan, int value){ return halBackend()->set_servo(chan, value); }
+int  connect_to_server(char server_addr[15], int port){ return halBackend()->connect_to_server(server_addr, port); }
+int  send_to_server(char message[24]){ return halBackend()->send_to_server(message); }
+int  receive_from_server(char message[24]){ return halBackend()->receive_from_server(message); }
+
+extern "C" int __wrap_usleep(useconds_t usec){
+    clockSleep(usec);
+    checkRunOver();
+    return 0;
+}
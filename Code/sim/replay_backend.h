@@ -0,0 +1,375 @@
+#ifndef REPLAY_BACKEND_H
+#define REPLAY_BACKEND_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../hal.h"
+#include "../clock.h"
+#include "../journal.h"
+#include "../frame_codec.h"
+
+//HAL backend and clock that replay a recorded run (journal.h) to the control code.
+//The control thread gets back, tick by tick, the clock readings, ADC and digital readings and
+//pictures it got during the run, and its motor commands are checked against the ones it posted
+//then. With the same code, the commands are the same, bit for bit; after a change, the first
+//tick where they differ is reported. The inputs keep coming from the recording after that
+//(the robot doesn't move differently), which is what is needed to see how a change reacts to
+//the same situation.
+//
+//Within a tick, each kind of input is taken in order from the ones recorded in the same tick,
+//so a change that reads a sensor once more or once less stays in step from the next tick on.
+//An input that isn't in the recording gets the last value recorded and is counted.
+//
+//What the control thread learnt from the other threads (the gate handshake and monitor) comes
+//from the recording too. The other threads still run: they see the time of the last clock
+//reading of the control thread, sleep on it, and read the last value recorded for a channel.
+//The gate server answers at once. The clock reports itself as virtual, so waits use the
+//polling paths of the gate code.
+
+const int REPLAY_CHANNELS = 16; //ADC and digital channels.
+
+class ReplayBackend : public HalBackend, public ClockSource, public HalJournal{
+public:
+    JournalHeader             header;
+    std::vector<JournalEvent> events;
+    std::vector<size_t>       ticks;        //Index of the first event of each tick (the first tick is the startup).
+    std::thread::id           control_thread;
+
+    //Pictures
+    bool                 raw;               //Raw recording (frame_recorder.h) rather than a stream.
+    FrameLog             log;
+    FrameStream          stream;
+    uint32_t             next_frame;        //Next record of a raw recording.
+    bool                 frames_left;
+    const FrameRecord   *frame;             //Last record read.
+    const uint8_t       *frame_pixels;
+    std::vector<uint8_t> pixels;            //Picture given to the control code.
+    int                  width;
+    int                  height;
+    int                  channels;
+
+    //Position in the journal.
+    size_t current;                         //Tick being replayed.
+    size_t cursor[EVENT_TICK];              //Next event of each type in the tick.
+    bool   tick_diverged;
+
+    //Last values, for inputs that aren't in the recording and for the other threads.
+    std::mutex              mutex;
+    std::condition_variable woken;
+    long long               now_ns;
+    bool                    over;
+    int                     analog_values[REPLAY_CHANNELS];
+    int                     digital_values[REPLAY_CHANNELS];
+
+    //Report
+    long   first_divergence;                //Tick, -1 if none.
+    double divergence_time;
+    int    recorded_left, recorded_right, replayed_left, replayed_right;
+    long   diverged_ticks;
+    long   missing_inputs;
+    long   missing_pictures;
+
+    ReplayBackend(){
+        control_thread   = std::this_thread::get_id();
+        frame            = NULL;
+        frame_pixels     = NULL;
+        current          = 0;
+        tick_diverged    = false;
+        now_ns           = 0;
+        over             = false;
+        first_divergence = -1;
+        divergence_time  = 0;
+        recorded_left    = recorded_right = replayed_left = replayed_right = 0;
+        diverged_ticks   = 0;
+        missing_inputs   = 0;
+        missing_pictures = 0;
+        memset(analog_values, 0, sizeof(analog_values));
+        memset(digital_values, 0, sizeof(digital_values));
+    }
+
+    //Loads the recording and its journal. Returns false, after printing why, if they can't be read.
+    bool open(const char *file){
+        std::string journal_file = std::string(file) + ".inputs";
+        if (!loadJournal(journal_file.c_str(), &header, &events)){
+            fprintf(stderr, "Replay: can't read the journal %s\n", journal_file.c_str());
+            return false;
+        }
+        if (header.dropped > 0)
+            fprintf(stderr, "Replay: the journal stops %llu events short of the run\n",
+                    (unsigned long long)header.dropped);
+        ticks.push_back(0);
+        for (size_t i = 0; i < events.size(); i++)
+            if (events[i].type == EVENT_TICK)
+                ticks.push_back(i + 1);
+        startTick(0);
+
+        raw = openFrameLog(&log, file);
+        if (raw){
+            width       = log.header->width;
+            height      = log.header->height;
+            channels    = log.header->channels;
+            next_frame  = 0;
+        }
+        else if (openFrameStream(&stream, file)){
+            width    = stream.header.width;
+            height   = stream.header.height;
+            channels = stream.header.channels;
+            if (stream.header.tolerance > 0 && stream.exact.rows + stream.exact.columns == 0)
+                fprintf(stderr, "Replay: the pictures were recorded with a tolerance of %u, the replay won't be exact\n",
+                        stream.header.tolerance);
+            else if (stream.header.tolerance > 0)
+                fprintf(stderr, "Replay: the pictures were recorded with a tolerance of %u, the replay is exact only if "
+                        "the code reads %u rows and %u columns kept without loss\n",
+                        stream.header.tolerance, stream.exact.rows, stream.exact.columns);
+        }
+        else {
+            fprintf(stderr, "Replay: can't read the pictures %s\n", file);
+            return false;
+        }
+        if (channels < 3)
+            fprintf(stderr, "Replay: the pictures have %d channels instead of RGB, the replay won't be exact\n",
+                    channels);
+        frames_left = true;
+        pixels.assign((size_t)width*height*channels, 0);
+        return true;
+    }
+
+    //==== Clock ====
+
+    void now(struct timespec *t){
+        long long time_ns;
+        const JournalEvent *event = onControlThread() ? nextEvent(EVENT_CLOCK, -1) : NULL;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (event != NULL){
+            now_ns = event->time_ns;
+            woken.notify_all();
+        }
+        time_ns   = now_ns;
+        t->tv_sec  = time_ns/1000000000LL;
+        t->tv_nsec = time_ns%1000000000LL;
+    }
+
+    //The control thread doesn't wait: the time it reads next is the one of the recording.
+    void sleepUntil(const struct timespec *deadline){
+        if (onControlThread())
+            return;
+        long long wake_ns = deadline->tv_sec*1000000000LL + deadline->tv_nsec;
+        std::unique_lock<std::mutex> lock(mutex);
+        woken.wait(lock, [this, wake_ns]{ return over || now_ns >= wake_ns; });
+    }
+
+    bool isVirtual(){ return true; }
+
+    //==== HAL ====
+
+    int take_picture(){
+        if (!onControlThread())
+            return 0;
+        const JournalEvent *event = nextEvent(EVENT_PICTURE, -1);
+        if (event == NULL){
+            if (!over)
+                missing_pictures++;
+            return 0;
+        }
+        loadPicture(event->value);
+        return 0;
+    }
+
+    char get_pixel(int row, int col, int color){
+        if (row < 0 || col < 0 || row >= height || col >= width || color < 0 || color > 3)
+            return 0;
+        const uint8_t *pixel = &pixels[((size_t)row*width + col)*channels];
+        if (channels == 1)
+            return (char)pixel[0];
+        if (color == 3 && channels == 3)
+            return (char)((pixel[0] + pixel[1] + pixel[2])/3);
+        return (char)pixel[color];
+    }
+
+    int set_motor(int, int){
+        return 0;
+    }
+
+    int read_analog(int chan){
+        return input(EVENT_ANALOG, chan, analog_values);
+    }
+
+    int read_digital(int chan){
+        return input(EVENT_DIGITAL, chan, digital_values);
+    }
+
+    int sleep1(int sec, int usec){
+        clockSleep(sec*1000000L + usec);
+        return 0;
+    }
+
+    //==== Journal ====
+    //The inputs have been taken from the journal already.
+
+    void picture(){}
+    void analog(int, int){}
+    void digital(int, int){}
+
+    void observe(int *value, struct timespec *time){
+        if (!onControlThread() || over)
+            return;
+        const JournalEvent *event = nextEvent(EVENT_OBSERVE, -1);
+        if (event == NULL){
+            missing_inputs++;
+            return;
+        }
+        *value = event->value;
+        if (time != NULL){
+            time->tv_sec  = event->time_ns/1000000000LL;
+            time->tv_nsec = event->time_ns%1000000000LL;
+        }
+    }
+
+    void command(int left_dc, int right_dc){
+        if (!onControlThread() || over)
+            return;
+        const JournalEvent *event = nextEvent(EVENT_COMMAND, -1);
+        if (event != NULL && commandLeft(event->value) == left_dc && commandRight(event->value) == right_dc)
+            return;
+        if (event != NULL)
+            diverge(commandLeft(event->value), commandRight(event->value), left_dc, right_dc);
+        else
+            diverge(0, 0, left_dc, right_dc);
+    }
+
+    //Moves on to the next tick of the recording, or ends the run after the last one.
+    void tick(){
+        if (!onControlThread() || over)
+            return;
+        //Commands the run posted in this tick that the replay didn't.
+        const JournalEvent *left_out = nextEvent(EVENT_COMMAND, -1);
+        if (left_out != NULL)
+            diverge(commandLeft(left_out->value), commandRight(left_out->value), 0, 0);
+        if (tick_diverged)
+            diverged_ticks++;
+        if (current + 1 >= ticks.size()){
+            end();
+            return;
+        }
+        startTick(current + 1);
+    }
+
+    void printReport(){
+        printf("Replay: %zu/%zu ticks", current, ticks.size() - 1);
+        if (first_divergence < 0)
+            printf(", motor commands identical\n");
+        else
+            printf(", motor commands diverge at tick %ld (%.3f s): recorded %d %d, now %d %d\n", first_divergence,
+                   divergence_time, recorded_left, recorded_right, replayed_left, replayed_right);
+        printf("Replay: %ld ticks with other commands, %ld inputs and %ld pictures not in the recording\n",
+               diverged_ticks, missing_inputs, missing_pictures);
+    }
+
+private:
+    bool onControlThread(){
+        return std::this_thread::get_id() == control_thread;
+    }
+
+    void startTick(size_t index){
+        current       = index;
+        tick_diverged = false;
+        for (int type = 0; type < EVENT_TICK; type++)
+            cursor[type] = ticks[index];
+    }
+
+    //Returns the next event of a type (and channel, unless -1) in the tick, or NULL.
+    const JournalEvent *nextEvent(int type, int channel){
+        size_t end = current + 1 < ticks.size() ? ticks[current + 1] - 1 : events.size();
+        for (size_t i = cursor[type]; i < end; i++){
+            const JournalEvent *event = &events[i];
+            if (event->type == type && (channel < 0 || event->channel == channel)){
+                cursor[type] = i + 1;
+                return event;
+            }
+        }
+        cursor[type] = end;
+        return NULL;
+    }
+
+    int input(int type, int chan, int *values){
+        if (chan < 0 || chan >= REPLAY_CHANNELS)
+            return 0;
+        if (onControlThread()){
+            const JournalEvent *event = over ? NULL : nextEvent(type, chan);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (event != NULL)
+                values[chan] = event->value;
+            else if (!over)
+                missing_inputs++;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        return values[chan];
+    }
+
+    //Makes picture `number` of the recording current. A picture the recording dropped leaves the
+    //previous one.
+    void loadPicture(int number){
+        while (frames_left && (frame == NULL || frame->picture < number)){
+            if (raw){
+                frames_left = next_frame < log.frames;
+                if (frames_left){
+                    frame        = frameLogRecord(&log, next_frame++);
+                    frame_pixels = framePixels((FrameRecord *)frame);
+                }
+            }
+            else {
+                frames_left = readFrame(&stream);
+                if (frames_left){
+                    frame        = &stream.record;
+                    frame_pixels = stream.picture.data();
+                }
+            }
+        }
+        if (frame == NULL || frame->picture != number){
+            missing_pictures++;
+            return;
+        }
+        memcpy(pixels.data(), frame_pixels, pixels.size());
+    }
+
+    void diverge(int recorded_left_dc, int recorded_right_dc, int left_dc, int right_dc){
+        tick_diverged = true;
+        if (first_divergence >= 0)
+            return;
+        first_divergence = current;
+        recorded_left    = recorded_left_dc;
+        recorded_right   = recorded_right_dc;
+        replayed_left    = left_dc;
+        replayed_right   = right_dc;
+        long long start_ns = 0;
+        for (size_t i = 0; i < events.size(); i++)
+            if (events[i].type == EVENT_CLOCK){
+                start_ns = events[i].time_ns;
+                break;
+            }
+        std::lock_guard<std::mutex> lock(mutex);
+        divergence_time = (now_ns - start_ns)/1e9;
+    }
+
+    //Ends the run the way Ctrl+C does, and lets the other threads go.
+    void end(){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            over = true;
+        }
+        woken.notify_all();
+        struct sigaction current;
+        if (sigaction(SIGINT, NULL, &current) == 0 && current.sa_handler != SIG_DFL)
+            raise(SIGINT);
+    }
+};
+
+#endif
@@ -0,0 +1,47 @@
+//Replays a run recorded with RECORD=<file> (see readRecordFile() in main.cpp) to a program
+//built with -DHAL_SIM, without changing the program:
+//
+//  g++ -std=c++20 -O2 -pthread -funsigned-char -DHAL_SIM -o main_replay main.cpp sim/replay_hal.cpp
+//  REPLAY=run.fz QUADRANT=2 ./main_replay
+//
+//(or "make main_replay"). Start it in the quadrant the run started in. The report, printed
+//when the program exits, gives the first tick where the motor commands differ from the run
+//(see sim/replay_backend.h).
+//
+//Environment:
+//  REPLAY  the recording; its journal is REPLAY.inputs
+#include <stdio.h>
+#include <stdlib.h>
+#include "../clock.h"
+#include "replay_backend.h"
+
+//Fields
+ReplayBackend *replay_backend = NULL;
+
+void printReplayReport(){
+    if (replay_backend != NULL)
+        replay_backend->printReport();
+}
+
+//Loads the recording and installs the backend.
+void installReplay(){
+    const char *file = getenv("REPLAY");
+    if (file == NULL){
+        fprintf(stderr, "Replay: set REPLAY to the recording to replay\n");
+        exit(1);
+    }
+    replay_backend = new ReplayBackend();
+    if (!replay_backend->open(file))
+        exit(1);
+    setClockSource(replay_backend);
+    setHalBackend(replay_backend);
+    setHalJournal(replay_backend);
+    atexit(printReplayReport);
+}
+
+//Runs installReplay() before main().
+struct ReplayInstaller{
+    ReplayInstaller(){
+        installReplay();
+    }
+} replay_installer;
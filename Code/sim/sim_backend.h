@@ -0,0 +1,258 @@
+#ifndef SIM_BACKEND_H
+#define SIM_BACKEND_H
+
+#include <stdio.h>
+#include <signal.h>
+#include <time.h>
+#include <mutex>
+#include <random>
+#include "../hal.h"
+#include "../clock.h"
+#include "../scheduler.h"
+#include "sim_world.h"
+#include "sim_robot.h"
+#include "sim_camera.h"
+#include "sim_sensors.h"
+
+//HAL backend that drives a simulated robot on a simulated course.
+//Motor commands set the wheel duty cycles; every call catches the simulation up with the
+//clock first, so the robot moves between calls just like the real one does. The clock is
+//whatever clock.h uses: real time, or a VirtualClock to run faster than real time. Pictures are
+//rendered from the pose at take_picture(), and the distance sensors are ray-cast against the
+//walls and gates. The robot can't go through walls: a step that would touch one only keeps
+//its part along the wall, and each new contact counts as a collision. When the robot passes the last checkpoint, runs
+//out of time or leaves the course, the backend raises SIGINT, which main() already treats
+//as the end of the run.
+//On a virtual clock the calls also take time, like on the robot, so a loop that only polls a
+//sensor still sees the world move.
+
+//Channels the program uses (see main.cpp).
+struct SimWiring{
+    int left_motor;
+    int right_motor;
+    int front_sensor;
+    int left_sensor;
+    int right_sensor;
+};
+
+const SimWiring DEFAULT_WIRING  = {2, 1, 6, 5, 0};
+const double    SIM_SUBSTEP     = 0.005; //s between collision checks.
+const double    SPIN_ANGLE      = M_PI;  //A turn on the spot larger than this counts as a recovery spin.
+
+//Time each call takes on the robot. #todo measure on the robot.
+const long PICTURE_TIME_US = 10000;
+const long ANALOG_TIME_US  = 100;
+const long DIGITAL_TIME_US = 10;
+const long MOTOR_TIME_US   = 50;
+
+enum SimResult{
+    SIM_RUNNING,
+    SIM_FINISHED,
+    SIM_TIME_UP,
+    SIM_OFF_COURSE
+};
+
+class SimBackend : public HalBackend{
+public:
+    const Course       *course;
+    SimWiring           wiring;
+    SimRobot            robot;
+    SimCamera           camera;
+    double              time_limit; //s
+    double              time;       //s since init().
+    SimResult           result;
+    size_t              next_checkpoint;
+    std::vector<double> checkpoint_times;
+    Pose                picture_pose;
+    uint32_t            frame;
+    long                pictures;
+    long                collisions;
+    bool                touching;     //Against a wall right now.
+    long                spins;        //Recovery spins.
+    double              spin_angle;   //rad turned on the spot so far.
+    uint32_t            seed;
+    std::mt19937        random;       //Sensor noise.
+    std::mutex          mutex;
+    struct timespec     last_update;
+
+    SimBackend(const Course *sim_course, const SimRobotParams *params, double limit_s, uint32_t noise_seed){
+        course     = sim_course;
+        seed       = noise_seed;
+        wiring     = DEFAULT_WIRING;
+        time_limit = limit_s;
+        initSimCamera(&camera);
+        initSimRobot(&robot, params, course->start);
+        restart();
+    }
+
+    //Puts the robot back on the start and the clock to 0.
+    void restart(){
+        initSimRobot(&robot, &robot.params, course->start);
+        time            = 0;
+        result          = SIM_RUNNING;
+        next_checkpoint = 0;
+        checkpoint_times.clear();
+        picture_pose    = robot.pose;
+        frame           = 0;
+        pictures        = 0;
+        collisions      = 0;
+        touching        = false;
+        spins           = 0;
+        spin_angle      = 0;
+        random.seed(seed);
+        clockNow(&last_update);
+    }
+
+    //Moves the simulation up to now. Needs the mutex.
+    void advance(){
+        struct timespec now;
+        clockNow(&now);
+        double dt = diffNanoseconds(&now, &last_update)/1e9;
+        last_update = now;
+        if (dt <= 0 || result != SIM_RUNNING)
+            return;
+        while (dt > 0){
+            double h = fmin(dt, SIM_SUBSTEP);
+            Pose before = robot.pose;
+            stepSimRobot(&robot, h);
+            time += h;
+            dt   -= h;
+            if (touchesWall(course, time, robot.pose.x, robot.pose.y, SIM_ROBOT_RADIUS)){
+                //The robot scrapes along the wall: it keeps the part of the step along the wall
+                //(walls run along x or y) and the wheels can still pivot it.
+                if (!touchesWall(course, time, before.x, robot.pose.y, SIM_ROBOT_RADIUS))
+                    robot.pose.x = before.x;
+                else if (!touchesWall(course, time, robot.pose.x, before.y, SIM_ROBOT_RADIUS))
+                    robot.pose.y = before.y;
+                else {
+                    robot.pose.x = before.x;
+                    robot.pose.y = before.y;
+                }
+                if (!touching)
+                    collisions++;
+                touching = true;
+            }
+            else
+                touching = false;
+            if (robot.duty[0]*robot.duty[1] < 0)
+                spin_angle += fabs(robot.pose.heading - before.heading);
+            else
+                endSpin();
+        }
+
+        if (next_checkpoint < course->checkpoints.size()){
+            const Checkpoint *checkpoint = &course->checkpoints[next_checkpoint];
+            double dx = robot.pose.x - checkpoint->x, dy = robot.pose.y - checkpoint->y;
+            if (dx*dx + dy*dy <= checkpoint->radius*checkpoint->radius){
+                checkpoint_times.push_back(time);
+                next_checkpoint++;
+                if (next_checkpoint == course->checkpoints.size())
+                    finish(SIM_FINISHED);
+            }
+        }
+        if (result == SIM_RUNNING && time > time_limit)
+            finish(SIM_TIME_UP);
+        if (result == SIM_RUNNING && !onFloor(&course->floor, robot.pose.x, robot.pose.y))
+            finish(SIM_OFF_COURSE);
+    }
+
+    //Counts the turn on the spot that just ended if it was a recovery spin.
+    void endSpin(){
+        if (spin_angle > SPIN_ANGLE)
+            spins++;
+        spin_angle = 0;
+    }
+
+    //Ends the run. SIGINT is only raised for programs that handle it: the others would be
+    //killed before the report is printed (see e101_sim.cpp).
+    void finish(SimResult how){
+        result = how;
+        endSpin();
+        struct sigaction current;
+        if (sigaction(SIGINT, NULL, &current) == 0 && current.sa_handler != SIG_DFL)
+            raise(SIGINT);
+    }
+
+    //Lets the time of a call pass on a virtual clock. Called without the mutex.
+    void callTime(long usec){
+        if (clockSource()->isVirtual())
+            clockSleep(usec);
+    }
+
+    int init(){
+        std::lock_guard<std::mutex> lock(mutex);
+        restart();
+        return 0;
+    }
+
+    int take_picture(){
+        callTime(PICTURE_TIME_US);
+        std::lock_guard<std::mutex> lock(mutex);
+        advance();
+        picture_pose = robot.pose;
+        frame++;
+        pictures++;
+        return 0;
+    }
+
+    //Only reads what take_picture() left, so it doesn't need the mutex.
+    char get_pixel(int row, int col, int color){
+        return (char)cameraPixel(&camera, &course->floor, &picture_pose, frame, row, col, color);
+    }
+
+    int set_motor(int motor, int speed){
+        callTime(MOTOR_TIME_US);
+        std::lock_guard<std::mutex> lock(mutex);
+        advance();
+        if (motor == wiring.left_motor)
+            robot.duty[0] = speed;
+        else if (motor == wiring.right_motor)
+            robot.duty[1] = speed;
+        return 0;
+    }
+
+    //Digital side sensors read 0 when something is close.
+    int read_digital(int chan){
+        callTime(DIGITAL_TIME_US);
+        std::lock_guard<std::mutex> lock(mutex);
+        advance();
+        if (chan == wiring.left_sensor)
+            return digitalReading(sensorDistance(course, time, &robot.pose, &LEFT_MOUNT));
+        if (chan == wiring.right_sensor)
+            return digitalReading(sensorDistance(course, time, &robot.pose, &RIGHT_MOUNT));
+        return 1;
+    }
+
+    int read_analog(int in_ch_adc){
+        callTime(ANALOG_TIME_US);
+        std::lock_guard<std::mutex> lock(mutex);
+        advance();
+        if (in_ch_adc == wiring.front_sensor)
+            return analogReading(sensorDistance(course, time, &robot.pose, &FRONT_MOUNT), &random);
+        //The side sensors read on an ADC channel (as the Q4 variations do): 0 or full scale.
+        if (in_ch_adc == wiring.left_sensor)
+            return digitalReading(sensorDistance(course, time, &robot.pose, &LEFT_MOUNT))*ADC_MAX;
+        if (in_ch_adc == wiring.right_sensor)
+            return digitalReading(sensorDistance(course, time, &robot.pose, &RIGHT_MOUNT))*ADC_MAX;
+        return 0;
+    }
+
+    int sleep1(int sec, int usec){
+        clockSleep(sec*1000000L + usec);
+        return 0;
+    }
+
+    //Prints how the run went.
+    void printReport(){
+        std::lock_guard<std::mutex> lock(mutex);
+        const char *names[] = {"still running", "finished", "time up", "left the course"};
+        printf("Sim: %s after %.3f s, %zu/%zu checkpoints, %.0f mm travelled, %ld pictures, %ld collisions, "
+               "%ld spins\n", names[result], time, checkpoint_times.size(), course->checkpoints.size(), robot.distance,
+               pictures, collisions, spins + (spin_angle > SPIN_ANGLE ? 1 : 0));
+        printf("Sim: %.3f s of CPU time\n", (double)clock()/CLOCKS_PER_SEC);
+        for (size_t i = 0; i < checkpoint_times.size(); i++)
+            printf("Sim: %-12s at %8.3f s\n", course->checkpoints[i].name, checkpoint_times[i]);
+    }
+};
+
+#endif
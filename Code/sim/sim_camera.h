@@ -0,0 +1,89 @@
+#ifndef SIM_CAMERA_H
+#define SIM_CAMERA_H
+
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+#include "sim_world.h"
+
+//Synthetic picture of the E101 camera.
+//The camera is a pinhole looking forwards and down at the floor. For every pixel of the
+//320x240 picture the point of the floor it sees is worked out once, relative to the robot;
+//a pixel is then just a lookup in the floor raster from the pose at take_picture(), so only
+//the pixels that the control code actually reads are ever computed. Some noise is added,
+//the same for a pixel until the next picture. Like the camera library, the luminosity is the
+//mean of the red, green and blue of the pixel, noise included.
+
+const int SIM_PIC_WIDTH  = 320;
+const int SIM_PIC_HEIGHT = 240;
+
+//Structure to store the camera and its projection table.
+struct SimCamera{
+    double             height;   //mm above the floor.
+    double             tilt;     //rad below the horizon.
+    double             hfov;     //rad, horizontal field of view.
+    double             offset;   //mm ahead of the wheel axle.
+    int                noise;    //Max. change of a colour component.
+    std::vector<float> ahead;    //mm ahead of the axle seen by each pixel.
+    std::vector<float> left;     //mm to the left.
+};
+
+//#todo measure on the robot. Row 190 sees about 10 cm of floor, 11 cm ahead of the axle.
+inline void initSimCamera(SimCamera *camera, double height = 100, double tilt_deg = 60,
+                          double hfov_deg = 50, double offset = 80, int noise = 12){
+    camera->height = height;
+    camera->tilt   = tilt_deg*M_PI/180;
+    camera->hfov   = hfov_deg*M_PI/180;
+    camera->offset = offset;
+    camera->noise  = noise;
+    camera->ahead.assign(SIM_PIC_WIDTH*SIM_PIC_HEIGHT, 0);
+    camera->left.assign(SIM_PIC_WIDTH*SIM_PIC_HEIGHT, 0);
+
+    double focal = (SIM_PIC_WIDTH/2)/tan(camera->hfov/2);
+    double s = sin(camera->tilt), c = cos(camera->tilt);
+    for (int row = 0; row < SIM_PIC_HEIGHT; row++){
+        double v = (row - SIM_PIC_HEIGHT/2 + 0.5)/focal;
+        double t = height/(s + v*c); //Distance along the ray to the floor (the tilt keeps it positive).
+        for (int column = 0; column < SIM_PIC_WIDTH; column++){
+            double u = (column - SIM_PIC_WIDTH/2 + 0.5)/focal;
+            camera->ahead[row*SIM_PIC_WIDTH + column] = (float)(offset + t*(c - v*s));
+            camera->left[row*SIM_PIC_WIDTH + column]  = (float)(-t*u);
+        }
+    }
+}
+
+//Cheap deterministic noise in [-amplitude, amplitude] for a pixel of a picture.
+inline int pixelNoise(uint32_t frame, int row, int column, int color, int amplitude){
+    if (amplitude <= 0)
+        return 0;
+    uint32_t h = frame*0x9E3779B1u ^ (uint32_t)(row*SIM_PIC_WIDTH + column)*0x85EBCA77u ^ (uint32_t)color*0xC2B2AE3Du;
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 12;
+    return (int)(h%(2*amplitude + 1)) - amplitude;
+}
+
+//Returns a colour component (0 red, 1 green, 2 blue, 3 luminosity) of a pixel of the
+//picture taken from `pose`.
+inline int cameraPixel(const SimCamera *camera, const Floor *map, const Pose *pose, uint32_t frame,
+                       int row, int column, int color){
+    if (row < 0 || column < 0 || row >= SIM_PIC_HEIGHT || column >= SIM_PIC_WIDTH)
+        return 0;
+    int    index = row*SIM_PIC_WIDTH + column;
+    double c = cos(pose->heading), s = sin(pose->heading);
+    double x = pose->x + camera->ahead[index]*c - camera->left[index]*s;
+    double y = pose->y + camera->ahead[index]*s + camera->left[index]*c;
+    Color  floor_color = floorColor(map, x, y);
+    int    components[3] = {floor_color.r, floor_color.g, floor_color.b};
+    for (int c = 0; c < 3; c++){
+        if (c != color && color >= 0 && color < 3)
+            continue;
+        int value = components[c] + pixelNoise(frame, row, column, c, camera->noise);
+        components[c] = value < 0 ? 0 : (value > 255 ? 255 : value);
+    }
+    if (color >= 0 && color < 3)
+        return components[color];
+    return (components[0] + components[1] + components[2])/3;
+}
+
+#endif
@@ -0,0 +1,79 @@
+//Links the simulator into a program built with -DHAL_SIM, without changing the program:
+//
+//  g++ -std=c++20 -O2 -pthread -funsigned-char -DHAL_SIM -o main_sim main.cpp sim/sim_hal.cpp
+//
+//(or "make main_sim"). The backend is installed before main() runs, and the report is
+//printed when the program exits. -funsigned-char matches the Raspberry Pi, where char is
+//unsigned: on a PC get_pixel() would return negative values for bright pixels without it.
+//
+//Environment:
+//  SIM_COURSE      "track" (default, quadrants 1 to 3) or "maze" (quadrant 4)
+//  SIM_SEED        seed of the maze, the gate phase and the sensor noise (default 1)
+//  SIM_MAZE        size of the maze as "columns,rows" (default 5,4)
+//  SIM_MAP         binary PPM to use as the floor instead of the default course
+//  SIM_MM_PER_PX   scale of SIM_MAP (default 5)
+//  SIM_START       start pose of SIM_MAP as "x,y,heading_deg" in mm (default 250,400,0)
+//  SIM_TIME_LIMIT  seconds before the run is stopped (default 60)
+//  SIM_REALTIME    set to 1 to run at the speed of the real robot instead of on a virtual clock
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../clock.h"
+#include "sim_backend.h"
+#include "sim_maze.h"
+
+//Fields
+Course       sim_course;
+SimBackend  *sim_backend = NULL;
+VirtualClock sim_clock;
+
+//Returns an environment variable as a number, or `fallback` if it is not set.
+double envNumber(const char *name, double fallback){
+    const char *value = getenv(name);
+    return value != NULL ? atof(value) : fallback;
+}
+
+void printSimReport(){
+    if (sim_backend != NULL)
+        sim_backend->printReport();
+}
+
+//Sets up the course and installs the backend.
+void installSimulator(){
+    const char *map_file = getenv("SIM_MAP");
+    const char *course   = getenv("SIM_COURSE");
+    uint32_t    seed     = (uint32_t)envNumber("SIM_SEED", 1);
+    if (course != NULL && strcmp(course, "maze") == 0){
+        MazeOptions options = DEFAULT_MAZE;
+        const char *size = getenv("SIM_MAZE");
+        if (size != NULL)
+            sscanf(size, "%d,%d", &options.columns, &options.rows);
+        buildMazeCourse(&sim_course, &options, seed);
+    }
+    else if (map_file != NULL){
+        if (!loadFloorPPM(&sim_course.floor, map_file, envNumber("SIM_MM_PER_PX", 5))){
+            fprintf(stderr, "Sim: can't read %s\n", map_file);
+            exit(1);
+        }
+        Pose start = {250, 400, 0};
+        const char *start_text = getenv("SIM_START");
+        if (start_text != NULL && sscanf(start_text, "%lf,%lf,%lf", &start.x, &start.y, &start.heading) == 3)
+            start.heading *= M_PI/180;
+        sim_course.start = start;
+    }
+    else {
+        buildTrackCourse(&sim_course);
+    }
+    if (envNumber("SIM_REALTIME", 0) == 0)
+        setClockSource(&sim_clock);
+    sim_backend = new SimBackend(&sim_course, &DEFAULT_ROBOT, envNumber("SIM_TIME_LIMIT", 60), seed);
+    setHalBackend(sim_backend);
+    atexit(printSimReport);
+}
+
+//Runs installSimulator() before main().
+struct SimInstaller{
+    SimInstaller(){
+        installSimulator();
+    }
+} sim_installer;
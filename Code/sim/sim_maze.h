@@ -0,0 +1,117 @@
+#ifndef SIM_MAZE_H
+#define SIM_MAZE_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "sim_world.h"
+
+//Random walled mazes for quadrant 4.
+//A perfect maze (exactly one way between any two cells) is carved with a randomised depth
+//first search, and then only the way from the first cell to the last one is kept open: like
+//the maze of quadrant 4, it is a single winding corridor without branches, which is what the
+//wall following of main.cpp is written for. The robot starts in a short corridor on the west
+//side, facing into the bottom-left cell; the way out is on the east side of the top-right
+//cell, followed by the red line, the second gate and the finish.
+
+const double MAZE_CELL = 350; //mm between wall centres.
+
+//Structure to store the options of a maze.
+struct MazeOptions{
+    int    columns;
+    int    rows;
+    double gate_period; //s
+    double gate_open;   //s open in each period.
+};
+
+//The gate stays open long enough for the approach of main.cpp (GATE_TIMER after the opening,
+//then about 300 mm at BASE_DUTY_CYCLE).
+const MazeOptions DEFAULT_MAZE = {5, 4, 10, 6};
+
+//Builds a maze course. The same seed always gives the same maze and gate phase.
+inline void buildMazeCourse(Course *course, const MazeOptions *options, uint32_t seed){
+    std::mt19937 random(seed);
+    int columns = options->columns, rows = options->rows;
+    //Walls between cells: east[r][c] is on the east side of cell (c, r), north[r][c] on its north side.
+    std::vector<char> east(columns*rows, 1), north(columns*rows, 1), visited(columns*rows, 0);
+    std::vector<int>  stack(1, 0), way;
+    visited[0] = 1;
+    while (!stack.empty()){
+        int cell = stack.back();
+        if (cell == columns*rows - 1 && way.empty())
+            way = stack; //The stack is the way from the first cell to the last one.
+        int c = cell%columns, r = cell/columns;
+        int options_found[4], count = 0;
+        if (c + 1 < columns && !visited[cell + 1])       options_found[count++] = 0;
+        if (c > 0 && !visited[cell - 1])                 options_found[count++] = 1;
+        if (r + 1 < rows && !visited[cell + columns])    options_found[count++] = 2;
+        if (r > 0 && !visited[cell - columns])           options_found[count++] = 3;
+        if (count == 0){
+            stack.pop_back();
+            continue;
+        }
+        int next;
+        switch (options_found[random()%count]){
+            case 0:  next = cell + 1;       east[cell]  = 0; break;
+            case 1:  next = cell - 1;       east[next]  = 0; break;
+            case 2:  next = cell + columns; north[cell] = 0; break;
+            default: next = cell - columns; north[next] = 0; break;
+        }
+        visited[next] = 1;
+        stack.push_back(next);
+    }
+    //Walls off everything but the way out.
+    east.assign(columns*rows, 1);
+    north.assign(columns*rows, 1);
+    for (size_t i = 1; i < way.size(); i++){
+        int from = std::min(way[i-1], way[i]), to = std::max(way[i-1], way[i]);
+        if (to == from + 1)
+            east[from] = 0;
+        else
+            north[from] = 0;
+    }
+
+    //The maze starts one cell east of x = 0, after the entry corridor.
+    double x0 = MAZE_CELL, y0 = 0, cell = MAZE_CELL;
+    double width = (columns + 3)*cell, height = rows*cell;
+    initFloor(&course->floor, width, height, 5, FLOOR_COLOR);
+    course->walls.clear();
+    course->gates.clear();
+    for (int c = 0; c < columns; c++)
+        course->walls.push_back({x0 + c*cell, y0, x0 + (c + 1)*cell, y0}); //South border.
+    for (int r = 0; r < rows; r++){
+        if (r != 0)
+            course->walls.push_back({x0, y0 + r*cell, x0, y0 + (r + 1)*cell}); //West border, but the entrance.
+        for (int c = 0; c < columns; c++){
+            int index = r*columns + c;
+            bool exit = (c == columns - 1 && r == rows - 1);
+            if (east[index] && !exit)
+                course->walls.push_back({x0 + (c + 1)*cell, y0 + r*cell, x0 + (c + 1)*cell, y0 + (r + 1)*cell});
+            if (north[index])
+                course->walls.push_back({x0 + c*cell, y0 + (r + 1)*cell, x0 + (c + 1)*cell, y0 + (r + 1)*cell});
+        }
+    }
+    //Entry corridor.
+    course->walls.push_back({0, y0, x0, y0});
+    course->walls.push_back({0, y0 + cell, x0, y0 + cell});
+    course->walls.push_back({0, y0, 0, y0 + cell});
+    //Exit corridor: red line, gate, finish.
+    double exit_x = x0 + columns*cell, exit_y = y0 + (rows - 1)*cell;
+    course->walls.push_back({exit_x, exit_y, exit_x + 2*cell, exit_y});
+    course->walls.push_back({exit_x, exit_y + cell, exit_x + 2*cell, exit_y + cell});
+    course->walls.push_back({exit_x + 2*cell, exit_y, exit_x + 2*cell, exit_y + cell});
+    double red_x = exit_x + 0.3*cell, gate_x = exit_x + 0.75*cell;
+    drawSegment(&course->floor, red_x, exit_y + 30, red_x, exit_y + cell - 30, RED_LINE_WIDTH, RED_LINE_COLOR);
+    std::uniform_real_distribution<double> phase(0, options->gate_period);
+    course->gates.push_back({{gate_x, exit_y, gate_x, exit_y + cell}, options->gate_period, options->gate_open,
+                             phase(random)});
+
+    course->start = {cell/2, y0 + cell/2, 0};
+    course->checkpoints.clear();
+    course->checkpoints.push_back({"maze", x0 + cell/2, y0 + cell/2, cell/3});
+    course->checkpoints.push_back({"red line", red_x, exit_y + cell/2, cell/2});
+    course->checkpoints.push_back({"finish", exit_x + 1.5*cell, exit_y + cell/2, cell/3});
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef SIM_ROBOT_H
+#define SIM_ROBOT_H
+
+#include <math.h>
+#include "sim_world.h"
+
+//Differential-drive model of the robot.
+//Each wheel's speed follows the duty cycle through a dead band and a linear gain, with a
+//first-order lag standing for the motor and the inertia of the robot. The pose is the
+//centre of the wheel axle and is integrated in small fixed steps.
+
+//Structure to store the physical constants of the robot.
+struct SimRobotParams{
+    double wheel_base;  //mm between the wheels.
+    double max_speed;   //mm/s of a wheel at max_duty.
+    int    deadband;    //Duty cycles up to this don't move the wheel.
+    int    max_duty;
+    double motor_lag;   //s, time constant of the wheel speed.
+    double step;        //s, integration step.
+};
+
+//#todo measure on the robot.
+const SimRobotParams DEFAULT_ROBOT = {150, 1000, 20, 254, 0.08, 0.001};
+const double SIM_ROBOT_RADIUS = 90; //mm, used to detect collisions with walls.
+
+//Structure to store the state of the simulated robot.
+struct SimRobot{
+    SimRobotParams params;
+    Pose           pose;
+    int            duty[2];   //Commanded duty cycle, left and right.
+    double         speed[2];  //mm/s, left and right.
+    double         distance;  //mm travelled by the centre.
+};
+
+//Places the robot, stopped.
+inline void initSimRobot(SimRobot *robot, const SimRobotParams *params, Pose pose){
+    robot->params   = *params;
+    robot->pose     = pose;
+    robot->duty[0]  = robot->duty[1]  = 0;
+    robot->speed[0] = robot->speed[1] = 0;
+    robot->distance = 0;
+}
+
+//Steady-state wheel speed for a duty cycle.
+inline double dutyToSpeed(const SimRobotParams *params, int duty){
+    int magnitude = abs(duty);
+    if (magnitude <= params->deadband)
+        return 0;
+    if (magnitude > params->max_duty)
+        magnitude = params->max_duty;
+    double speed = params->max_speed*(magnitude - params->deadband)/(params->max_duty - params->deadband);
+    return duty > 0 ? speed : -speed;
+}
+
+//Advances the robot by dt seconds.
+inline void stepSimRobot(SimRobot *robot, double dt){
+    const SimRobotParams *params = &robot->params;
+    while (dt > 0){
+        double h     = fmin(dt, params->step);
+        double blend = 1 - exp(-h/params->motor_lag);
+        for (int wheel = 0; wheel < 2; wheel++)
+            robot->speed[wheel] += (dutyToSpeed(params, robot->duty[wheel]) - robot->speed[wheel])*blend;
+        double v = (robot->speed[0] + robot->speed[1])/2;
+        double w = (robot->speed[1] - robot->speed[0])/params->wheel_base;
+        double heading = robot->pose.heading + w*h/2; //Midpoint heading.
+        robot->pose.x       += v*cos(heading)*h;
+        robot->pose.y       += v*sin(heading)*h;
+        robot->pose.heading += w*h;
+        robot->distance     += fabs(v)*h;
+        dt -= h;
+    }
+}
+
+#endif
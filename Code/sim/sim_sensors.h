@@ -0,0 +1,61 @@
+#ifndef SIM_SENSORS_H
+#define SIM_SENSORS_H
+
+#include <math.h>
+#include <random>
+#include "sim_world.h"
+
+//Models of the distance sensors.
+//The front sensor is an analog IR ranger (Sharp GP2Y0A21 style): its reading falls roughly
+//as 1/distance over its range, folds back below the minimum range, and has some noise.
+//The side sensors are digital IR proximity switches that read 0 while something is within
+//their trigger distance; read on an ADC channel, as the Q4 variations do, they give 0 or
+//ADC_MAX. All of them are ray-cast against the walls and closed gates.
+
+//Structure to store where a sensor is mounted.
+struct SensorMount{
+    double ahead;  //mm ahead of the wheel axle.
+    double left;   //mm to the left of the centre.
+    double angle;  //rad from the heading of the robot.
+};
+
+//#todo measure on the robot.
+const SensorMount FRONT_MOUNT = {90, 0, 0};
+const SensorMount LEFT_MOUNT  = {40, 70, M_PI/2};
+const SensorMount RIGHT_MOUNT = {40, -70, -M_PI/2};
+
+const double ADC_SCALE       = 25000; //Reading at d mm is about ADC_SCALE/d: 250 at 10 cm (see main.cpp).
+const double ADC_MIN_RANGE   = 40;    //mm; closer than this the reading falls again.
+const double ADC_MAX_RANGE   = 800;   //mm; further than this only noise is read.
+const double ADC_NOISE       = 6;     //Standard deviation of the noise.
+const int    ADC_MAX         = 1023;
+const double DIGITAL_TRIGGER = 150;   //mm at which the side sensors switch (both trigger in the middle of a corridor).
+
+//Distance seen by a sensor, from the robot pose.
+inline double sensorDistance(const Course *course, double time, const Pose *pose, const SensorMount *mount){
+    double c = cos(pose->heading), s = sin(pose->heading);
+    double x = pose->x + mount->ahead*c - mount->left*s;
+    double y = pose->y + mount->ahead*s + mount->left*c;
+    return castRay(course, time, x, y, pose->heading + mount->angle, ADC_MAX_RANGE);
+}
+
+//Analog reading of the front sensor for a distance.
+inline int analogReading(double distance, std::mt19937 *random){
+    double reading;
+    if (distance < ADC_MIN_RANGE)
+        reading = ADC_SCALE/ADC_MIN_RANGE*distance/ADC_MIN_RANGE;
+    else
+        reading = ADC_SCALE/distance;
+    std::normal_distribution<double> noise(0, ADC_NOISE);
+    reading += noise(*random);
+    if (reading < 0)
+        return 0;
+    return reading > ADC_MAX ? ADC_MAX : (int)reading;
+}
+
+//Digital reading of a side sensor: 0 if something is close.
+inline int digitalReading(double distance){
+    return distance < DIGITAL_TRIGGER ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,253 @@
+#ifndef SIM_WORLD_H
+#define SIM_WORLD_H
+
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+
+//A simulated course: the floor as a top-down colour raster in millimetres, the walls, an
+//optional gate, the start pose of the robot and the checkpoints it has to pass, in order.
+//x grows to the right and y upwards; headings are in radians from the x axis.
+
+//Structure to store an RGB colour.
+struct Color{
+    unsigned char r;
+    unsigned char g;
+    unsigned char b;
+};
+
+const Color  FLOOR_COLOR    = {45, 45, 50};
+const Color  TRACK_COLOR    = {225, 225, 220};
+const Color  RED_LINE_COLOR = {200, 35, 30};
+const double TRACK_WIDTH    = 20; //mm, width of the white tape.
+const double RED_LINE_WIDTH = 30; //mm
+
+//Structure to store the floor raster.
+struct Floor{
+    int                width;     //Pixels
+    int                height;
+    double             mm_per_px;
+    std::vector<Color> pixels;    //Row 0 is y = 0.
+};
+
+//Structure to store the position of the robot (centre of the wheel axle).
+struct Pose{
+    double x;        //mm
+    double y;
+    double heading;  //rad
+};
+
+//Structure to store a point the robot has to pass near.
+struct Checkpoint{
+    const char *name;
+    double      x;
+    double      y;
+    double      radius;
+};
+
+//Structure to store a straight wall.
+struct Wall{
+    double x0;
+    double y0;
+    double x1;
+    double y1;
+};
+
+//Structure to store a gate: a wall that is only there for part of each period.
+struct Gate{
+    Wall   wall;
+    double period;   //s
+    double open;     //s open in each period, starting at phase 0.
+    double phase;    //s, where in the period the gate is at time 0.
+};
+
+//Structure to store a whole course.
+struct Course{
+    Floor                   floor;
+    std::vector<Wall>       walls;
+    std::vector<Gate>       gates;
+    Pose                    start;
+    std::vector<Checkpoint> checkpoints; //The last one is the finish.
+};
+
+//Returns true if the gate is closed at `time`.
+inline bool gateClosed(const Gate *gate, double time){
+    double t = fmod(time + gate->phase, gate->period);
+    return t >= gate->open;
+}
+
+//Distance along the ray from (x, y) with direction (dx, dy) (unit length) to the wall,
+//or -1 if the ray misses it.
+inline double rayToWall(const Wall *wall, double x, double y, double dx, double dy){
+    double ex = wall->x1 - wall->x0, ey = wall->y1 - wall->y0;
+    double denominator = dx*ey - dy*ex;
+    if (fabs(denominator) < 1e-12)
+        return -1;
+    double wx = wall->x0 - x, wy = wall->y0 - y;
+    double t = (wx*ey - wy*ex)/denominator; //Along the ray.
+    double u = (wx*dy - wy*dx)/denominator; //Along the wall.
+    if (t < 0 || u < 0 || u > 1)
+        return -1;
+    return t;
+}
+
+//Distance from (x, y) to the nearest point of the wall.
+inline double distanceToWall(const Wall *wall, double x, double y){
+    double ex = wall->x1 - wall->x0, ey = wall->y1 - wall->y0;
+    double length2 = ex*ex + ey*ey;
+    double t = length2 > 0 ? ((x - wall->x0)*ex + (y - wall->y0)*ey)/length2 : 0;
+    t = fmin(1, fmax(0, t));
+    double px = wall->x0 + t*ex - x, py = wall->y0 + t*ey - y;
+    return sqrt(px*px + py*py);
+}
+
+//Distance along a ray to the nearest wall or closed gate, or max_range if there is none closer.
+inline double castRay(const Course *course, double time, double x, double y, double heading, double max_range){
+    double dx = cos(heading), dy = sin(heading);
+    double nearest = max_range;
+    for (size_t i = 0; i < course->walls.size(); i++){
+        double t = rayToWall(&course->walls[i], x, y, dx, dy);
+        if (t >= 0 && t < nearest)
+            nearest = t;
+    }
+    for (size_t i = 0; i < course->gates.size(); i++){
+        if (!gateClosed(&course->gates[i], time))
+            continue;
+        double t = rayToWall(&course->gates[i].wall, x, y, dx, dy);
+        if (t >= 0 && t < nearest)
+            nearest = t;
+    }
+    return nearest;
+}
+
+//Returns true if a circle at (x, y) touches a wall or a closed gate.
+inline bool touchesWall(const Course *course, double time, double x, double y, double radius){
+    for (size_t i = 0; i < course->walls.size(); i++)
+        if (distanceToWall(&course->walls[i], x, y) < radius)
+            return true;
+    for (size_t i = 0; i < course->gates.size(); i++)
+        if (gateClosed(&course->gates[i], time) && distanceToWall(&course->gates[i].wall, x, y) < radius)
+            return true;
+    return false;
+}
+
+//Sets up a floor of width_mm x height_mm filled with `color`.
+inline void initFloor(Floor *map, double width_mm, double height_mm, double mm_per_px, Color color){
+    map->width     = (int)ceil(width_mm/mm_per_px);
+    map->height    = (int)ceil(height_mm/mm_per_px);
+    map->mm_per_px = mm_per_px;
+    map->pixels.assign((size_t)map->width*map->height, color);
+}
+
+//Returns the colour of the floor at (x, y). Outside of the raster is bare floor.
+inline Color floorColor(const Floor *map, double x, double y){
+    int column = (int)floor(x/map->mm_per_px);
+    int row    = (int)floor(y/map->mm_per_px);
+    if (column < 0 || row < 0 || column >= map->width || row >= map->height)
+        return FLOOR_COLOR;
+    return map->pixels[(size_t)row*map->width + column];
+}
+
+//Returns true if (x, y) is on the raster.
+inline bool onFloor(const Floor *map, double x, double y){
+    return x >= 0 && y >= 0 && x < map->width*map->mm_per_px && y < map->height*map->mm_per_px;
+}
+
+//Paints a straight strip of tape from (x0, y0) to (x1, y1) with round ends.
+inline void drawSegment(Floor *map, double x0, double y0, double x1, double y1, double width, Color color){
+    double half = width/2;
+    double dx = x1 - x0, dy = y1 - y0;
+    double length2 = dx*dx + dy*dy;
+    int column_min = (int)floor((fmin(x0, x1) - half)/map->mm_per_px);
+    int column_max = (int)ceil((fmax(x0, x1) + half)/map->mm_per_px);
+    int row_min    = (int)floor((fmin(y0, y1) - half)/map->mm_per_px);
+    int row_max    = (int)ceil((fmax(y0, y1) + half)/map->mm_per_px);
+    for (int row = row_min; row <= row_max; row++){
+        for (int column = column_min; column <= column_max; column++){
+            if (column < 0 || row < 0 || column >= map->width || row >= map->height)
+                continue;
+            double px = (column + 0.5)*map->mm_per_px;
+            double py = (row + 0.5)*map->mm_per_px;
+            double t  = length2 > 0 ? ((px - x0)*dx + (py - y0)*dy)/length2 : 0;
+            t = fmin(1, fmax(0, t));
+            double ex = px - (x0 + t*dx), ey = py - (y0 + t*dy);
+            if (ex*ex + ey*ey <= half*half)
+                map->pixels[(size_t)row*map->width + column] = color;
+        }
+    }
+}
+
+//Paints a polyline of tape through the points (xs[i], ys[i]).
+inline void drawPath(Floor *map, const double *xs, const double *ys, int count, double width, Color color){
+    for (int i = 1; i < count; i++)
+        drawSegment(map, xs[i-1], ys[i-1], xs[i], ys[i], width, color);
+}
+
+//Reads a binary PPM (P6) as the floor. Returns false if it can't be read.
+inline bool loadFloorPPM(Floor *map, const char *file_name, double mm_per_px){
+    FILE *file = fopen(file_name, "rb");
+    if (file == NULL)
+        return false;
+    int width, height, max_value;
+    if (fscanf(file, "P6 %d %d %d", &width, &height, &max_value) != 3 || max_value != 255){
+        fclose(file);
+        return false;
+    }
+    fgetc(file);
+    map->width     = width;
+    map->height    = height;
+    map->mm_per_px = mm_per_px;
+    map->pixels.assign((size_t)width*height, FLOOR_COLOR);
+    //The image is stored top row first; the floor has y growing upwards.
+    for (int row = height - 1; row >= 0; row--){
+        if (fread(&map->pixels[(size_t)row*width], sizeof(Color), width, file) != (size_t)width){
+            fclose(file);
+            return false;
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+//Builds the default course for quadrants 1 to 3 (about 3.6 m x 2 m):
+//  Q1: a straight line through the first gate.
+//  Q2: a winding line, level where it starts and ends.
+//  Q3: a transversal where it starts, square corners, a transversal where the way on is to
+//      the left, and the red line between the first walls of quadrant 4.
+inline void buildTrackCourse(Course *course){
+    Floor *map = &course->floor;
+    initFloor(map, 3600, 2000, 5, FLOOR_COLOR);
+
+    //Q1
+    drawSegment(map, 100, 400, 900, 400, TRACK_WIDTH, TRACK_COLOR);
+    //Q2
+    const int STEPS = 90;
+    double xs[STEPS + 1], ys[STEPS + 1];
+    for (int i = 0; i <= STEPS; i++){
+        xs[i] = 900 + 1800.0*i/STEPS;
+        ys[i] = 400 + 180*sin(2*M_PI*(xs[i] - 900)/900)*sin(M_PI*i/STEPS); //Flat at both ends.
+    }
+    drawPath(map, xs, ys, STEPS + 1, TRACK_WIDTH, TRACK_COLOR);
+    drawSegment(map, 2700, 400, 2950, 400, TRACK_WIDTH, TRACK_COLOR);
+    drawSegment(map, 2950, 250, 2950, 550, TRACK_WIDTH, TRACK_COLOR); //Transversal at the start of Q3
+    //Q3
+    drawSegment(map, 2950, 400, 3200, 400, TRACK_WIDTH, TRACK_COLOR);
+    drawSegment(map, 3200, 400, 3200, 1000, TRACK_WIDTH, TRACK_COLOR);
+    drawSegment(map, 2800, 1000, 3450, 1000, TRACK_WIDTH, TRACK_COLOR); //Transversal
+    drawSegment(map, 2800, 1000, 2800, 1600, TRACK_WIDTH, TRACK_COLOR);
+    drawSegment(map, 2800, 1600, 3400, 1600, TRACK_WIDTH, TRACK_COLOR);
+    drawSegment(map, 3300, 1520, 3300, 1680, RED_LINE_WIDTH, RED_LINE_COLOR);
+
+    course->walls.clear();
+    course->walls.push_back({3150, 1430, 3600, 1430}); //Walls of Q4 on both sides of the red line.
+    course->walls.push_back({3150, 1770, 3600, 1770});
+    course->gates.clear();
+    course->start = {250, 400, 0};
+    course->checkpoints.clear();
+    course->checkpoints.push_back({"Q2", 900, 400, 120});
+    course->checkpoints.push_back({"Q3", 2950, 400, 150});
+    course->checkpoints.push_back({"transversal", 3200, 1000, 150});
+    course->checkpoints.push_back({"red line", 3300, 1600, 100});
+}
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef SPEED_PLANNER_H
+#define SPEED_PLANNER_H
+
+//Chooses the base duty cycle on every tick.
+//Each input gives a factor between 0 (go as slow as allowed) and 1 (go as fast as allowed),
+//the product of the factors sets the target speed, and the speed moves towards the target
+//no faster than the acceleration limits allow.
+
+//Structure to store the configuration and state of the speed planner.
+struct SpeedPlanner{
+    double min_speed;      //Duty cycle when every factor is zero.
+    double max_speed;      //Duty cycle on a clear straight.
+    double accel;          //Max. increase of duty cycle per second.
+    double decel;          //Max. decrease of duty cycle per second.
+    double error_slowdown; //How much a centred error of 100% slows down (0 to 1).
+    double curve_slowdown; //How much a curvature of 1 slows down (0 to 1).
+    double front_filter;   //Weight of a new front reading in the low-pass filter.
+    int    front_clear;    //Front readings below this don't slow down.
+    int    front_stop;     //Front readings at or above this give the minimum speed.
+    double speed;          //Current base duty cycle.
+    double filtered_front; //Low-pass filtered front sensor reading.
+};
+
+//Keeps x within [0,1].
+inline double clampUnit(double x){
+    if (x < 0)
+        return 0;
+    if (x > 1)
+        return 1;
+    return x;
+}
+
+//Sets the speed limits, e.g. when entering a quadrant where the robot should go slower.
+inline void setSpeedLimits(SpeedPlanner *planner, double min_speed, double max_speed){
+    planner->min_speed = min_speed;
+    planner->max_speed = max_speed;
+    if (planner->speed > max_speed)
+        planner->speed = max_speed;
+}
+
+//Drops back to the minimum speed, e.g. after the robot has stopped.
+inline void resetSpeed(SpeedPlanner *planner){
+    planner->speed = planner->min_speed;
+}
+
+//Updates the filtered front reading and returns it.
+inline double filterFront(SpeedPlanner *planner, int front_reading){
+    planner->filtered_front += planner->front_filter*(front_reading - planner->filtered_front);
+    return planner->filtered_front;
+}
+
+//Returns the base duty cycle to use in this tick.
+//error:     current tracking error, -1 to 1.
+//curvature: how much the track bends ahead, 0 (straight) to 1.
+//junction:  how close a junction or transversal is, 0 (none in sight) to 1 (on it).
+//front_reading: raw front sensor reading (higher is closer).
+//dt:        seconds since the last call.
+inline double planSpeed(SpeedPlanner *planner, double error, double curvature, double junction,
+                        int front_reading, double dt){
+    if (error < 0)
+        error = -error;
+    double front       = filterFront(planner, front_reading);
+    double front_range = planner->front_stop - planner->front_clear;
+    double factor = (1 - planner->error_slowdown*clampUnit(error))
+                  * (1 - planner->curve_slowdown*clampUnit(curvature))
+                  * (1 - clampUnit(junction))
+                  * (1 - clampUnit((front - planner->front_clear)/front_range));
+    double target = planner->min_speed + factor*(planner->max_speed - planner->min_speed);
+
+    if (target > planner->speed + planner->accel*dt)
+        planner->speed += planner->accel*dt;
+    else if (target < planner->speed - planner->decel*dt)
+        planner->speed -= planner->decel*dt;
+    else
+        planner->speed = target;
+    return planner->speed;
+}
+
+#endif
@@ -0,0 +1,307 @@
+//Tunes the TUNABLE constants of main.cpp on the simulator:
+//
+//  make main_sim autotune
+//  ./autotune -g 40 -s 3 -o tuned_constants.h
+//  make main TUNED=1
+//
+//Every candidate set of constants drives a lap made of two simulated runs: the track from
+//quadrant 1 to the red line, and the maze of quadrant 4 to the finish, each with several
+//noise seeds. The runs are separate main_sim processes passed the constants as TUNE_<name>
+//(see tuning.h), so every one is an independent simulator; a pool of worker threads, one per
+//core by default, keeps that many running at a time (tools/sim_runner.h). The search is CMA-ES (tools/cmaes.h) in
+//a space where every constant goes from 0 to 1 over its range.
+//
+//The cost of a lap is its time when both runs finish without touching a wall. Otherwise it
+//is pushed above the time limit, by one limit for every checkpoint missed and for any
+//collision, so a collision-free lap always beats one that isn't. The header is only written
+//if a collision-free candidate was found on every seed.
+//
+//Options:
+//  -b path       simulator binary (default ./main_sim)
+//  -g count      generations (default 30)
+//  -p count      candidates per generation (default 4 + 3 ln(number of constants))
+//  -s count      noise seeds per course (default 3)
+//  -j count      worker threads (default: number of cores)
+//  -t seconds    time limit of each run (default 90)
+//  -o file       header to write (default tuned_constants.h)
+//  -r seed       seed of the search (default 1)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <limits.h>
+#include <string>
+#include <vector>
+#include "cmaes.h"
+#include "sim_runner.h"
+
+//Structure to store a constant the tuner searches over.
+struct Tunable{
+    const char *name;
+    int         initial; //Same as in main.cpp.
+    int         low;
+    int         high;
+};
+
+const Tunable TUNABLES[] = {
+    {"KP",                30,  10,  60},
+    {"KPQ4",              12,   4,  30},
+    {"KI",                 0,   0,  10},
+    {"KD",                 0,   0,  10},
+    {"KDQ3",               0,   0,  10},
+    {"KDQ4",               0,   0,  10},
+    {"BASE_DUTY_CYCLE",   40,  30,  70},
+    {"MAX_BLK_NOISE",      5,   1,  15},
+    {"TRANSVERSAL",      290, 200, 320},
+    {"PASSAGE",          170, 100, 260},
+    {"MIN_DISTANCE",     250, 150, 400},
+    {"Q4_MIN_DISTANCE",  200, 120, 350},
+    {"BIGGER_DISTANCE",  155,  80, 250},
+    {"INTERNAL_DISTANCE",220, 120, 350}
+};
+const int TUNABLE_COUNT = sizeof(TUNABLES)/sizeof(TUNABLES[0]);
+
+//Structure to store a course of the lap.
+struct LapCourse{
+    const char *name;
+    const char *course;   //SIM_COURSE
+    const char *quadrant; //QUADRANT
+};
+
+const LapCourse LAP[] = {
+    {"track", "track", "1"},
+    {"maze",  "maze",  "4"}
+};
+const int LAP_COURSES = sizeof(LAP)/sizeof(LAP[0]);
+
+const double INITIAL_SIGMA   = 0.15;  //Step size in the normalised space.
+const double BOUND_PENALTY   = 100;   //Cost per squared unit outside [0, 1].
+const double WALL_TIME_SCALE = 4;     //A run is killed after this many times its time limit of wall time.
+
+//Structure to store one simulated run.
+struct SimJob{
+    std::vector<int> values;
+    int              course;  //Index in LAP.
+    int              seed;
+    SimReport        report;
+};
+
+//Fields
+std::string simulator  = "./main_sim";
+double      time_limit = 90;
+
+//==== Running the simulator =======================================================================
+
+//Runs the simulator for one job.
+void runSimJob(SimJob *job, const std::string &dir){
+    std::vector<std::string> settings;
+    for (int i = 0; i < TUNABLE_COUNT; i++)
+        settings.push_back(std::string("TUNE_") + TUNABLES[i].name + "=" + std::to_string(job->values[i]));
+    settings.push_back(std::string("SIM_COURSE=") + LAP[job->course].course);
+    settings.push_back(std::string("QUADRANT=") + LAP[job->course].quadrant);
+    settings.push_back("SIM_SEED=" + std::to_string(job->seed));
+    settings.push_back("SIM_TIME_LIMIT=" + std::to_string(time_limit));
+    runSimulator(simulator, settings, dir.c_str(), WALL_TIME_SCALE*time_limit + 10, &job->report);
+}
+
+//Runs all the jobs on the workers.
+void runSimJobs(WorkerPool *pool, std::vector<SimJob> *jobs){
+    runJobs(pool, jobs->size(), [pool, jobs](size_t job, int worker){
+        runSimJob(&(*jobs)[job], pool->dirs[worker]);
+    });
+}
+
+//==== Costs =======================================================================================
+
+//Structure to store how a candidate did over all its runs.
+struct Score{
+    double cost;       //Average over the seeds.
+    double lap;        //Average lap time.
+    double course_time[LAP_COURSES];
+    long   collisions;
+    int    failed;     //Runs that didn't finish or touched a wall.
+};
+
+//Cost of one run, in seconds.
+double runCost(const SimReport *report){
+    if (!report->ran)
+        return 3*time_limit;
+    double cost = report->time + time_limit*(report->checkpoints - report->reached);
+    if (report->collisions > 0)
+        cost += time_limit + report->collisions;
+    return cost;
+}
+
+//Scores the runs of one candidate, which are consecutive in jobs.
+Score scoreRuns(const std::vector<SimJob> &jobs, size_t first, int seeds){
+    Score score = {0, 0, {0}, 0, 0};
+    for (int i = 0; i < LAP_COURSES*seeds; i++){
+        const SimJob    *job    = &jobs[first + i];
+        const SimReport *report = &job->report;
+        score.cost += runCost(report);
+        score.lap  += report->time;
+        score.course_time[job->course] += report->time/seeds;
+        score.collisions += report->collisions;
+        if (!report->ran || !report->finished || report->collisions > 0)
+            score.failed++;
+    }
+    score.cost /= seeds;
+    score.lap  /= seeds;
+    return score;
+}
+
+//Maps a point of the normalised space to constants, and returns how far outside [0, 1] it is.
+double decode(const std::vector<double> &x, std::vector<int> *values){
+    double outside = 0;
+    values->resize(TUNABLE_COUNT);
+    for (int i = 0; i < TUNABLE_COUNT; i++){
+        double u = x[i];
+        if (u < 0){ outside += u*u; u = 0; }
+        if (u > 1){ outside += (u - 1)*(u - 1); u = 1; }
+        (*values)[i] = (int)lround(TUNABLES[i].low + u*(TUNABLES[i].high - TUNABLES[i].low));
+    }
+    return outside;
+}
+
+//Adds the runs of one candidate to jobs.
+void addJobs(std::vector<SimJob> *jobs, const std::vector<int> &values, int seeds){
+    for (int course = 0; course < LAP_COURSES; course++){
+        for (int seed = 1; seed <= seeds; seed++){
+            SimJob job = SimJob();
+            job.values = values;
+            job.course = course;
+            job.seed   = seed;
+            jobs->push_back(job);
+        }
+    }
+}
+
+void printScore(const char *label, const Score *score, int runs){
+    printf("%s cost %8.2f, lap %7.2f s (track %6.2f s, maze %6.2f s), %ld collisions, %d/%d runs failed\n", label,
+           score->cost, score->lap, score->course_time[0], score->course_time[1], score->collisions, score->failed, runs);
+}
+
+//Writes the constants as a header tuning.h can include.
+bool writeHeader(const char *file, const std::vector<int> &values, const Score *best, const Score *initial, int seeds){
+    FILE *out = fopen(file, "w");
+    if (out == NULL)
+        return false;
+    fprintf(out, "//Written by tools/autotune. Average over %d noise seeds of the simulator:\n", seeds);
+    fprintf(out, "//  tuned:    lap %.2f s (track %.2f s, maze %.2f s), no collisions\n", best->lap,
+            best->course_time[0], best->course_time[1]);
+    fprintf(out, "//  defaults: lap %.2f s (track %.2f s, maze %.2f s), %ld collisions, %d failed runs\n", initial->lap,
+            initial->course_time[0], initial->course_time[1], initial->collisions, initial->failed);
+    fprintf(out, "//Build with -DTUNED_CONSTANTS='\"%s\"' (make main TUNED=1) to use these values.\n", file);
+    fprintf(out, "#ifndef TUNED_CONSTANTS_H\n#define TUNED_CONSTANTS_H\n\n");
+    for (int i = 0; i < TUNABLE_COUNT; i++)
+        fprintf(out, "#define TUNED_%-18s %4d //Default %d\n", TUNABLES[i].name, values[i], TUNABLES[i].initial);
+    fprintf(out, "\n#endif\n");
+    fclose(out);
+    return true;
+}
+
+//==== Main ========================================================================================
+int main(int argc, char *argv[]){
+    int         generations = 30;
+    int         lambda      = 0;
+    int         seeds       = 3;
+    int         workers     = (int)std::thread::hardware_concurrency();
+    uint32_t    search_seed = 1;
+    const char *header      = "tuned_constants.h";
+    int option;
+    while ((option = getopt(argc, argv, "b:g:p:s:j:t:o:r:")) != -1){
+        switch (option){
+            case 'b': simulator   = optarg; break;
+            case 'g': generations = atoi(optarg); break;
+            case 'p': lambda      = atoi(optarg); break;
+            case 's': seeds       = atoi(optarg); break;
+            case 'j': workers     = atoi(optarg); break;
+            case 't': time_limit  = atof(optarg); break;
+            case 'o': header      = optarg; break;
+            case 'r': search_seed = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-b main_sim] [-g generations] [-p population] [-s seeds] [-j workers]"
+                                " [-t seconds] [-o header] [-r seed]\n", argv[0]);
+                return 1;
+        }
+    }
+    char path[PATH_MAX];
+    if (realpath(simulator.c_str(), path) == NULL || access(path, X_OK) != 0){
+        fprintf(stderr, "Can't run %s (make main_sim)\n", simulator.c_str());
+        return 1;
+    }
+    simulator = path;
+    if (workers < 1)
+        workers = 1;
+    WorkerPool pool;
+    if (!startWorkers(&pool, workers))
+        return 1;
+    int runs = LAP_COURSES*seeds;
+
+    //The hand-tuned values first, as the starting point and the reference.
+    std::vector<double> start(TUNABLE_COUNT);
+    std::vector<int>    initial_values(TUNABLE_COUNT);
+    for (int i = 0; i < TUNABLE_COUNT; i++){
+        start[i] = (double)(TUNABLES[i].initial - TUNABLES[i].low)/(TUNABLES[i].high - TUNABLES[i].low);
+        initial_values[i] = TUNABLES[i].initial;
+    }
+    std::vector<SimJob> jobs;
+    addJobs(&jobs, initial_values, seeds);
+    runSimJobs(&pool, &jobs);
+    Score initial = scoreRuns(jobs, 0, seeds);
+    printf("%d workers, %d runs per candidate\n", workers, runs);
+    printScore("Defaults:      ", &initial, runs);
+
+    Score            best        = initial;
+    std::vector<int> best_values = initial_values;
+    bool             found       = initial.failed == 0;
+    CmaEs es;
+    initCmaEs(&es, start, INITIAL_SIGMA, lambda, search_seed);
+    for (int generation = 1; generation <= generations; generation++){
+        std::vector<std::vector<double>> population;
+        sampleCmaEs(&es, &population);
+        std::vector<std::vector<int>> values(es.lambda);
+        std::vector<double> costs(es.lambda), outside(es.lambda);
+        jobs.clear();
+        for (int k = 0; k < es.lambda; k++){
+            outside[k] = decode(population[k], &values[k]);
+            addJobs(&jobs, values[k], seeds);
+        }
+        runSimJobs(&pool, &jobs);
+        int best_in_generation = 0;
+        for (int k = 0; k < es.lambda; k++){
+            Score score = scoreRuns(jobs, k*runs, seeds);
+            costs[k] = score.cost + BOUND_PENALTY*outside[k];
+            if (costs[k] < costs[best_in_generation])
+                best_in_generation = k;
+            if (score.failed == 0 && (!found || score.cost < best.cost)){
+                best        = score;
+                best_values = values[k];
+                found       = true;
+            }
+        }
+        updateCmaEs(&es, population, costs);
+        Score score = scoreRuns(jobs, best_in_generation*runs, seeds);
+        char label[32];
+        snprintf(label, sizeof(label), "Generation %3d:", generation);
+        printScore(label, &score, runs);
+        fflush(stdout);
+    }
+    stopWorkers(&pool);
+
+    if (!found){
+        printf("No candidate finished every run without a collision: %s not written.\n", header);
+        return 2;
+    }
+    printScore("Best:          ", &best, runs);
+    for (int i = 0; i < TUNABLE_COUNT; i++)
+        printf("  %-18s %4d (was %d)\n", TUNABLES[i].name, best_values[i], TUNABLES[i].initial);
+    if (!writeHeader(header, best_values, &best, &initial, seeds)){
+        fprintf(stderr, "Can't write %s\n", header);
+        return 1;
+    }
+    printf("Wrote %s\n", header);
+    return 0;
+}
@@ -0,0 +1,194 @@
+#ifndef CMAES_H
+#define CMAES_H
+
+#include <math.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+//Covariance matrix adaptation evolution strategy, (mu/mu_w, lambda) with rank-one and
+//rank-mu updates, as in Hansen's "The CMA Evolution Strategy: A Tutorial" (2016).
+//It only needs the cost of each sample, so it copes with the noisy, discontinuous costs
+//of simulated runs. Ask for a population with sampleCmaEs(), evaluate it, and hand the
+//costs to updateCmaEs(). Lower cost is better.
+
+//Structure to store the state of the search.
+struct CmaEs{
+    int                 n;       //Dimensions.
+    int                 lambda;  //Samples per generation.
+    int                 mu;      //Samples that move the mean.
+    std::vector<double> weights;
+    double              mueff;
+    double              cc, cs, c1, cmu, damps, chi_n;
+    std::vector<double> mean;
+    double              sigma;   //Step size.
+    std::vector<double> pc, ps;  //Evolution paths.
+    std::vector<double> C;       //Covariance, n*n row-major.
+    std::vector<double> B;       //Eigenvectors of C, one per column.
+    std::vector<double> D;       //Square roots of the eigenvalues of C.
+    long                evaluations;
+    int                 generation;
+    std::mt19937        random;
+};
+
+//Eigen-decomposition of the symmetric n*n matrix a with the cyclic Jacobi method.
+//Fills the eigenvalues and the eigenvectors (columns of v).
+inline void symmetricEigen(int n, std::vector<double> a, std::vector<double> *values, std::vector<double> *v){
+    v->assign(n*n, 0);
+    for (int i = 0; i < n; i++)
+        (*v)[i*n + i] = 1;
+    for (int sweep = 0; sweep < 50; sweep++){
+        double off = 0;
+        for (int p = 0; p < n; p++)
+            for (int q = p + 1; q < n; q++)
+                off += a[p*n + q]*a[p*n + q];
+        if (off < 1e-30)
+            break;
+        for (int p = 0; p < n; p++){
+            for (int q = p + 1; q < n; q++){
+                double apq = a[p*n + q];
+                if (fabs(apq) < 1e-300)
+                    continue;
+                double theta = (a[q*n + q] - a[p*n + p])/(2*apq);
+                double t = (theta >= 0 ? 1 : -1)/(fabs(theta) + sqrt(theta*theta + 1));
+                double c = 1/sqrt(t*t + 1), s = t*c;
+                for (int k = 0; k < n; k++){ //Columns p and q.
+                    double akp = a[k*n + p], akq = a[k*n + q];
+                    a[k*n + p] = c*akp - s*akq;
+                    a[k*n + q] = s*akp + c*akq;
+                }
+                for (int k = 0; k < n; k++){ //Rows p and q.
+                    double apk = a[p*n + k], aqk = a[q*n + k];
+                    a[p*n + k] = c*apk - s*aqk;
+                    a[q*n + k] = s*apk + c*aqk;
+                }
+                for (int k = 0; k < n; k++){
+                    double vkp = (*v)[k*n + p], vkq = (*v)[k*n + q];
+                    (*v)[k*n + p] = c*vkp - s*vkq;
+                    (*v)[k*n + q] = s*vkp + c*vkq;
+                }
+            }
+        }
+    }
+    values->resize(n);
+    for (int i = 0; i < n; i++)
+        (*values)[i] = a[i*n + i];
+}
+
+//Starts a search around `start` with step size sigma0. lambda <= 0 picks the default
+//population size, 4 + 3 ln(n).
+inline void initCmaEs(CmaEs *es, const std::vector<double> &start, double sigma0, int lambda, uint32_t seed){
+    int n = (int)start.size();
+    es->n      = n;
+    es->lambda = lambda > 0 ? lambda : 4 + (int)(3*log((double)n));
+    es->mu     = es->lambda/2;
+    es->weights.resize(es->mu);
+    double sum = 0, sum_sq = 0;
+    for (int i = 0; i < es->mu; i++){
+        es->weights[i] = log(es->mu + 0.5) - log(i + 1.0);
+        sum += es->weights[i];
+    }
+    for (int i = 0; i < es->mu; i++){
+        es->weights[i] /= sum;
+        sum_sq += es->weights[i]*es->weights[i];
+    }
+    es->mueff = 1/sum_sq;
+    es->cc    = (4 + es->mueff/n)/(n + 4 + 2*es->mueff/n);
+    es->cs    = (es->mueff + 2)/(n + es->mueff + 5);
+    es->c1    = 2/((n + 1.3)*(n + 1.3) + es->mueff);
+    es->cmu   = std::min(1 - es->c1, 2*(es->mueff - 2 + 1/es->mueff)/((n + 2)*(n + 2) + es->mueff));
+    es->damps = 1 + 2*std::max(0.0, sqrt((es->mueff - 1)/(n + 1)) - 1) + es->cs;
+    es->chi_n = sqrt((double)n)*(1 - 1.0/(4*n) + 1.0/(21.0*n*n));
+    es->mean  = start;
+    es->sigma = sigma0;
+    es->pc.assign(n, 0);
+    es->ps.assign(n, 0);
+    es->C.assign(n*n, 0);
+    es->B.assign(n*n, 0);
+    es->D.assign(n, 1);
+    for (int i = 0; i < n; i++)
+        es->C[i*n + i] = es->B[i*n + i] = 1;
+    es->evaluations = 0;
+    es->generation  = 0;
+    es->random.seed(seed);
+}
+
+//Draws a new population of lambda points.
+inline void sampleCmaEs(CmaEs *es, std::vector<std::vector<double>> *population){
+    int n = es->n;
+    std::normal_distribution<double> normal(0, 1);
+    std::vector<double> z(n);
+    population->assign(es->lambda, std::vector<double>(n));
+    for (int k = 0; k < es->lambda; k++){
+        for (int i = 0; i < n; i++)
+            z[i] = es->D[i]*normal(es->random);
+        for (int i = 0; i < n; i++){
+            double y = 0;
+            for (int j = 0; j < n; j++)
+                y += es->B[i*n + j]*z[j];
+            (*population)[k][i] = es->mean[i] + es->sigma*y;
+        }
+    }
+}
+
+//Moves the distribution towards the best samples of the population.
+inline void updateCmaEs(CmaEs *es, const std::vector<std::vector<double>> &population, const std::vector<double> &costs){
+    int n = es->n;
+    std::vector<int> order(es->lambda);
+    for (int k = 0; k < es->lambda; k++)
+        order[k] = k;
+    std::stable_sort(order.begin(), order.end(), [&costs](int a, int b){ return costs[a] < costs[b]; });
+    es->evaluations += es->lambda;
+    es->generation++;
+
+    std::vector<double> old_mean = es->mean, step(n);
+    for (int i = 0; i < n; i++){
+        es->mean[i] = 0;
+        for (int k = 0; k < es->mu; k++)
+            es->mean[i] += es->weights[k]*population[order[k]][i];
+        step[i] = (es->mean[i] - old_mean[i])/es->sigma;
+    }
+
+    //ps follows C^-1/2 * step = B * D^-1 * B' * step.
+    std::vector<double> bt_step(n, 0);
+    for (int j = 0; j < n; j++){
+        for (int i = 0; i < n; i++)
+            bt_step[j] += es->B[i*n + j]*step[i];
+        bt_step[j] /= es->D[j];
+    }
+    double ps_norm = 0;
+    for (int i = 0; i < n; i++){
+        double whitened = 0;
+        for (int j = 0; j < n; j++)
+            whitened += es->B[i*n + j]*bt_step[j];
+        es->ps[i] = (1 - es->cs)*es->ps[i] + sqrt(es->cs*(2 - es->cs)*es->mueff)*whitened;
+        ps_norm += es->ps[i]*es->ps[i];
+    }
+    ps_norm = sqrt(ps_norm);
+    double decay = 1 - pow(1 - es->cs, 2.0*es->evaluations/es->lambda);
+    bool   hsig  = ps_norm/sqrt(decay)/es->chi_n < 1.4 + 2.0/(n + 1);
+    for (int i = 0; i < n; i++)
+        es->pc[i] = (1 - es->cc)*es->pc[i] + (hsig ? sqrt(es->cc*(2 - es->cc)*es->mueff) : 0)*step[i];
+
+    double keep = 1 - es->c1 - es->cmu + (hsig ? 0 : es->c1*es->cc*(2 - es->cc));
+    for (int i = 0; i < n; i++){
+        for (int j = 0; j <= i; j++){
+            double rank_mu = 0;
+            for (int k = 0; k < es->mu; k++){
+                const std::vector<double> &x = population[order[k]];
+                rank_mu += es->weights[k]*(x[i] - old_mean[i])*(x[j] - old_mean[j]);
+            }
+            rank_mu /= es->sigma*es->sigma;
+            double c = keep*es->C[i*n + j] + es->c1*es->pc[i]*es->pc[j] + es->cmu*rank_mu;
+            es->C[i*n + j] = es->C[j*n + i] = c;
+        }
+    }
+    es->sigma *= exp(es->cs/es->damps*(ps_norm/es->chi_n - 1));
+
+    std::vector<double> values;
+    symmetricEigen(n, es->C, &values, &es->B);
+    for (int i = 0; i < n; i++)
+        es->D[i] = sqrt(std::max(values[i], 1e-20));
+}
+
+#endif
@@ -0,0 +1,136 @@
+//Compresses a raw recording (RECORD_FORMAT=raw, frame_recorder.h) into a frame stream
+//(frame_codec.h), then reads the stream back and checks it against the recording:
+//
+//  make frame_pack
+//  ./frame_pack -t 25 run.log run.fz
+//
+//It reports the size against the raw pictures, the time taken to code a frame (mean and
+//worst), and the largest error of a component, which is at most the tolerance.
+//
+//Options:
+//  -l            luminance only
+//  -t tolerance  max. error of a component (default 0, lossless)
+//  -k frames     frames between key frames (default 40)
+//  -r row        row kept without loss whatever the tolerance (repeatable, such as -r 190 -r 50
+//                -r 170 for the rows main.cpp reads)
+//  -c column     column kept without loss (repeatable)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "../frame_codec.h"
+
+//Copies the picture of a raw record: RGB if channels is 3, only the luminance if it is 1.
+//Recordings without the luminance of the camera library get the average of R, G and B.
+void loadPicture(const FrameLog *log, const FrameRecord *record, int channels, uint8_t *picture){
+    const uint8_t *pixel    = framePixels((FrameRecord *)record);
+    size_t         pixels   = (size_t)log->header->width*log->header->height;
+    int            recorded = log->header->channels;
+    if (channels == recorded){
+        memcpy(picture, pixel, pixels*channels);
+        return;
+    }
+    for (size_t i = 0; i < pixels; i++, pixel += recorded){
+        if (channels == 3){
+            memcpy(picture + 3*i, pixel, 3);
+            continue;
+        }
+        picture[i] = recorded == 4 ? pixel[3] : (uint8_t)((pixel[0] + pixel[1] + pixel[2])/3);
+    }
+}
+
+//==== Main ========================================================================================
+int main(int argc, char *argv[]){
+    bool     luminance = false;
+    int      tolerance = 0;
+    uint32_t keyframes = 40;
+    FrameExactLines exact;
+    memset(&exact, 0, sizeof(exact));
+    int option;
+    while ((option = getopt(argc, argv, "lt:k:r:c:")) != -1){
+        switch (option){
+            case 'l': luminance = true; break;
+            case 't': tolerance = atoi(optarg); break;
+            case 'k': keyframes = atoi(optarg); break;
+            case 'r': if (exact.rows < (uint32_t)FRAME_EXACT_LINES) exact.row[exact.rows++] = atoi(optarg); break;
+            case 'c': if (exact.columns < (uint32_t)FRAME_EXACT_LINES) exact.column[exact.columns++] = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-l] [-t tolerance] [-k frames] [-r row] [-c column] raw.log out.fz\n", argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 2){
+        fprintf(stderr, "Usage: %s [-l] [-t tolerance] [-k frames] [-r row] [-c column] raw.log out.fz\n", argv[0]);
+        return 1;
+    }
+    const char *in_file  = argv[optind];
+    const char *out_file = argv[optind + 1];
+    FrameLog log;
+    if (!openFrameLog(&log, in_file)){
+        fprintf(stderr, "%s isn't a raw recording\n", in_file);
+        return 1;
+    }
+    if (log.header->channels < 3){
+        fprintf(stderr, "%s has %u channels, 3 or 4 expected\n", in_file, log.header->channels);
+        return 1;
+    }
+    int channels = luminance ? 1 : 3; //The luminance is the mean of R, G and B (see frame_codec.h).
+
+    //The encoder thread isn't needed: frames are coded as they are committed on a virtual clock.
+    VirtualClock virtual_clock;
+    setClockSource(&virtual_clock);
+    FrameEncoder encoder;
+    int width  = log.header->width;
+    int height = log.header->height;
+    if (!openFrameEncoder(&encoder, out_file, width, height, channels, tolerance, keyframes, &exact))
+        return 1;
+    for (uint32_t i = 0; i < log.frames; i++){
+        const FrameRecord *raw    = frameLogRecord(&log, i);
+        FrameRecord       *record = beginEncodedFrame(&encoder);
+        uint32_t           frame  = record->frame;
+        *record       = *raw;
+        record->frame = frame;
+        loadPicture(&log, raw, channels, framePixels(record));
+        commitEncodedFrame(&encoder, record);
+    }
+    closeFrameEncoder(&encoder);
+
+    //Reads it back.
+    FrameStream stream;
+    if (!openFrameStream(&stream, out_file)){
+        fprintf(stderr, "Can't read %s back\n", out_file);
+        return 1;
+    }
+    std::vector<uint8_t> picture((size_t)width*height*channels);
+    uint32_t frames    = 0;
+    int      max_error = 0;
+    int      exact_error = 0; //Largest error on the rows and columns kept without loss.
+    while (readFrame(&stream)){
+        const FrameRecord *raw = frameLogRecord(&log, frames);
+        if (stream.record.time_ns != raw->time_ns || stream.record.left_dc != raw->left_dc ||
+            stream.record.right_dc != raw->right_dc){
+            fprintf(stderr, "Frame %u: the record doesn't match\n", frames);
+            return 1;
+        }
+        loadPicture(&log, raw, channels, picture.data());
+        for (size_t i = 0; i < picture.size(); i++){
+            int error = abs(picture[i] - stream.picture[i]);
+            if (error > max_error)
+                max_error = error;
+            size_t pixel = i/channels;
+            bool   kept  = false;
+            for (uint32_t r = 0; r < exact.rows; r++)
+                kept = kept || pixel/width == exact.row[r];
+            for (uint32_t c = 0; c < exact.columns; c++)
+                kept = kept || pixel%width == exact.column[c];
+            if (kept && error > exact_error)
+                exact_error = error;
+        }
+        frames++;
+    }
+    closeFrameStream(&stream);
+    closeFrameLog(&log);
+    printf("Read back %u/%u frames, largest error %d, %d on the lines kept\n", frames, log.frames, max_error,
+           exact_error);
+    return frames == log.frames && max_error <= tolerance && exact_error == 0 ? 0 : 1;
+}
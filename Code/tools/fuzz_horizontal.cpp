@@ -0,0 +1,288 @@
+//Property-based fuzzing of getHorizontalData() of main.cpp:
+//
+//  make fuzz_horizontal
+//  ./fuzz_horizontal                   (1000000 random rows)
+//  ./fuzz_horizontal -n 50000 -s 7     (other number of rows and seed)
+//  ./fuzz_horizontal crash-0123        (replays saved inputs)
+//
+//  make fuzz_horizontal_libfuzzer      (needs clang++)
+//  ./fuzz_horizontal_libfuzzer corpus/
+//
+//An input is the luminosity threshold (first byte) and then the row, as runs: a length
+//(1 to 64 pixels) and a luminosity, a pair of bytes each, until the row is full. The rest of a
+//short row is black. Runs rather than single pixels make tracks, gaps in them and junctions
+//out of a few bytes, which random or mutated bytes then find easily.
+//
+//Each implementation in IMPLEMENTATIONS is given the row (the same row at every y) and its
+//result is compared, bit for bit, with scanModel(), the scan written out again on an array
+//from how getHorizontalData() is described. It is also checked against properties that hold
+//whatever the details of the scan:
+//  - total_white_pixels is the number of pixels above the threshold;
+//  - at most two tracks, at most PIC_WIDTH pixels between them;
+//  - errors within [-PIC_WIDTH/2, PIC_WIDTH/2], and 0 without a track;
+//  - a second track only after a first one of at least MIN_H_TRACK_WID pixels;
+//  - only pixels of row y are read.
+//Both builds use AddressSanitizer and UBSan, so reading or writing past the arrays of the scan
+//fails too. This driver writes an input that fails to crash-<number> to replay it; libFuzzer
+//writes its own.
+//
+//A faster version of getHorizontalData() (SIMD, sparse, ...) is added to IMPLEMENTATIONS.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <random>
+#include <vector>
+#define main robot_main
+#include "../main.cpp"
+#undef main
+
+const int MAX_RUN         = 64;  //Pixels in a run of an input.
+const int MAX_INPUT_BYTES = 128; //Bytes of a random input of this driver.
+
+//Structure to store an implementation to check.
+struct Implementation{
+    const char *name;
+    ImageData (*scan)(int y);
+};
+
+const Implementation IMPLEMENTATIONS[] = {
+    {"getHorizontalData", getHorizontalData},
+};
+const int IMPLEMENTATION_COUNT = sizeof(IMPLEMENTATIONS)/sizeof(IMPLEMENTATIONS[0]);
+
+//HAL backend with one row of luminosities, the same at every y. It notes reads outside of the
+//row being scanned.
+class FuzzBackend : public HalBackend{
+public:
+    uint8_t row[PIC_WIDTH];
+    int     scanned_row;
+    int     stray_reads;
+
+    int take_picture(){ return 0; }
+
+    char get_pixel(int y, int x, int color){
+        if (y != scanned_row || x < 0 || x >= PIC_WIDTH || color != LUM){
+            stray_reads++;
+            return 0;
+        }
+        return (char)row[x];
+    }
+
+    int set_motor(int, int){ return 0; }
+    int read_digital(int){ return 0; }
+    int read_analog(int){ return 0; }
+    int sleep1(int, int){ return 0; }
+};
+
+//Fields
+FuzzBackend fuzz_backend;
+
+//Decodes an input into the threshold and the row. Returns false if it is empty.
+bool decodeInput(const uint8_t *data, size_t size, int *threshold, uint8_t *row){
+    if (size == 0)
+        return false;
+    *threshold = data[0];
+    int x = 0;
+    for (size_t i = 1; i + 1 < size && x < PIC_WIDTH; i += 2)
+        for (int run = data[i]%MAX_RUN + 1; run > 0 && x < PIC_WIDTH; run--)
+            row[x++] = data[i + 1];
+    while (x < PIC_WIDTH)
+        row[x++] = 0;
+    return true;
+}
+
+//Reference model of getHorizontalData() on a row:
+//  - pixel x is white above the threshold and has the value x - PIC_WIDTH/2, or one more from
+//    the middle on, so there is no 0;
+//  - the first white pixel while no track is open opens one; it takes the white pixels and
+//    their values from there on;
+//  - black pixels in an open track are held. At a white pixel after two white ones they join
+//    the track, values included. When more than MAX_BLK_NOISE are held, the track ends there:
+//    it is dropped if it has fewer than MIN_H_TRACK_WID pixels, otherwise the next track
+//    opens at the next white pixel. Only the first two tracks are kept;
+//  - the error of a track is the mean of its values.
+ImageData scanModel(const uint8_t *row, int threshold){
+    long long sum[3]   = {0, 0, 0};
+    int       count[3] = {0, 0, 0};
+    int       track    = 0;
+    int       held     = 0;
+    long long held_sum = 0;
+    int       total    = 0;
+    for (int x = 0; x < PIC_WIDTH; x++){
+        int  value = x < PIC_WIDTH/2 ? x - PIC_WIDTH/2 : x - PIC_WIDTH/2 + 1;
+        bool white = row[x] > threshold;
+        if (white){
+            total++;
+            count[track]++;
+            sum[track] += value;
+            bool after_two = x >= 2 && row[x-1] > threshold && row[x-2] > threshold;
+            if (held > 0 && after_two){
+                count[track] += held;
+                sum[track]   += held_sum;
+                held          = 0;
+                held_sum      = 0;
+            }
+        }
+        else if (count[track] > 0){
+            held++;
+            held_sum += value;
+            if (held > MAX_BLK_NOISE){
+                held     = 0;
+                held_sum = 0;
+                if (count[track] < MIN_H_TRACK_WID || track == 2){
+                    count[track] = 0;
+                    sum[track]   = 0;
+                }
+                else
+                    track++;
+            }
+        }
+    }
+    ImageData result = {total,
+                        count[0] > 0 ? (double)sum[0]/count[0] : 0, count[0],
+                        count[1] > 0 ? (double)sum[1]/count[1] : 0, count[1]};
+    return result;
+}
+
+void printData(const char *name, ImageData data){
+    printf("  %-18s total %d, track 1: %d pixels, error %.6f, track 2: %d pixels, error %.6f\n", name,
+           data.total_white_pixels, data.white_pixels1, data.error1, data.white_pixels2, data.error2);
+}
+
+//Returns why a result breaks the properties of a scan, or NULL.
+const char *brokenProperty(ImageData data, const uint8_t *row, int threshold){
+    int white = 0;
+    for (int x = 0; x < PIC_WIDTH; x++)
+        white += row[x] > threshold;
+    if (data.total_white_pixels != white)
+        return "total_white_pixels isn't the number of white pixels";
+    if (data.white_pixels1 < 0 || data.white_pixels2 < 0 || data.white_pixels1 + data.white_pixels2 > PIC_WIDTH)
+        return "track widths out of range";
+    if (!(fabs(data.error1) <= PIC_WIDTH/2) || !(fabs(data.error2) <= PIC_WIDTH/2))
+        return "error out of [-PIC_WIDTH/2, PIC_WIDTH/2]";
+    if ((data.white_pixels1 == 0 && data.error1 != 0) || (data.white_pixels2 == 0 && data.error2 != 0))
+        return "error without a track";
+    if (data.white_pixels2 > 0 && data.white_pixels1 < MIN_H_TRACK_WID)
+        return "second track after a first one narrower than MIN_H_TRACK_WID";
+    if (fuzz_backend.stray_reads > 0)
+        return "pixels read outside of the row";
+    return NULL;
+}
+
+bool sameData(ImageData a, ImageData b){
+    return a.total_white_pixels == b.total_white_pixels && a.white_pixels1 == b.white_pixels1 &&
+           a.white_pixels2 == b.white_pixels2 && a.error1 == b.error1 && a.error2 == b.error2;
+}
+
+//Checks every implementation on an input. Returns false, after printing why, if one fails.
+bool checkInput(const uint8_t *data, size_t size){
+    int threshold;
+    if (!decodeInput(data, size, &threshold, fuzz_backend.row))
+        return true;
+    setHalBackend(&fuzz_backend);
+    lum_threshold = threshold;
+    ImageData expected = scanModel(fuzz_backend.row, threshold);
+    for (int i = 0; i < IMPLEMENTATION_COUNT; i++){
+        fuzz_backend.scanned_row = ROW;
+        fuzz_backend.stray_reads = 0;
+        ImageData   result = IMPLEMENTATIONS[i].scan(ROW);
+        const char *broken = brokenProperty(result, fuzz_backend.row, threshold);
+        if (broken == NULL && sameData(result, expected))
+            continue;
+        printf("%s: %s\n", IMPLEMENTATIONS[i].name, broken != NULL ? broken : "differs from the model");
+        printf("  threshold %d, row:", threshold);
+        for (int x = 0; x < PIC_WIDTH; x++)
+            printf("%s%d", x%32 == 0 ? "\n    " : " ", fuzz_backend.row[x]);
+        printf("\n");
+        printData(IMPLEMENTATIONS[i].name, result);
+        printData("model", expected);
+        return false;
+    }
+    return true;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size){
+    if (!checkInput(data, size))
+        abort();
+    return 0;
+}
+
+#ifndef LIBFUZZER
+//==== Driver ======================================================================================
+
+//Random input: a threshold and some runs, with luminosities mostly close to the threshold so
+//that many pixels are only just white or black.
+std::vector<uint8_t> randomInput(std::mt19937 *random){
+    std::vector<uint8_t> input(1 + (*random)()%MAX_INPUT_BYTES);
+    int threshold = (*random)()%256;
+    input[0] = (uint8_t)threshold;
+    for (size_t i = 1; i < input.size(); i++){
+        int byte = (*random)()%256;
+        if (i%2 == 0 && (*random)()%4 != 0)
+            byte = std::min(255, std::max(0, threshold + byte%9 - 4));
+        input[i] = (uint8_t)byte;
+    }
+    return input;
+}
+
+bool readInput(const char *file, std::vector<uint8_t> *input){
+    FILE *in = fopen(file, "rb");
+    if (in == NULL)
+        return false;
+    int byte;
+    while ((byte = fgetc(in)) != EOF)
+        input->push_back((uint8_t)byte);
+    fclose(in);
+    return true;
+}
+
+int main(int argc, char *argv[]){
+    long     rows = 1000000;
+    unsigned seed = 1;
+    int option;
+    while ((option = getopt(argc, argv, "n:s:")) != -1){
+        switch (option){
+            case 'n': rows = atol(optarg); break;
+            case 's': seed = (unsigned)atol(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n rows] [-s seed] [input]...\n", argv[0]);
+                return 1;
+        }
+    }
+    //Replays inputs.
+    if (optind < argc){
+        int failed = 0;
+        for (int i = optind; i < argc; i++){
+            std::vector<uint8_t> input;
+            if (!readInput(argv[i], &input)){
+                fprintf(stderr, "Can't read %s\n", argv[i]);
+                return 1;
+            }
+            if (!checkInput(input.data(), input.size()))
+                failed++;
+        }
+        printf("%d/%d inputs pass\n", argc - optind - failed, argc - optind);
+        return failed == 0 ? 0 : 1;
+    }
+
+    std::mt19937 random(seed);
+    for (long n = 0; n < rows; n++){
+        std::vector<uint8_t> input = randomInput(&random);
+        if (checkInput(input.data(), input.size()))
+            continue;
+        char file[32];
+        snprintf(file, sizeof(file), "crash-%04ld", n);
+        FILE *out = fopen(file, "wb");
+        if (out != NULL){
+            fwrite(input.data(), 1, input.size(), out);
+            fclose(out);
+            printf("Input written to %s\n", file);
+        }
+        return 1;
+    }
+    printf("%ld rows, %d implementations, no failures (seed %u)\n", rows, IMPLEMENTATION_COUNT, seed);
+    return 0;
+}
+#endif
@@ -0,0 +1,485 @@
+//Golden frames: a fixed corpus of camera pictures, with what the vision functions of main.cpp
+//make of them, so that a faster version of those functions can't change what the robot sees:
+//
+//  make golden                 (checks main.cpp against golden_frames.txt)
+//  ./golden_frames -u          (rewrites golden_frames.txt, after a change that is meant to)
+//  ./golden_frames -r -u       (renders the simulator pictures again, then rewrites it)
+//
+//The pictures are the binary PPMs in golden/, one a frame, checked in with the expected
+//outputs so that a change to the simulator can't change them. The luminosity is the mean of
+//R, G and B, like the library gives it. Most of them were rendered with the simulator camera
+//(sim/sim_camera.h) from the poses in CORPUS below, on the default course as it was then and
+//on a board of junctions built here: straights, curves, corners, passages, transversals,
+//dead ends, the red line and nothing at all, with the camera noise, and some of them again
+//with bad lighting (dim, dark, glare, a shadow across the picture, more noise). -r renders
+//them again from the current simulator. Pictures taken on the robot belong there too:
+//save_picture() writes the same PPM, and every .ppm in the directory is checked, so a
+//picture is added by copying it in and running ./golden_frames -u.
+//The expected outputs are kept one line a picture:
+//  lum    the luminosity threshold (setLumThreshold())
+//  h190   getHorizontalData(ROW): total white pixels, then error and width of both tracks
+//  h50    getHorizontalData(ROW_AHEAD)
+//  h170   getHorizontalData(ROW-20), used by turnLeftQ3()
+//  v      verticalWhitePix() at the left and right edges
+//  red    isRedLine()
+//  q3     what followQ3() decides from the picture alone, with walls on both sides so that
+//         the red line counts: the event, and for STAY whether it follows the track, spins
+//         left or right, or stops.
+//main.cpp is compiled in as it is, like in tools/vision_bench.cpp, so a new kernel for any
+//of these (SIMD, sparse scans, a region of interest, a pyramid) is checked by putting it in
+//main.cpp and running make golden. Every picture that comes out differently is printed and
+//the exit status is 1.
+//
+//Options:
+//  -g file  expected outputs (default golden_frames.txt)
+//  -f dir   the pictures (default golden)
+//  -u       rewrite the file instead of checking it
+//  -r       render the pictures of CORPUS into the directory first
+//  -v       print the outputs of every picture
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#define main robot_main
+#include "../main.cpp"
+#undef main
+#include "../sim/sim_world.h"
+#include "../sim/sim_camera.h"
+
+extern char **environ;
+
+//Scenes the pictures are taken in.
+enum Scene{
+    SCENE_TRACK,     //buildTrackCourse() of sim/sim_world.h.
+    SCENE_JUNCTIONS, //buildJunctionBoard() below.
+};
+
+//Lighting of a picture.
+enum Lighting{
+    LIGHT_NORMAL,
+    LIGHT_DIM,       //60% of the light: the track is still above BASE_LUM_THRESH.
+    LIGHT_DARK,      //40%: the track falls below it.
+    LIGHT_GLARE,     //Washed out: the floor goes above it.
+    LIGHT_SHADOW,    //Darker from left to right, down to 40% at the right edge.
+    LIGHT_NOISY,     //Camera noise of 40 instead of 12.
+};
+
+const char *const LIGHTING_NAMES[] = {"normal", "dim", "dark", "glare", "shadow", "noisy"};
+const int         CAMERA_NOISE     = 12;
+const int         NOISY_CAMERA     = 40;
+const int         CHANNELS         = 4; //RGB and luminance, as get_pixel() gives them.
+
+//Structure to store where a picture of the corpus is taken from.
+struct GoldenFrame{
+    const char *name;
+    int         scene;
+    double      x;       //mm
+    double      y;
+    double      heading; //Degrees from the x axis.
+    int         lighting;
+};
+
+//The junction board has a feature every JUNCTION_SPACING mm along x, each one a stem coming
+//from y = 0 up to JUNCTION_Y. The robot looks at them heading north (90 degrees); row ROW
+//sees about 113 mm ahead of the axle and row ROW_AHEAD about 168 mm.
+const double JUNCTION_SPACING = 500;
+const double JUNCTION_Y       = 450;
+const double BRANCH_LENGTH    = 250;
+
+//x of feature `number` on the junction board.
+inline double feature(int number){
+    return 300 + number*JUNCTION_SPACING;
+}
+
+//Feature 0: corner to the left. 1: corner to the right. 2: T (both sides, no way ahead).
+//3: crossing. 4: branch to the left with the track going on. 5: dead end.
+const GoldenFrame CORPUS[] = {
+    //Default course.
+    {"straight",               SCENE_TRACK,      400,  400,   0,  LIGHT_NORMAL},
+    {"straight_offset",        SCENE_TRACK,      400,  425,   0,  LIGHT_NORMAL},
+    {"straight_angled",        SCENE_TRACK,      400,  400,  12,  LIGHT_NORMAL},
+    {"track_at_edge",          SCENE_TRACK,      400,  350,   0,  LIGHT_NORMAL},
+    {"curve_right",            SCENE_TRACK,     1000,  516,  35,  LIGHT_NORMAL},
+    {"curve_right_sharp",      SCENE_TRACK,     1000,  516,  40,  LIGHT_NORMAL},
+    {"curve_left",             SCENE_TRACK,     1400,  338, -60,  LIGHT_NORMAL},
+    {"curve_steep",            SCENE_TRACK,     1325,  431, -51,  LIGHT_NORMAL},
+    {"q3_corner",              SCENE_TRACK,     3087,  400,   0,  LIGHT_NORMAL},
+    {"q3_transversal",         SCENE_TRACK,     3200,  887,  90,  LIGHT_NORMAL},
+    {"q3_transversal_ahead",   SCENE_TRACK,     3200,  840,  90,  LIGHT_NORMAL},
+    {"red_line",               SCENE_TRACK,     3187, 1600,   0,  LIGHT_NORMAL},
+    {"red_line_angled",        SCENE_TRACK,     3190, 1600,  20,  LIGHT_NORMAL},
+    {"track_end",              SCENE_TRACK,     3340, 1600,   0,  LIGHT_NORMAL},
+    {"nothing",                SCENE_TRACK,      500,  800,   0,  LIGHT_NORMAL},
+    //Junction board.
+    {"corner_left",            SCENE_JUNCTIONS, feature(0), JUNCTION_Y - 113, 90, LIGHT_NORMAL},
+    {"corner_right",           SCENE_JUNCTIONS, feature(1), JUNCTION_Y - 113, 90, LIGHT_NORMAL},
+    {"t_junction",             SCENE_JUNCTIONS, feature(2), JUNCTION_Y - 113, 90, LIGHT_NORMAL},
+    {"t_junction_angled",      SCENE_JUNCTIONS, feature(2), JUNCTION_Y - 100, 75, LIGHT_NORMAL},
+    {"t_junction_skewed",      SCENE_JUNCTIONS, feature(2), JUNCTION_Y - 105, 86, LIGHT_NORMAL},
+    {"t_junction_near",        SCENE_JUNCTIONS, feature(2), JUNCTION_Y - 150, 90, LIGHT_NORMAL},
+    {"crossing",               SCENE_JUNCTIONS, feature(3), JUNCTION_Y - 113, 90, LIGHT_NORMAL},
+    {"branch_left",            SCENE_JUNCTIONS, feature(4), JUNCTION_Y - 113, 90, LIGHT_NORMAL},
+    {"dead_end",               SCENE_JUNCTIONS, feature(5), JUNCTION_Y - 60,  90, LIGHT_NORMAL},
+    {"dead_end_ahead",         SCENE_JUNCTIONS, feature(5), JUNCTION_Y - 140, 90, LIGHT_NORMAL},
+    //Bad lighting.
+    {"straight_dim",           SCENE_TRACK,      400,  400,   0,  LIGHT_DIM},
+    {"straight_dark",          SCENE_TRACK,      400,  400,   0,  LIGHT_DARK},
+    {"straight_glare",         SCENE_TRACK,      400,  400,   0,  LIGHT_GLARE},
+    {"straight_shadow",        SCENE_TRACK,      400,  425,   0,  LIGHT_SHADOW},
+    {"straight_noisy",         SCENE_TRACK,      400,  400,   0,  LIGHT_NOISY},
+    {"curve_shadow",           SCENE_TRACK,     1000,  516,  40,  LIGHT_SHADOW},
+    {"curve_noisy",            SCENE_TRACK,     1325,  431, -51,  LIGHT_NOISY},
+    {"q3_transversal_glare",   SCENE_TRACK,     3200,  887,  90,  LIGHT_GLARE},
+    {"corner_left_dim",        SCENE_JUNCTIONS, feature(0), JUNCTION_Y - 113, 90, LIGHT_DIM},
+    {"t_junction_shadow",      SCENE_JUNCTIONS, feature(2), JUNCTION_Y - 113, 90, LIGHT_SHADOW},
+    {"red_line_dim",           SCENE_TRACK,     3187, 1600,   0,  LIGHT_DIM},
+    {"red_line_noisy",         SCENE_TRACK,     3187, 1600,   0,  LIGHT_NOISY},
+};
+const int CORPUS_SIZE = sizeof(CORPUS)/sizeof(CORPUS[0]);
+
+//HAL backend that shows one picture.
+class GoldenBackend : public HalBackend{
+public:
+    std::vector<unsigned char> pixels; //CHANNELS components a pixel.
+
+    GoldenBackend(){
+        pixels.assign(PIC_WIDTH*PIC_HEIGHT*CHANNELS, 0);
+    }
+
+    int take_picture(){ return 0; }
+
+    char get_pixel(int row, int col, int color){
+        if (row < 0 || row >= PIC_HEIGHT || col < 0 || col >= PIC_WIDTH || color < 0 || color >= CHANNELS)
+            return 0;
+        return (char)pixels[(row*PIC_WIDTH + col)*CHANNELS + color];
+    }
+
+    int set_motor(int, int){ return 0; }
+    int read_digital(int){ return 0; }
+    int read_analog(int){ return 0; }
+    int sleep1(int, int){ return 0; }
+};
+
+//Fields
+GoldenBackend golden_backend;
+
+//==== Pictures ====================================================================================
+
+//Builds the junction board (see JUNCTION_SPACING).
+void buildJunctionBoard(Floor *map){
+    initFloor(map, feature(6), 1000, 5, FLOOR_COLOR);
+    for (int number = 0; number < 6; number++){
+        double x = feature(number);
+        drawSegment(map, x, 0, x, JUNCTION_Y, TRACK_WIDTH, TRACK_COLOR);
+    }
+    drawSegment(map, feature(0), JUNCTION_Y, feature(0) - BRANCH_LENGTH, JUNCTION_Y, TRACK_WIDTH, TRACK_COLOR);
+    drawSegment(map, feature(1), JUNCTION_Y, feature(1) + BRANCH_LENGTH, JUNCTION_Y, TRACK_WIDTH, TRACK_COLOR);
+    drawSegment(map, feature(2) - BRANCH_LENGTH, JUNCTION_Y, feature(2) + BRANCH_LENGTH, JUNCTION_Y,
+                TRACK_WIDTH, TRACK_COLOR);
+    drawSegment(map, feature(3) - BRANCH_LENGTH, JUNCTION_Y, feature(3) + BRANCH_LENGTH, JUNCTION_Y,
+                TRACK_WIDTH, TRACK_COLOR);
+    drawSegment(map, feature(3), JUNCTION_Y, feature(3), 1000, TRACK_WIDTH, TRACK_COLOR);
+    drawSegment(map, feature(4), JUNCTION_Y, feature(4) - BRANCH_LENGTH, JUNCTION_Y, TRACK_WIDTH, TRACK_COLOR);
+    drawSegment(map, feature(4), JUNCTION_Y, feature(4), 1000, TRACK_WIDTH, TRACK_COLOR);
+}
+
+//Applies the lighting of a picture to a colour component seen at column `col`.
+int light(int lighting, int value, int col){
+    double lit = value;
+    switch (lighting){
+        case LIGHT_DIM:    lit = value*0.6; break;
+        case LIGHT_DARK:   lit = value*0.4; break;
+        case LIGHT_GLARE:  lit = value*1.2 + 60; break;
+        case LIGHT_SHADOW: lit = value*(1 - 0.6*col/(PIC_WIDTH - 1)); break;
+        default: break;
+    }
+    return lit < 0 ? 0 : (lit > 255 ? 255 : (int)lit);
+}
+
+//Renders picture `number` of the corpus.
+void renderFrame(int number, const Floor *scenes, std::vector<unsigned char> *pixels){
+    const GoldenFrame *frame = &CORPUS[number];
+    SimCamera camera;
+    initSimCamera(&camera);
+    camera.noise = frame->lighting == LIGHT_NOISY ? NOISY_CAMERA : CAMERA_NOISE;
+    Pose pose = {frame->x, frame->y, frame->heading*M_PI/180};
+    unsigned char *pixel = pixels->data();
+    for (int row = 0; row < PIC_HEIGHT; row++)
+        for (int col = 0; col < PIC_WIDTH; col++, pixel += CHANNELS)
+            for (int color = 0; color < 3; color++)
+                pixel[color] = light(frame->lighting,
+                                     cameraPixel(&camera, &scenes[frame->scene], &pose, number, row, col, color), col);
+}
+
+//Writes the RGB of a picture as a binary PPM.
+bool writeFrame(const char *file, const std::vector<unsigned char> &pixels){
+    FILE *out = fopen(file, "wb");
+    if (out == NULL)
+        return false;
+    fprintf(out, "P6 %d %d 255\n", PIC_WIDTH, PIC_HEIGHT);
+    for (int i = 0; i < PIC_WIDTH*PIC_HEIGHT; i++)
+        fwrite(&pixels[i*CHANNELS], 1, 3, out);
+    return fclose(out) == 0;
+}
+
+//Reads a number of a PPM header, skipping white space and comments.
+bool readHeaderNumber(FILE *in, int *number){
+    int c = fgetc(in);
+    while (c == '#' || c == ' ' || c == '\t' || c == '\r' || c == '\n'){
+        if (c == '#')
+            while (c != '\n' && c != EOF)
+                c = fgetc(in);
+        c = fgetc(in);
+    }
+    if (c < '0' || c > '9')
+        return false;
+    *number = 0;
+    while (c >= '0' && c <= '9'){
+        *number = *number*10 + c - '0';
+        c = fgetc(in);
+    }
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+//Reads a binary PPM of PIC_WIDTH x PIC_HEIGHT into the CHANNELS of a picture, with the
+//luminosity worked out from the RGB.
+bool readFrame(const char *file, std::vector<unsigned char> *pixels){
+    FILE *in = fopen(file, "rb");
+    if (in == NULL)
+        return false;
+    int width, height, max_value;
+    bool ok = fgetc(in) == 'P' && fgetc(in) == '6' && readHeaderNumber(in, &width) &&
+              readHeaderNumber(in, &height) && readHeaderNumber(in, &max_value) &&
+              width == PIC_WIDTH && height == PIC_HEIGHT && max_value == 255;
+    unsigned char *pixel = pixels->data();
+    for (int i = 0; ok && i < PIC_WIDTH*PIC_HEIGHT; i++, pixel += CHANNELS){
+        ok = fread(pixel, 1, 3, in) == 3;
+        pixel[3] = (pixel[0] + pixel[1] + pixel[2])/3;
+    }
+    fclose(in);
+    return ok;
+}
+
+//Names of the pictures in a directory (the .ppm files, without the extension), sorted.
+std::vector<std::string> listFrames(const char *dir){
+    std::vector<std::string> names;
+    DIR *directory = opendir(dir);
+    if (directory == NULL)
+        return names;
+    struct dirent *entry;
+    while ((entry = readdir(directory)) != NULL){
+        std::string file = entry->d_name;
+        if (file.size() > 4 && file.compare(file.size() - 4, 4, ".ppm") == 0)
+            names.push_back(file.substr(0, file.size() - 4));
+    }
+    closedir(directory);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+//Lighting of a picture of the corpus, for the messages.
+const char *lightingName(const std::string &name){
+    for (int i = 0; i < CORPUS_SIZE; i++)
+        if (name == CORPUS[i].name)
+            return LIGHTING_NAMES[CORPUS[i].lighting];
+    return "file";
+}
+
+//==== Outputs =====================================================================================
+
+std::string formatData(ImageData data){
+    char text[96];
+    snprintf(text, sizeof(text), "%d,%.3f,%d,%.3f,%d", data.total_white_pixels, data.error1, data.white_pixels1,
+             data.error2, data.white_pixels2);
+    return text;
+}
+
+const char *eventName(int event){
+    switch (event){
+        case STAY:               return "STAY";
+        case LOST_TRACK:         return "LOST_TRACK";
+        case TRANSVERSAL_FOUND:  return "TRANSVERSAL_FOUND";
+        case PASSAGE_BOTH_SIDES: return "PASSAGE_BOTH_SIDES";
+        case RED_LINE_FOUND:     return "RED_LINE_FOUND";
+        default:                 return "OTHER";
+    }
+}
+
+//What followQ3() does with the picture from the start of Q3: the event, and how it drives.
+std::string junctionDecision(){
+    double max_correction = (MAX_DUTY_CYCLE - MIN_DUTY_CYCLE)/2.0;
+    initPID(&track_pid, Q3_GAINS, -max_correction, max_correction);
+    resetSpeed(&speed_planner);
+    previous_h_data = ImageData{};
+    sensors         = SensorSnapshot{0, true, true};
+    last_left_dc    = 0;
+    last_right_dc   = 0;
+    int event = followQ3();
+    std::string decision = eventName(event);
+    if (event != STAY)
+        return decision;
+    if (last_left_dc > 0 && last_right_dc > 0)
+        return decision + ",follow";
+    if (last_left_dc < 0 && last_right_dc > 0)
+        return decision + ",left";
+    if (last_left_dc > 0 && last_right_dc < 0)
+        return decision + ",right";
+    return decision + ",stop";
+}
+
+//Outputs of the vision functions for the picture in golden_backend, as in the expected file.
+std::string visionOutputs(){
+    setLumThreshold();
+    char edges[32];
+    snprintf(edges, sizeof(edges), "%d,%d", verticalWhitePix(0), verticalWhitePix(PIC_WIDTH - 1));
+    std::string outputs = "lum=" + std::to_string(lum_threshold);
+    outputs += " h190=" + formatData(getHorizontalData(ROW));
+    outputs += " h50=" + formatData(getHorizontalData(ROW_AHEAD));
+    outputs += " h170=" + formatData(getHorizontalData(ROW - 20));
+    outputs += " v=" + std::string(edges);
+    outputs += std::string(" red=") + (isRedLine() ? "1" : "0");
+    outputs += " q3=" + junctionDecision();
+    return outputs;
+}
+
+//Reads the expected file: one line a picture, its name and then its outputs.
+bool readGolden(const char *file, std::vector<std::string> *names, std::vector<std::string> *outputs){
+    FILE *in = fopen(file, "r");
+    if (in == NULL)
+        return false;
+    char line[512];
+    while (fgets(line, sizeof(line), in) != NULL){
+        line[strcspn(line, "\r\n")] = 0;
+        char *space = strchr(line, ' ');
+        if (line[0] == '#' || space == NULL)
+            continue;
+        names->push_back(std::string(line, space - line));
+        outputs->push_back(space + 1);
+    }
+    fclose(in);
+    return true;
+}
+
+bool writeGolden(const char *file, const std::vector<std::string> &frames, const std::vector<std::string> &outputs){
+    FILE *out = fopen(file, "w");
+    if (out == NULL)
+        return false;
+    fprintf(out, "# Expected outputs of the vision functions of main.cpp. See tools/golden_frames.cpp.\n");
+    for (size_t i = 0; i < frames.size(); i++)
+        fprintf(out, "%s %s\n", frames[i].c_str(), outputs[i].c_str());
+    return fclose(out) == 0;
+}
+
+//Prints the fields of two output lines that differ.
+void printDifferences(const std::string &expected, const std::string &got){
+    size_t e = 0, g = 0;
+    while (e < expected.size() || g < got.size()){
+        size_t e_end = expected.find(' ', e), g_end = got.find(' ', g);
+        if (e_end == std::string::npos) e_end = expected.size();
+        if (g_end == std::string::npos) g_end = got.size();
+        std::string e_field = expected.substr(e, e_end - e), g_field = got.substr(g, g_end - g);
+        if (e_field != g_field)
+            printf("    expected %-34s got %s\n", e_field.c_str(), g_field.c_str());
+        e = e_end < expected.size() ? e_end + 1 : e_end;
+        g = g_end < got.size() ? g_end + 1 : g_end;
+    }
+}
+
+//==== Main ========================================================================================
+int main(int argc, char *argv[]){
+    const char *golden_file = "golden_frames.txt";
+    const char *frame_dir   = "golden";
+    bool        update      = false;
+    bool        render      = false;
+    bool        verbose     = false;
+    int option;
+    while ((option = getopt(argc, argv, "g:f:urv")) != -1){
+        switch (option){
+            case 'g': golden_file = optarg; break;
+            case 'f': frame_dir   = optarg; break;
+            case 'u': update      = true; break;
+            case 'r': render      = true; break;
+            case 'v': verbose     = true; break;
+            default:
+                fprintf(stderr, "Usage: %s [-g file] [-f dir] [-u] [-r] [-v]\n", argv[0]);
+                return 1;
+        }
+    }
+    for (char **variable = environ; *variable != NULL; variable++)
+        if (strncmp(*variable, "TUNE_", 5) == 0)
+            printf("Warning: %s changes the constants of main.cpp\n", *variable);
+
+    if (render){
+        Floor scenes[2];
+        Course track;
+        buildTrackCourse(&track);
+        scenes[SCENE_TRACK] = track.floor;
+        buildJunctionBoard(&scenes[SCENE_JUNCTIONS]);
+        for (int i = 0; i < CORPUS_SIZE; i++){
+            renderFrame(i, scenes, &golden_backend.pixels);
+            std::string file = std::string(frame_dir) + "/" + CORPUS[i].name + ".ppm";
+            if (!writeFrame(file.c_str(), golden_backend.pixels)){
+                fprintf(stderr, "Can't write %s\n", file.c_str());
+                return 1;
+            }
+        }
+        printf("%d pictures rendered to %s\n", CORPUS_SIZE, frame_dir);
+    }
+    std::vector<std::string> frames = listFrames(frame_dir);
+    if (frames.empty()){
+        fprintf(stderr, "No pictures in %s (render them with -r)\n", frame_dir);
+        return 1;
+    }
+    setHalBackend(&golden_backend);
+
+    std::vector<std::string> outputs;
+    for (size_t i = 0; i < frames.size(); i++){
+        std::string file = std::string(frame_dir) + "/" + frames[i] + ".ppm";
+        if (!readFrame(file.c_str(), &golden_backend.pixels)){
+            fprintf(stderr, "%s isn't a %dx%d binary PPM\n", file.c_str(), PIC_WIDTH, PIC_HEIGHT);
+            return 1;
+        }
+        outputs.push_back(visionOutputs());
+        if (verbose)
+            printf("%-22s %-6s %s\n", frames[i].c_str(), lightingName(frames[i]), outputs[i].c_str());
+    }
+
+    int count = (int)frames.size();
+    std::vector<std::string> names, expected;
+    if (update || !readGolden(golden_file, &names, &expected)){
+        if (!writeGolden(golden_file, frames, outputs)){
+            fprintf(stderr, "Can't write %s\n", golden_file);
+            return 1;
+        }
+        printf("%d golden frames written to %s\n", count, golden_file);
+        return 0;
+    }
+    int failed = 0;
+    for (int i = 0; i < count; i++){
+        size_t j = 0;
+        while (j < names.size() && names[j] != frames[i])
+            j++;
+        if (j == names.size()){
+            printf("%s: not in %s (rewrite it with -u)\n", frames[i].c_str(), golden_file);
+            failed++;
+        }
+        else if (expected[j] != outputs[i]){
+            printf("%s (%s):\n", frames[i].c_str(), lightingName(frames[i]));
+            printDifferences(expected[j], outputs[i]);
+            failed++;
+        }
+    }
+    int missing = 0;
+    for (size_t j = 0; j < names.size(); j++)
+        if (std::find(frames.begin(), frames.end(), names[j]) == frames.end()){
+            printf("%s: no picture in %s\n", names[j].c_str(), frame_dir);
+            missing++;
+        }
+    printf("%d/%d golden frames %s\n", count - failed, count,
+           failed + missing == 0 ? "match" : "match, the others differ");
+    return failed + missing == 0 ? 0 : 1;
+}
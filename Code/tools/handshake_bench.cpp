@@ -0,0 +1,91 @@
+//Times the gate-1 handshake of gate_handshake.h against a gate server, usually the mock one:
+//
+//  ./mock_gate_server -d 50 -j 100 -l 20 &
+//  ./handshake_bench 127.0.0.1 1024 50
+//
+//The arguments are the IP, the port and the number of handshakes (default 127.0.0.1, 1024, 20).
+//The three network functions of the E101 library are replaced with plain sockets here, so it
+//runs on any computer; the rest of the handshake code is the same the robot uses.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "../gate_handshake.h"
+
+const int  ATTEMPTS        = 3;
+const long ATTEMPT_TIMEOUT = 1000000; //Microseconds
+const long POLL_PERIOD_US  = 1000;
+
+//Fields
+int server_socket = -1;
+
+//==== Replacements for the E101 network functions ================================================
+int connect_to_server(char server_addr[15], int port){
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port   = htons(port);
+    if (inet_pton(AF_INET, server_addr, &address.sin_addr) != 1)
+        return -1;
+    int new_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(new_socket, (struct sockaddr *)&address, sizeof(address)) < 0){
+        close(new_socket);
+        return -1;
+    }
+    server_socket = new_socket;
+    return 0;
+}
+
+int send_to_server(char message[24]){
+    return send(server_socket, message, strlen(message) + 1, 0) < 0 ? -1 : 0;
+}
+
+int receive_from_server(char message[24]){
+    memset(message, 0, 24);
+    return recv(server_socket, message, 23, 0) <= 0 ? -1 : 0;
+}
+
+//==== Main =======================================================================================
+int main(int argc, char *argv[]){
+    char ip[16]   = "127.0.0.1";
+    char please[] = "Please";
+    int  port     = 1024;
+    int  runs     = 20;
+    if (argc > 1){
+        strncpy(ip, argv[1], sizeof(ip) - 1);
+        ip[sizeof(ip) - 1] = '\0';
+    }
+    if (argc > 2)
+        port = atoi(argv[2]);
+    if (argc > 3)
+        runs = atoi(argv[3]);
+
+    int    failed = 0, retried = 0;
+    double total_s = 0, min_s = 1e9, max_s = 0;
+    for (int i = 0; i < runs; i++){
+        GateHandshake handshake;
+        startGateHandshake(&handshake, ip, port, please, ATTEMPTS, ATTEMPT_TIMEOUT);
+        while (pollGateHandshake(&handshake) == HANDSHAKE_PENDING)
+            usleep(POLL_PERIOD_US);
+        double elapsed = diffNanoseconds(&handshake.finished, &handshake.started)/1e9;
+        if (handshake.attempts > 1)
+            retried++;
+        if (handshake.status != HANDSHAKE_DONE){
+            failed++;
+            continue;
+        }
+        total_s += elapsed;
+        if (elapsed < min_s)
+            min_s = elapsed;
+        if (elapsed > max_s)
+            max_s = elapsed;
+    }
+
+    printf("%d handshakes: %d failed, %d needed a retry\n", runs, failed, retried);
+    if (runs > failed)
+        printf("Time: min %.3f s, average %.3f s, max %.3f s\n", min_s, total_s/(runs - failed), max_s);
+    return failed > 0;
+}
@@ -0,0 +1,359 @@
+//Lap-time benchmark of the versions of the program on the simulator:
+//
+//  make lap_bench
+//  ./lap_bench -s 10
+//
+//Every variant is built against the simulated HAL: main.cpp through hal.h, the others
+//(main5.cpp, Q4 Variations/main1-4.cpp) by linking sim/e101_sim.cpp in place of libE101,
+//with -Wl,--wrap=usleep so their usleep() calls sleep on the simulator's clock.
+//main.cpp picks its first quadrant from QUADRANT; the others have it as a constant, so they
+//are built from a copy with INITIAL_QUADRANT changed, once per course.
+//
+//A lap is the track from quadrant 1 to the red line plus the maze of quadrant 4, both with the
+//same seed (which also picks the maze). All the runs go through a pool of worker threads
+//(tools/sim_runner.h). For every variant it reports the laps completed, the average lap time
+//of those, the average time of each quadrant, the share of the checkpoints reached (which
+//ranks the variants that don't finish), the collisions and the recovery spins (turns on the
+//spot of more than half a revolution). The maze run starts in quadrant 4, so quadrant 4 is
+//scored even for a variant that can't get through quadrant 3.
+//
+//Options:
+//  -C dir        directory with main.cpp (default .)
+//  -B dir        where to build (default lap_build)
+//  -s count      seeds, 1 to count (default 5)
+//  -j count      worker threads (default: number of cores)
+//  -t seconds    time limit of each run (default 120)
+//  -v file       only this variant (can be repeated), e.g. -v main5.cpp
+//  -c file       also write every run to a CSV file
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <regex>
+#include <string>
+#include <vector>
+#include "sim_runner.h"
+
+//Structure to store a version of the program.
+struct Variant{
+    const char *source;  //Relative to the directory of main.cpp.
+    bool        uses_hal;
+};
+
+const Variant VARIANTS[] = {
+    {"main.cpp",                true},
+    {"main5.cpp",               false},
+    {"Q4 Variations/main1.cpp", false},
+    {"Q4 Variations/main2.cpp", false},
+    {"Q4 Variations/main3.cpp", false},
+    {"Q4 Variations/main4.cpp", false}
+};
+const int VARIANT_COUNT = sizeof(VARIANTS)/sizeof(VARIANTS[0]);
+
+//Structure to store a course of the lap and the checkpoints that end each of its quadrants.
+struct LapCourse{
+    const char *name;
+    const char *course;     //SIM_COURSE
+    int         quadrant;   //First quadrant.
+    const char *ends[3];    //Checkpoint at the end of each quadrant, from the first one.
+};
+
+const LapCourse LAP[] = {
+    {"track", "track", 1, {"Q2", "Q3", "red line"}},
+    {"maze",  "maze",  4, {"finish", NULL, NULL}}
+};
+const int LAP_COURSES     = sizeof(LAP)/sizeof(LAP[0]);
+const int QUADRANTS       = 4;
+const double WALL_TIME_SCALE = 4; //A run is killed after this many times its time limit of wall time.
+
+//Structure to store one run.
+struct LapRun{
+    int       variant;
+    int       course;
+    int       seed;
+    SimReport report;
+};
+
+//Fields
+std::string code_dir  = ".";
+std::string build_dir = "lap_build";
+double      time_limit = 120;
+
+//==== Building ====================================================================================
+
+//Path of the binary of a variant for a course.
+std::string binaryPath(int variant, int course){
+    std::string name = VARIANTS[variant].source;
+    for (size_t i = 0; i < name.size(); i++)
+        if (name[i] == '/' || name[i] == ' ' || name[i] == '.')
+            name[i] = '_';
+    if (!VARIANTS[variant].uses_hal)
+        name += "_q" + std::to_string(LAP[course].quadrant);
+    return build_dir + "/" + name;
+}
+
+//Quotes a path for the shell.
+std::string quoted(const std::string &text){
+    std::string result = "'";
+    for (size_t i = 0; i < text.size(); i++)
+        result += text[i] == '\'' ? std::string("'\\''") : std::string(1, text[i]);
+    return result + "'";
+}
+
+//Builds a variant for a course. Returns false and keeps the compiler output in <binary>.log on failure.
+bool buildVariant(int variant, int course){
+    const Variant *v      = &VARIANTS[variant];
+    std::string    source = code_dir + "/" + v->source;
+    std::string    binary = binaryPath(variant, course);
+    std::string    dir    = source.substr(0, source.rfind('/'));
+    std::string    sources;
+    if (v->uses_hal){
+        sources = quoted(source) + " " + quoted(code_dir + "/sim/sim_hal.cpp");
+    }
+    else {
+        FILE *in = fopen(source.c_str(), "rb");
+        if (in == NULL)
+            return false;
+        std::string text;
+        char buffer[4096];
+        size_t count;
+        while ((count = fread(buffer, 1, sizeof(buffer), in)) > 0)
+            text.append(buffer, count);
+        fclose(in);
+        std::regex initial("const int INITIAL_QUADRANT\\s*=\\s*-?[0-9]+;");
+        if (!std::regex_search(text, initial)){
+            fprintf(stderr, "%s has no INITIAL_QUADRANT\n", v->source);
+            return false;
+        }
+        text = std::regex_replace(text, initial, "const int INITIAL_QUADRANT = " + std::to_string(LAP[course].quadrant) + ";");
+        std::string copy = binary + ".cpp";
+        FILE *out = fopen(copy.c_str(), "wb");
+        if (out == NULL)
+            return false;
+        fwrite(text.data(), 1, text.size(), out);
+        fclose(out);
+        sources = quoted(copy) + " " + quoted(code_dir + "/sim/sim_hal.cpp") + " " +
+                  quoted(code_dir + "/sim/e101_sim.cpp") + " -Wl,--wrap=usleep";
+    }
+    std::string command = "g++ -std=c++20 -O2 -pthread -funsigned-char -DHAL_SIM -iquote " + quoted(dir) +
+                          " -iquote " + quoted(code_dir) + " -o " + quoted(binary) + " " + sources + " > " +
+                          quoted(binary + ".log") + " 2>&1";
+    return system(command.c_str()) == 0;
+}
+
+//==== Results =====================================================================================
+
+//Structure to store the totals of a variant.
+struct VariantTotals{
+    int    laps;                  //Laps completed, both runs finished.
+    double lap_time;              //Sum over the completed laps.
+    double quadrant_time[QUADRANTS];
+    int    quadrant_runs[QUADRANTS];
+    int    finished[LAP_COURSES];
+    int    reached;               //Checkpoints reached, over all the runs.
+    int    checkpoints;           //Checkpoints of all the runs.
+    long   collisions;
+    long   spins;
+    int    failed_runs;           //No report: crashed or killed.
+};
+
+//Adds the time of every quadrant the run completed.
+void addQuadrantTimes(const LapRun *run, VariantTotals *totals){
+    const LapCourse *course = &LAP[run->course];
+    double           start  = 0;
+    for (int i = 0; i < 3 && course->ends[i] != NULL; i++){
+        const SimReport *report = &run->report;
+        size_t j = 0;
+        while (j < report->names.size() && report->names[j] != course->ends[i])
+            j++;
+        if (j == report->names.size())
+            return;
+        int quadrant = course->quadrant - 1 + i;
+        totals->quadrant_time[quadrant] += report->times[j] - start;
+        totals->quadrant_runs[quadrant]++;
+        start = report->times[j];
+    }
+}
+
+void printTotals(const char *name, const VariantTotals *totals, int seeds){
+    printf("%-24s %2d/%-2d", name, totals->laps, seeds);
+    if (totals->laps > 0)
+        printf(" %8.2f", totals->lap_time/totals->laps);
+    else
+        printf(" %8s", "-");
+    for (int q = 0; q < QUADRANTS; q++){
+        if (totals->quadrant_runs[q] > 0)
+            printf(" %7.2f", totals->quadrant_time[q]/totals->quadrant_runs[q]);
+        else
+            printf(" %7s", "-");
+    }
+    for (int c = 0; c < LAP_COURSES; c++)
+        printf("   %2d/%-2d", totals->finished[c], seeds);
+    printf(" %7.0f%%", totals->checkpoints > 0 ? 100.0*totals->reached/totals->checkpoints : 0.0);
+    printf(" %10ld %6ld", totals->collisions, totals->spins);
+    if (totals->failed_runs > 0)
+        printf("  (%d runs crashed)", totals->failed_runs);
+    printf("\n");
+}
+
+bool writeCsv(const char *file, const std::vector<LapRun> &runs){
+    FILE *out = fopen(file, "w");
+    if (out == NULL)
+        return false;
+    fprintf(out, "variant,course,seed,result,time,checkpoints,collisions,spins\n");
+    for (size_t i = 0; i < runs.size(); i++){
+        const SimReport *report = &runs[i].report;
+        fprintf(out, "%s,%s,%d,%s,%.3f,%d/%d,%ld,%ld\n", VARIANTS[runs[i].variant].source, LAP[runs[i].course].name,
+                runs[i].seed, !report->ran ? "crashed" : report->finished ? "finished" : "stopped", report->time,
+                report->reached, report->checkpoints, report->collisions, report->spins);
+    }
+    fclose(out);
+    return true;
+}
+
+//==== Main ========================================================================================
+int main(int argc, char *argv[]){
+    int         seeds    = 5;
+    int         workers  = (int)std::thread::hardware_concurrency();
+    const char *csv_file = NULL;
+    std::vector<int> selected;
+    int option;
+    while ((option = getopt(argc, argv, "C:B:s:j:t:v:c:")) != -1){
+        switch (option){
+            case 'C': code_dir   = optarg; break;
+            case 'B': build_dir  = optarg; break;
+            case 's': seeds      = atoi(optarg); break;
+            case 'j': workers    = atoi(optarg); break;
+            case 't': time_limit = atof(optarg); break;
+            case 'c': csv_file   = optarg; break;
+            case 'v': {
+                int found = -1;
+                for (int i = 0; i < VARIANT_COUNT; i++)
+                    if (strcmp(VARIANTS[i].source, optarg) == 0)
+                        found = i;
+                if (found < 0){
+                    fprintf(stderr, "Unknown variant %s\n", optarg);
+                    return 1;
+                }
+                selected.push_back(found);
+                break;
+            }
+            default:
+                fprintf(stderr, "Usage: %s [-C dir] [-B dir] [-s seeds] [-j workers] [-t seconds] [-v variant]... "
+                                "[-c file.csv]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (selected.empty())
+        for (int i = 0; i < VARIANT_COUNT; i++)
+            selected.push_back(i);
+    char path[PATH_MAX];
+    mkdir(build_dir.c_str(), 0755);
+    if (realpath(code_dir.c_str(), path) == NULL){
+        fprintf(stderr, "Can't find %s\n", code_dir.c_str());
+        return 1;
+    }
+    code_dir = path;
+    if (realpath(build_dir.c_str(), path) == NULL){
+        fprintf(stderr, "Can't make %s\n", build_dir.c_str());
+        return 1;
+    }
+    build_dir = path;
+    if (workers < 1)
+        workers = 1;
+    WorkerPool pool;
+    if (!startWorkers(&pool, workers))
+        return 1;
+
+    //Builds: one per variant, or one per variant and course for the ones without QUADRANT.
+    std::vector<std::pair<int, int>> builds;
+    for (size_t i = 0; i < selected.size(); i++)
+        for (int course = 0; course < (VARIANTS[selected[i]].uses_hal ? 1 : LAP_COURSES); course++)
+            builds.push_back(std::make_pair(selected[i], course));
+    std::vector<char> built(builds.size());
+    printf("Building %zu binaries in %s\n", builds.size(), build_dir.c_str());
+    fflush(stdout);
+    runJobs(&pool, builds.size(), [&builds, &built](size_t job, int){
+        built[job] = buildVariant(builds[job].first, builds[job].second);
+    });
+    std::vector<int> ready;
+    for (size_t i = 0; i < selected.size(); i++){
+        bool ok = true;
+        for (size_t j = 0; j < builds.size(); j++)
+            if (builds[j].first == selected[i] && !built[j]){
+                fprintf(stderr, "%s didn't build, see %s.log\n", VARIANTS[selected[i]].source,
+                        binaryPath(builds[j].first, builds[j].second).c_str());
+                ok = false;
+            }
+        if (ok)
+            ready.push_back(selected[i]);
+    }
+
+    std::vector<LapRun> runs;
+    for (size_t i = 0; i < ready.size(); i++)
+        for (int course = 0; course < LAP_COURSES; course++)
+            for (int seed = 1; seed <= seeds; seed++)
+                runs.push_back({ready[i], course, seed, SimReport()});
+    printf("%zu runs on %d workers\n\n", runs.size(), workers);
+    fflush(stdout);
+    runJobs(&pool, runs.size(), [&runs, &pool](size_t job, int worker){
+        LapRun *run = &runs[job];
+        const LapCourse *course = &LAP[run->course];
+        std::vector<std::string> settings;
+        settings.push_back(std::string("SIM_COURSE=") + course->course);
+        settings.push_back("QUADRANT=" + std::to_string(course->quadrant));
+        settings.push_back("SIM_SEED=" + std::to_string(run->seed));
+        settings.push_back("SIM_TIME_LIMIT=" + std::to_string(time_limit));
+        runSimulator(binaryPath(run->variant, run->course), settings, pool.dirs[worker].c_str(),
+                     WALL_TIME_SCALE*time_limit + 10, &run->report);
+    });
+    stopWorkers(&pool);
+
+    printf("%-24s %5s %8s %7s %7s %7s %7s", "Variant", "Laps", "Lap (s)", "Q1", "Q2", "Q3", "Q4");
+    for (int c = 0; c < LAP_COURSES; c++)
+        printf(" %7s", LAP[c].name);
+    printf(" %8s %10s %6s\n", "Progress", "Collisions", "Spins");
+    for (size_t i = 0; i < ready.size(); i++){
+        VariantTotals totals;
+        memset(&totals, 0, sizeof(totals));
+        for (int seed = 1; seed <= seeds; seed++){
+            bool   lap  = true;
+            double time = 0;
+            for (size_t j = 0; j < runs.size(); j++){
+                const LapRun *run = &runs[j];
+                if (run->variant != ready[i] || run->seed != seed)
+                    continue;
+                const SimReport *report = &run->report;
+                if (!report->ran){
+                    totals.failed_runs++;
+                    lap = false;
+                    continue;
+                }
+                addQuadrantTimes(run, &totals);
+                totals.reached     += report->reached;
+                totals.checkpoints += report->checkpoints;
+                totals.collisions  += report->collisions;
+                totals.spins       += report->spins;
+                if (report->finished)
+                    totals.finished[run->course]++;
+                lap   = lap && report->finished;
+                time += report->time;
+            }
+            if (lap){
+                totals.laps++;
+                totals.lap_time += time;
+            }
+        }
+        printTotals(VARIANTS[ready[i]].source, &totals, seeds);
+    }
+    printf("\nQuadrant times are averaged over the runs that completed the quadrant. Progress is the share of\n"
+           "the checkpoints reached over all the runs.\n");
+    if (csv_file != NULL && !writeCsv(csv_file, runs)){
+        fprintf(stderr, "Can't write %s\n", csv_file);
+        return 1;
+    }
+    return ready.size() == selected.size() ? 0 : 1;
+}
@@ -0,0 +1,185 @@
+//Stand-in for the gate server of the first gate, to test and time the handshake off-site.
+//It speaks the same exchange as the real one: the robot sends "Please", the server answers
+//with a password, and the robot sends the password back to open the gate. The server can
+//misbehave on purpose so the timeouts and retries of gate_handshake.h can be checked:
+//
+//  -p port      port to listen on (default 1024)
+//  -w password  password sent to the robot (default "123456")
+//  -d ms        delay before answering (default 0)
+//  -j ms        random jitter added to the delay, 0 to ms (default 0)
+//  -l percent   chance of never answering a connection (default 0)
+//  -c ms        delay before closing a connection after the exchange (default 0)
+//  -s seed      seed of the random numbers (default: time)
+//
+//Build with "make mock_gate_server", run it, and start the robot program with
+//GATE_IP=127.0.0.1 (and GATE_PORT if -p was used). Ctrl+C prints the statistics.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+const int MESSAGE_SIZE = 24;  //Size of the buffers of send_to_server() and receive_from_server().
+const int MAX_HELD     = 64;  //Connections kept open without an answer.
+
+//Fields
+int    port         = 1024;
+char   password[24] = "123456";
+long   delay_ms     = 0;
+long   jitter_ms    = 0;
+int    loss_percent = 0;
+long   close_ms     = 0;
+int    held[MAX_HELD];
+int    held_count   = 0;
+volatile sig_atomic_t running = 1;
+
+//Statistics
+long   connections = 0;
+long   dropped     = 0;
+long   opened      = 0;
+long   rejected    = 0;
+double total_s     = 0;
+double max_s       = 0;
+
+void stopRunning(int){
+    running = 0;
+}
+
+//Returns CLOCK_MONOTONIC in seconds.
+double monotonicSeconds(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec/1e9;
+}
+
+void sleepMillis(long ms){
+    if (ms > 0)
+        usleep(ms*1000);
+}
+
+//Reads one message into buffer. Returns false if the robot closed the connection.
+bool receiveMessage(int client, char *buffer){
+    memset(buffer, 0, MESSAGE_SIZE);
+    ssize_t length = recv(client, buffer, MESSAGE_SIZE - 1, 0);
+    return length > 0;
+}
+
+//Runs the exchange with one robot. Returns false if the connection must be kept open.
+bool serveClient(int client){
+    double start = monotonicSeconds();
+    char   message[24];
+    connections++;
+
+    if (!receiveMessage(client, message)){
+        printf("#%ld: closed before asking\n", connections);
+        return true;
+    }
+    printf("#%ld: received \"%s\"\n", connections, message);
+
+    if (rand()%100 < loss_percent){
+        //Lost answer: the connection stays open but nothing is ever sent on it.
+        dropped++;
+        printf("#%ld: dropping the answer\n", connections);
+        return held_count >= MAX_HELD;
+    }
+
+    long wait_ms = delay_ms + (jitter_ms > 0 ? rand()%(jitter_ms + 1) : 0);
+    sleepMillis(wait_ms);
+    send(client, password, strlen(password) + 1, 0);
+
+    if (!receiveMessage(client, message)){
+        printf("#%ld: closed before answering\n", connections);
+        return true;
+    }
+    double elapsed = monotonicSeconds() - start;
+    if (strcmp(message, password) == 0){
+        opened++;
+        total_s += elapsed;
+        if (elapsed > max_s)
+            max_s = elapsed;
+        printf("#%ld: gate opened after %.3f s (%ld ms of it was the delay)\n", connections, elapsed, wait_ms);
+    }
+    else {
+        rejected++;
+        printf("#%ld: wrong password \"%s\"\n", connections, message);
+    }
+    sleepMillis(close_ms);
+    return true;
+}
+
+//Reads the options. Returns false if one is not valid.
+bool readOptions(int argc, char *argv[]){
+    int option;
+    srand(time(NULL));
+    while ((option = getopt(argc, argv, "p:w:d:j:l:c:s:")) != -1){
+        switch (option){
+            case 'p': port         = atoi(optarg); break;
+            case 'd': delay_ms     = atol(optarg); break;
+            case 'j': jitter_ms    = atol(optarg); break;
+            case 'l': loss_percent = atoi(optarg); break;
+            case 'c': close_ms     = atol(optarg); break;
+            case 's': srand(atoi(optarg));         break;
+            case 'w':
+                strncpy(password, optarg, sizeof(password) - 1);
+                password[sizeof(password) - 1] = '\0';
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]){
+    if (!readOptions(argc, argv)){
+        fprintf(stderr, "usage: %s [-p port] [-w password] [-d ms] [-j ms] [-l percent] [-c ms] [-s seed]\n", argv[0]);
+        return 1;
+    }
+    //No SA_RESTART, so accept() returns on Ctrl+C.
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stopRunning;
+    sigaction(SIGINT, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse  = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family      = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port        = htons(port);
+    if (bind(server, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(server, 4) < 0){
+        perror("mock_gate_server");
+        return 1;
+    }
+    printf("Mock gate server on port %d: delay %ld ms, jitter %ld ms, loss %d%%, close after %ld ms\n",
+           port, delay_ms, jitter_ms, loss_percent, close_ms);
+
+    while (running){
+        int client = accept(server, NULL, NULL);
+        if (client < 0){
+            if (errno != EINTR)
+                perror("accept");
+            continue;
+        }
+        if (serveClient(client))
+            close(client);
+        else
+            held[held_count++] = client;
+    }
+    for (int i = 0; i < held_count; i++)
+        close(held[i]);
+    close(server);
+
+    printf("\n%ld connections: %ld opened the gate, %ld dropped, %ld wrong passwords\n",
+           connections, opened, dropped, rejected);
+    if (opened > 0)
+        printf("Handshake time: average %.3f s, worst %.3f s\n", total_s/opened, max_s);
+    return 0;
+}
@@ -0,0 +1,241 @@
+#ifndef SIM_RUNNER_H
+#define SIM_RUNNER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <string>
+#include <vector>
+
+//Runs simulated programs (main_sim and the like) for the offline tools.
+//Every run is a child process with its own simulator, started from a pool of worker threads.
+//Each worker has a scratch directory that is emptied before every run, so files a program
+//writes (the gate model, for one) don't leak into the next run. The environment of a run is
+//the tool's own, without any TUNE_, SIM_ or QUADRANT variable, plus the settings given.
+
+extern char **environ;
+
+//Structure to store the report of one run (see SimBackend::printReport()).
+struct SimReport{
+    bool                     ran;         //The report was found.
+    bool                     finished;    //Passed every checkpoint.
+    double                   time;        //s
+    int                      reached;
+    int                      checkpoints;
+    long                     collisions;
+    long                     spins;
+    std::vector<std::string> names;       //Checkpoints reached, in order.
+    std::vector<double>      times;       //s at which each one was reached.
+};
+
+//Structure to store the worker threads and the jobs they share.
+struct WorkerPool{
+    std::vector<std::thread>              threads;
+    std::vector<std::string>              dirs;     //Scratch directory of each worker.
+    std::mutex                            mutex;
+    std::condition_variable               work;
+    std::condition_variable               done;
+    std::function<void(size_t job, int worker)> job;
+    size_t                                count;
+    size_t                                next;
+    size_t                                finished;
+    bool                                  stopping;
+};
+
+//Removes the files in dir.
+inline void clearDirectory(const char *dir){
+    DIR *handle = opendir(dir);
+    if (handle == NULL)
+        return;
+    struct dirent *entry;
+    while ((entry = readdir(handle)) != NULL){
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        std::string path = std::string(dir) + "/" + entry->d_name;
+        unlink(path.c_str());
+    }
+    closedir(handle);
+}
+
+//Reads the report of the simulator from the output of a run.
+inline void parseSimReport(const std::string &output, SimReport *report){
+    report->ran = false;
+    report->names.clear();
+    report->times.clear();
+    size_t start = 0;
+    while (start < output.size()){
+        size_t end = output.find('\n', start);
+        if (end == std::string::npos)
+            end = output.size();
+        std::string line = output.substr(start, end - start);
+        start = end + 1;
+        if (line.compare(0, 5, "Sim: ") != 0)
+            continue;
+        char how[16];
+        double time;
+        int reached, checkpoints;
+        long collisions, spins;
+        if (sscanf(line.c_str(), "Sim: %15s %*[^0-9]%lf s, %d/%d checkpoints, %*f mm travelled, %*d pictures, "
+                   "%ld collisions, %ld spins", how, &time, &reached, &checkpoints, &collisions, &spins) == 6){
+            report->ran         = true;
+            report->finished    = strcmp(how, "finished") == 0;
+            report->time        = time;
+            report->reached     = reached;
+            report->checkpoints = checkpoints;
+            report->collisions  = collisions;
+            report->spins       = spins;
+            continue;
+        }
+        //"Sim: <name> at <time> s", where the name can have spaces.
+        size_t at = line.rfind(" at ");
+        if (at != std::string::npos && line.size() > 2 && line.compare(line.size() - 2, 2, " s") == 0){
+            std::string name = line.substr(5, at - 5);
+            name.erase(name.find_last_not_of(' ') + 1);
+            report->names.push_back(name);
+            report->times.push_back(atof(line.c_str() + at + 4));
+        }
+    }
+}
+
+//Runs program in dir with the settings ("NAME=value") added to the environment, and reads its
+//report. A run still going after wall_limit_s seconds is killed and has no report.
+inline void runSimulator(const std::string &program, const std::vector<std::string> &settings, const char *dir,
+                         double wall_limit_s, SimReport *report){
+    std::vector<std::string> variables;
+    for (char **variable = environ; *variable != NULL; variable++)
+        if (strncmp(*variable, "TUNE_", 5) != 0 && strncmp(*variable, "SIM_", 4) != 0 &&
+            strncmp(*variable, "QUADRANT=", 9) != 0)
+            variables.push_back(*variable);
+    variables.insert(variables.end(), settings.begin(), settings.end());
+    std::vector<char *> env;
+    for (size_t i = 0; i < variables.size(); i++)
+        env.push_back((char *)variables[i].c_str());
+    env.push_back(NULL);
+    clearDirectory(dir);
+
+    report->ran = false;
+    int output[2];
+    if (pipe2(output, O_CLOEXEC) != 0) //Not inherited by the runs other workers start.
+        return;
+    char *argv[] = {(char *)program.c_str(), NULL};
+    pid_t pid = fork();
+    if (pid == 0){
+        //Only async-signal-safe calls until exec.
+        int null = open("/dev/null", O_RDWR);
+        dup2(null, 0);
+        dup2(output[1], 1);
+        dup2(null, 2);
+        if (chdir(dir) == 0)
+            execve(argv[0], argv, env.data());
+        _exit(127);
+    }
+    close(output[1]);
+    if (pid < 0){
+        close(output[0]);
+        return;
+    }
+
+    std::string text;
+    char buffer[4096];
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    struct pollfd readable = {output[0], POLLIN, 0};
+    bool killed = false;
+    while (true){
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ((now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec)/1e9 > wall_limit_s){
+            kill(pid, SIGKILL);
+            killed = true;
+            break;
+        }
+        if (poll(&readable, 1, 1000) <= 0)
+            continue;
+        ssize_t count = read(output[0], buffer, sizeof(buffer));
+        if (count <= 0)
+            break;
+        text.append(buffer, count);
+    }
+    close(output[0]);
+    waitpid(pid, NULL, 0);
+    if (!killed)
+        parseSimReport(text, report);
+}
+
+//Body of a worker thread.
+inline void workerLoop(WorkerPool *pool, int worker){
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    while (true){
+        pool->work.wait(lock, [pool]{ return pool->stopping || pool->next < pool->count; });
+        if (pool->stopping)
+            return;
+        size_t job = pool->next++;
+        lock.unlock();
+        pool->job(job, worker);
+        lock.lock();
+        if (++pool->finished == pool->count)
+            pool->done.notify_all();
+    }
+}
+
+//Starts count workers, each with a scratch directory. Returns false if one can't be made.
+inline bool startWorkers(WorkerPool *pool, int count){
+    pool->count    = 0;
+    pool->next     = 0;
+    pool->finished = 0;
+    pool->stopping = false;
+    for (int i = 0; i < count; i++){
+        char dir[] = "/tmp/sim_runner.XXXXXX";
+        if (mkdtemp(dir) == NULL){
+            perror("mkdtemp");
+            return false;
+        }
+        pool->dirs.push_back(dir);
+    }
+    for (int i = 0; i < count; i++)
+        pool->threads.push_back(std::thread(workerLoop, pool, i));
+    return true;
+}
+
+//Stops the workers and removes their directories.
+inline void stopWorkers(WorkerPool *pool){
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->stopping = true;
+    }
+    pool->work.notify_all();
+    for (size_t i = 0; i < pool->threads.size(); i++)
+        pool->threads[i].join();
+    pool->threads.clear();
+    for (size_t i = 0; i < pool->dirs.size(); i++){
+        clearDirectory(pool->dirs[i].c_str());
+        rmdir(pool->dirs[i].c_str());
+    }
+    pool->dirs.clear();
+}
+
+//Calls job(index, worker) for every index below count on the workers, and waits for all of them.
+inline void runJobs(WorkerPool *pool, size_t count, std::function<void(size_t job, int worker)> job){
+    if (count == 0)
+        return;
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    pool->job      = job;
+    pool->count    = count;
+    pool->next     = 0;
+    pool->finished = 0;
+    pool->work.notify_all();
+    pool->done.wait(lock, [pool]{ return pool->finished == pool->count; });
+    pool->count = 0;
+}
+
+#endif
@@ -0,0 +1,179 @@
+//Converts a trace (TRACE=<file>, trace.h) to Chrome trace JSON, to look at a run on a timeline
+//in chrome://tracing or https://ui.perfetto.dev:
+//
+//  make trace_to_json
+//  TRACE=run.trace ./main_sim
+//  ./trace_to_json run.trace run.json
+//
+//Every thread of the run is a track with its ticks, the events returned by the states and the
+//junction decisions. The states and the quadrants get a track each, and the motor commands,
+//the front sensor and the wall sensors are counters.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../trace.h"
+
+const int PROCESS         = 1;
+const int STATE_TRACK     = 1000; //Thread ids of the tracks that aren't threads.
+const int QUADRANT_TRACK  = 1001;
+
+//Fields
+std::map<std::pair<int, int>, std::string> names;
+FILE   *out;
+bool    first_event = true;
+int64_t start_ns;
+
+//Name of value `id` of events of a type, or the number if the trace has none.
+std::string nameOf(int type, int id){
+    std::map<std::pair<int, int>, std::string>::const_iterator name = names.find(std::make_pair(type, id));
+    if (name != names.end())
+        return name->second;
+    return std::to_string(id);
+}
+
+std::string quoted(const std::string &text){
+    std::string result = "\"";
+    for (size_t i = 0; i < text.size(); i++){
+        if (text[i] == '"' || text[i] == '\\')
+            result += '\\';
+        result += text[i];
+    }
+    return result + "\"";
+}
+
+//Writes an event. args is the JSON of its arguments, or empty.
+void writeEvent(const char *phase, const std::string &name, int tid, int64_t time_ns, const std::string &args){
+    fprintf(out, "%s\n{\"name\":%s,\"ph\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f", first_event ? "" : ",",
+            quoted(name).c_str(), phase, PROCESS, tid, (time_ns - start_ns)/1000.0);
+    if (strcmp(phase, "i") == 0)
+        fprintf(out, ",\"s\":\"t\"");
+    if (!args.empty())
+        fprintf(out, ",\"args\":{%s}", args.c_str());
+    fprintf(out, "}");
+    first_event = false;
+}
+
+void writeTrackName(int tid, const std::string &name){
+    writeEvent("M", "thread_name", tid, start_ns, "\"name\":" + quoted(name));
+}
+
+//Span on a track that lasts until the next one (a state, a quadrant).
+struct Span{
+    bool        open;
+    std::string name;
+};
+
+void nextSpan(Span *span, int tid, const std::string &name, int64_t time_ns){
+    if (span->open)
+        writeEvent("E", span->name, tid, time_ns, "");
+    span->open = true;
+    span->name = name;
+    writeEvent("B", name, tid, time_ns, "");
+}
+
+//==== Main ========================================================================================
+int main(int argc, char *argv[]){
+    if (argc != 2 && argc != 3){
+        fprintf(stderr, "Usage: %s run.trace [run.json]\n", argv[0]);
+        return 1;
+    }
+    std::vector<TraceName>   trace_names;
+    std::vector<TraceThread> threads;
+    if (!loadTrace(argv[1], &trace_names, &threads)){
+        fprintf(stderr, "%s isn't a trace\n", argv[1]);
+        return 1;
+    }
+    for (size_t i = 0; i < trace_names.size(); i++)
+        names[std::make_pair((int)trace_names[i].type, (int)trace_names[i].id)] = trace_names[i].name;
+    start_ns = INT64_MAX;
+    int64_t end_ns = 0;
+    size_t  events = 0;
+    for (size_t t = 0; t < threads.size(); t++){
+        if (!threads[t].events.empty()){
+            start_ns = std::min(start_ns, threads[t].events.front().time_ns);
+            end_ns   = std::max(end_ns, threads[t].events.back().time_ns);
+        }
+        events += threads[t].events.size();
+        if (threads[t].header.dropped > 0)
+            fprintf(stderr, "%s: %u events dropped at the end\n", threads[t].header.name, threads[t].header.dropped);
+    }
+    if (events == 0)
+        start_ns = 0;
+
+    out = argc == 3 ? fopen(argv[2], "w") : stdout;
+    if (out == NULL){
+        fprintf(stderr, "Can't create %s\n", argv[2]);
+        return 1;
+    }
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    writeTrackName(STATE_TRACK, "states");
+    writeTrackName(QUADRANT_TRACK, "quadrants");
+    Span state    = {false, ""};
+    Span quadrant = {false, ""};
+    for (size_t t = 0; t < threads.size(); t++){
+        int tid = (int)t + 1;
+        writeTrackName(tid, threads[t].header.name);
+        bool in_tick = false;
+        for (size_t i = 0; i < threads[t].events.size(); i++){
+            const TraceEvent *event = &threads[t].events[i];
+            char args[96];
+            switch (event->type){
+                case TRACE_TICK_BEGIN:
+                    snprintf(args, sizeof(args), "\"tick\":%d", event->b);
+                    writeEvent("B", "tick", tid, event->time_ns, args);
+                    in_tick = true;
+                    break;
+                case TRACE_TICK_END:
+                    if (in_tick)
+                        writeEvent("E", "tick", tid, event->time_ns, "");
+                    in_tick = false;
+                    break;
+                case TRACE_STATE:
+                    nextSpan(&state, STATE_TRACK, nameOf(TRACE_STATE, event->a), event->time_ns);
+                    break;
+                case TRACE_QUADRANT:
+                    nextSpan(&quadrant, QUADRANT_TRACK, event->a < 1 ? "TEST" : "Q" + std::to_string(event->a),
+                             event->time_ns);
+                    break;
+                case TRACE_EVENT:
+                    writeEvent("i", nameOf(TRACE_EVENT, event->a), tid, event->time_ns,
+                               "\"state\":" + quoted(nameOf(TRACE_STATE, event->b)));
+                    break;
+                case TRACE_JUNCTION:
+                    snprintf(args, sizeof(args), "\"white pixels\":%d", event->b);
+                    writeEvent("i", "junction: " + nameOf(TRACE_JUNCTION, event->a), tid, event->time_ns, args);
+                    break;
+                case TRACE_MOTOR:
+                    snprintf(args, sizeof(args), "\"left\":%d,\"right\":%d", event->a, event->b);
+                    writeEvent("C", "motor", tid, event->time_ns, args);
+                    break;
+                case TRACE_SENSORS:
+                    snprintf(args, sizeof(args), "\"front\":%d", event->a);
+                    writeEvent("C", "front sensor", tid, event->time_ns, args);
+                    snprintf(args, sizeof(args), "\"left\":%d,\"right\":%d", event->b & 1, (event->b >> 1) & 1);
+                    writeEvent("C", "walls", tid, event->time_ns, args);
+                    break;
+                default:
+                    break;
+            }
+        }
+        if (in_tick)
+            writeEvent("E", "tick", tid, end_ns, "");
+    }
+    if (state.open)
+        writeEvent("E", state.name, STATE_TRACK, end_ns, "");
+    if (quadrant.open)
+        writeEvent("E", quadrant.name, QUADRANT_TRACK, end_ns, "");
+    fprintf(out, "\n]}\n");
+    if (out != stdout && fclose(out) != 0){
+        fprintf(stderr, "Can't write %s\n", argv[2]);
+        return 1;
+    }
+    fprintf(stderr, "%zu events from %zu threads, %.3f s\n", events, threads.size(), (end_ns - start_ns)/1e9);
+    return 0;
+}
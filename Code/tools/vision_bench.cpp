@@ -0,0 +1,374 @@
+//Microbenchmarks of the vision and sensor functions of main.cpp:
+//
+//  make vision_bench
+//  ./vision_bench                      (synthetic frames)
+//  ./vision_bench -f q2.ppm -f q3.ppm  (recorded 320x240 binary PPM frames)
+//  ./vision_bench -b bench_baseline.txt
+//
+//main.cpp is compiled in as it is, with the HAL pointed at a backend that serves pixels from
+//frames in memory and ADC readings from a fixed sequence, so only the cost of the functions
+//themselves (and of the get_pixel() calls they make) is measured. Each benchmark is timed in
+//several batches of about BATCH_MS; the fastest batch gives ns/call, as it is the one least
+//disturbed by the rest of the system. Pixels/s counts the get_pixel() calls. Cache misses
+//come from perf_event_open(), where the kernel allows it.
+//
+//With -b, the results are compared with the baseline file: a benchmark more than -t percent
+//(default 15) and more than MIN_SLOWDOWN_NS slower than its baseline fails the run with exit
+//status 1. If the file doesn't
+//exist it is written, and -u rewrites it.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#define main robot_main
+#include "../main.cpp"
+#undef main
+
+const int    FRAME_BYTES     = PIC_WIDTH*PIC_HEIGHT*3;
+const double BATCH_MS        = 20;
+const int    BATCHES         = 9;
+const int    ADC_SAMPLES     = 64;
+const double MIN_SLOWDOWN_NS = 5; //Smaller changes are timer noise, whatever the percentage.
+
+//HAL backend with the frames and ADC readings in memory.
+class BenchBackend : public HalBackend{
+public:
+    std::vector<std::vector<unsigned char>> frames;
+    size_t               current;
+    const unsigned char *pixels;      //Frame get_pixel() reads.
+    int                  adc[ADC_SAMPLES];
+    int                  adc_next;
+    long                 pixel_reads;
+    long                 adc_reads;
+
+    BenchBackend(){
+        current     = 0;
+        pixels      = NULL;
+        adc_next    = 0;
+        pixel_reads = 0;
+        adc_reads   = 0;
+        //Front sensor creeping up to a wall, with some noise.
+        for (int i = 0; i < ADC_SAMPLES; i++)
+            adc[i] = 120 + 3*i + (int)((i*7919u)%13) - 6;
+    }
+
+    void nextFrame(){
+        current = (current + 1)%frames.size();
+        pixels  = frames[current].data();
+    }
+
+    int take_picture(){
+        nextFrame();
+        return 0;
+    }
+
+    char get_pixel(int row, int col, int color){
+        pixel_reads++;
+        if (row < 0 || row >= PIC_HEIGHT || col < 0 || col >= PIC_WIDTH)
+            return 0;
+        const unsigned char *pixel = pixels + (row*PIC_WIDTH + col)*3;
+        if (color == 3)
+            return (char)((pixel[0] + pixel[1] + pixel[2])/3);
+        return (char)pixel[color];
+    }
+
+    int set_motor(int, int){ return 0; }
+    int read_digital(int){ return 1; }
+
+    int read_analog(int){
+        adc_reads++;
+        int reading = adc[adc_next];
+        adc_next = (adc_next + 1)%ADC_SAMPLES;
+        return reading;
+    }
+
+    int sleep1(int, int){ return 0; }
+};
+
+//Structure to store the result of a benchmark.
+struct BenchResult{
+    std::string name;
+    double      ns_per_call;
+    double      pixels_per_s;
+    double      misses_per_call; //Negative if not available.
+};
+
+//Fields
+BenchBackend  bench_backend;
+volatile long sink;         //Keeps the compiler from dropping the results.
+int           perf_fd = -1;
+
+//==== Frames ======================================================================================
+
+//Paints a pixel.
+void setPixel(std::vector<unsigned char> *frame, int row, int col, int r, int g, int b){
+    if (row < 0 || row >= PIC_HEIGHT || col < 0 || col >= PIC_WIDTH)
+        return;
+    unsigned char *pixel = frame->data() + (row*PIC_WIDTH + col)*3;
+    pixel[0] = r;
+    pixel[1] = g;
+    pixel[2] = b;
+}
+
+//Frame of the dark floor with some sensor noise.
+std::vector<unsigned char> blankFrame(unsigned seed){
+    std::vector<unsigned char> frame(FRAME_BYTES);
+    for (int i = 0; i < FRAME_BYTES; i++){
+        seed = seed*1103515245u + 12345u;
+        frame[i] = 30 + (seed >> 16)%20;
+    }
+    return frame;
+}
+
+//Track of half-width `half` whose centre is at centre(row).
+template <typename Centre>
+void paintTrack(std::vector<unsigned char> *frame, int half, Centre centre){
+    for (int row = 0; row < PIC_HEIGHT; row++){
+        int middle = centre(row);
+        for (int col = middle - half; col <= middle + half; col++)
+            setPixel(frame, row, col, 220, 220, 215);
+    }
+}
+
+//The situations the robot sees most: straight track, curve, junction, red line, speckled track.
+void makeSyntheticFrames(std::vector<std::vector<unsigned char>> *frames){
+    std::vector<unsigned char> straight = blankFrame(1);
+    paintTrack(&straight, 20, [](int){ return PIC_WIDTH/2 + 10; });
+    frames->push_back(straight);
+
+    std::vector<unsigned char> curve = blankFrame(2);
+    paintTrack(&curve, 20, [](int row){ return PIC_WIDTH/2 + (PIC_HEIGHT - row)*(PIC_HEIGHT - row)/150; });
+    frames->push_back(curve);
+
+    std::vector<unsigned char> junction = blankFrame(3);
+    paintTrack(&junction, 20, [](int){ return PIC_WIDTH/2; });
+    for (int row = ROW - 25; row <= ROW + 25; row++)
+        for (int col = 0; col < PIC_WIDTH; col++)
+            setPixel(&junction, row, col, 220, 220, 215);
+    frames->push_back(junction);
+
+    std::vector<unsigned char> red = blankFrame(4);
+    for (int row = ROW - 15; row <= ROW + 15; row++)
+        for (int col = 0; col < PIC_WIDTH; col++)
+            setPixel(&red, row, col, 200, 40, 40);
+    frames->push_back(red);
+
+    std::vector<unsigned char> speckled = straight;
+    unsigned seed = 5;
+    for (int row = 0; row < PIC_HEIGHT; row++){
+        for (int col = 0; col < PIC_WIDTH; col++){
+            seed = seed*1103515245u + 12345u;
+            if ((seed >> 16)%16 == 0)
+                setPixel(&speckled, row, col, 40, 40, 40);
+        }
+    }
+    frames->push_back(speckled);
+}
+
+//Reads a 320x240 binary PPM (P6, maxval 255).
+bool loadFrame(const char *file, std::vector<unsigned char> *frame){
+    FILE *in = fopen(file, "rb");
+    if (in == NULL)
+        return false;
+    int width, height, maxval;
+    bool ok = fscanf(in, "P6 %d %d %d", &width, &height, &maxval) == 3 && width == PIC_WIDTH &&
+              height == PIC_HEIGHT && maxval == 255 && fgetc(in) != EOF;
+    if (ok){
+        frame->resize(FRAME_BYTES);
+        ok = fread(frame->data(), 1, FRAME_BYTES, in) == (size_t)FRAME_BYTES;
+    }
+    fclose(in);
+    return ok;
+}
+
+//==== Measuring ===================================================================================
+
+//Opens a counter of the cache misses of this thread. Returns -1 if perf events aren't available.
+int openCacheMissCounter(){
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type           = PERF_TYPE_HARDWARE;
+    attr.size           = sizeof(attr);
+    attr.config         = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled       = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+double nowSeconds(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec/1e9;
+}
+
+//Times `call`, which does one call of the function and moves to the next frame when it needs to.
+template <typename Call>
+BenchResult runBenchmark(const char *name, Call call){
+    //Number of calls in a batch.
+    long calls = 1;
+    while (true){
+        double start = nowSeconds();
+        for (long i = 0; i < calls; i++)
+            call();
+        if ((nowSeconds() - start)*1000 >= BATCH_MS/4)
+            break;
+        calls *= 2;
+    }
+    calls *= 4;
+
+    std::vector<double> batch_ns;
+    long pixels = 0;
+    double total_s = 0;
+    long long misses = 0;
+    for (int batch = 0; batch < BATCHES; batch++){
+        long reads = bench_backend.pixel_reads;
+        if (perf_fd >= 0){
+            ioctl(perf_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+        double start = nowSeconds();
+        for (long i = 0; i < calls; i++)
+            call();
+        double elapsed = nowSeconds() - start;
+        if (perf_fd >= 0){
+            ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+            long long count = 0;
+            if (read(perf_fd, &count, sizeof(count)) == sizeof(count))
+                misses += count;
+        }
+        pixels  += bench_backend.pixel_reads - reads;
+        total_s += elapsed;
+        batch_ns.push_back(elapsed*1e9/calls);
+    }
+    std::sort(batch_ns.begin(), batch_ns.end());
+    BenchResult result;
+    result.name            = name;
+    result.ns_per_call     = batch_ns[0];
+    result.pixels_per_s    = pixels/total_s;
+    result.misses_per_call = perf_fd >= 0 ? (double)misses/(calls*BATCHES) : -1;
+    return result;
+}
+
+//==== Baseline ====================================================================================
+
+bool readBaseline(const char *file, std::vector<BenchResult> *baseline){
+    FILE *in = fopen(file, "r");
+    if (in == NULL)
+        return false;
+    char name[64];
+    double ns;
+    while (fscanf(in, "%63s %lf", name, &ns) == 2){
+        BenchResult result = {name, ns, 0, -1};
+        baseline->push_back(result);
+    }
+    fclose(in);
+    return true;
+}
+
+bool writeBaseline(const char *file, const std::vector<BenchResult> &results){
+    FILE *out = fopen(file, "w");
+    if (out == NULL)
+        return false;
+    for (size_t i = 0; i < results.size(); i++)
+        fprintf(out, "%s %.2f\n", results[i].name.c_str(), results[i].ns_per_call);
+    fclose(out);
+    return true;
+}
+
+//==== Main ========================================================================================
+int main(int argc, char *argv[]){
+    const char *baseline_file = NULL;
+    double      tolerance     = 15;
+    bool        update        = false;
+    int option;
+    while ((option = getopt(argc, argv, "f:b:t:u")) != -1){
+        switch (option){
+            case 'f': {
+                std::vector<unsigned char> frame;
+                if (!loadFrame(optarg, &frame)){
+                    fprintf(stderr, "%s is not a %dx%d binary PPM\n", optarg, PIC_WIDTH, PIC_HEIGHT);
+                    return 1;
+                }
+                bench_backend.frames.push_back(frame);
+                break;
+            }
+            case 'b': baseline_file = optarg; break;
+            case 't': tolerance     = atof(optarg); break;
+            case 'u': update        = true; break;
+            default:
+                fprintf(stderr, "Usage: %s [-f frame.ppm]... [-b baseline] [-t percent] [-u]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (bench_backend.frames.empty())
+        makeSyntheticFrames(&bench_backend.frames);
+    bench_backend.nextFrame();
+    setHalBackend(&bench_backend);
+    setLumThreshold();
+    perf_fd = openCacheMissCounter();
+
+    std::vector<BenchResult> results;
+    results.push_back(runBenchmark("getHorizontalData", []{
+        bench_backend.nextFrame();
+        sink = getHorizontalData(ROW).total_white_pixels;
+    }));
+    results.push_back(runBenchmark("verticalWhitePix", []{
+        bench_backend.nextFrame();
+        sink = verticalWhitePix(PIC_WIDTH - 1);
+    }));
+    results.push_back(runBenchmark("isRedLine", []{
+        bench_backend.nextFrame();
+        sink = isRedLine();
+    }));
+    results.push_back(runBenchmark("setLumThreshold", []{
+        setLumThreshold();
+        sink = lum_threshold;
+    }));
+    results.push_back(runBenchmark("readAnalogSensor", []{
+        sink = readAnalogSensor(F_SENSOR, 5).max;
+    }));
+
+    std::vector<BenchResult> baseline;
+    bool have_baseline = baseline_file != NULL && !update && readBaseline(baseline_file, &baseline);
+    bool failed = false;
+    printf("%zu frames, %s\n", bench_backend.frames.size(),
+           perf_fd >= 0 ? "cache misses from perf events" : "no perf events (cache misses not counted)");
+    printf("%-18s %10s %14s %13s %10s\n", "", "ns/call", "pixels/s", "misses/call", "baseline");
+    for (size_t i = 0; i < results.size(); i++){
+        const BenchResult *result = &results[i];
+        char misses[16] = "-", change[32] = "";
+        if (result->misses_per_call >= 0)
+            snprintf(misses, sizeof(misses), "%.2f", result->misses_per_call);
+        for (size_t j = 0; j < baseline.size(); j++){
+            if (baseline[j].name != result->name)
+                continue;
+            double percent = (result->ns_per_call/baseline[j].ns_per_call - 1)*100;
+            bool   slower  = percent > tolerance && result->ns_per_call - baseline[j].ns_per_call > MIN_SLOWDOWN_NS;
+            snprintf(change, sizeof(change), "%+.1f%%%s", percent, slower ? " SLOWER" : "");
+            failed = failed || slower;
+        }
+        printf("%-18s %10.1f %14.0f %13s %10s\n", result->name.c_str(), result->ns_per_call, result->pixels_per_s,
+               misses, change);
+    }
+    if (baseline_file != NULL && !have_baseline){
+        if (!writeBaseline(baseline_file, results)){
+            fprintf(stderr, "Can't write %s\n", baseline_file);
+            return 1;
+        }
+        printf("Baseline written to %s\n", baseline_file);
+    }
+    if (failed){
+        printf("Slower than the baseline by more than %.0f%%\n", tolerance);
+        return 1;
+    }
+    return 0;
+}
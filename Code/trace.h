@@ -0,0 +1,233 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+//Trace of a run: compact binary events (state changes, quadrants, junction decisions, motor
+//commands, sensor readings, ticks) to look at the whole run on a timeline, without printf()
+//in the loop. tools/trace_to_json.cpp turns a trace into Chrome trace JSON, which
+//chrome://tracing and https://ui.perfetto.dev open.
+//
+//Every thread writes to its own buffer, which it allocates the first time; only registering
+//it takes a lock. Adding an event is a clock_gettime() from the vDSO, a store and a release
+//of the count, so a buffer can be read while it is written. A buffer holds TRACE_CAPACITY
+//events (8 MB, over 30 minutes of the control loop); later ones are counted as dropped.
+//Until openTrace() is called tracing is off and an event costs a test.
+//
+//Times are from CLOCK_MONOTONIC, not from clock.h, so tracing doesn't go into the journal.
+//On the simulator they are the real time the simulation took, not the simulated time.
+
+const char   TRACE_MAGIC[8] = {'T', 'R', 'A', 'C', 'E', '0', '0', '1'};
+const int    TRACE_VERSION  = 1;
+const size_t TRACE_CAPACITY = 1 << 19;
+
+//Types of event.
+enum TraceType{
+    TRACE_TICK_BEGIN, //b: tick number.
+    TRACE_TICK_END,
+    TRACE_STATE,      //a: new state, b: previous state (-1 at the start).
+    TRACE_EVENT,      //a: event returned by a state, b: the state.
+    TRACE_QUADRANT,   //a: quadrant.
+    TRACE_JUNCTION,   //a: decision, b: white pixels of the row.
+    TRACE_MOTOR,      //a: left duty cycle, b: right duty cycle.
+    TRACE_SENSORS,    //a: front reading, b: left wall | right wall << 1.
+    TRACE_TYPES
+};
+
+//Structure to store an event.
+struct TraceEvent{
+    int64_t time_ns;
+    uint8_t type;
+    uint8_t reserved;
+    int16_t a;
+    int32_t b;
+};
+
+//Structure to store the name of a value of an event (a state, an event, a decision).
+struct TraceName{
+    uint8_t  type;
+    uint8_t  reserved;
+    uint16_t id;
+    char     name[28];
+};
+
+//Structures at the start of a trace file and of every thread in it.
+struct TraceHeader{
+    char     magic[8];
+    uint32_t version;
+    uint32_t threads;
+    uint32_t names;
+    uint32_t reserved;
+};
+
+struct TraceThreadHeader{
+    char     name[16];
+    uint32_t events;
+    uint32_t dropped;
+};
+
+//Structure to store the buffer of a thread.
+struct TraceBuffer{
+    char                  name[16];
+    TraceEvent           *events;
+    std::atomic<uint32_t> count;
+    uint32_t              dropped;
+};
+
+//Structure to store the state shared by all threads.
+struct Tracer{
+    std::mutex                 mutex;   //Only taken to add a thread or a name and to write the trace.
+    std::vector<TraceBuffer *> buffers;
+    std::vector<TraceName>     names;
+    std::atomic<bool>          enabled;
+};
+
+inline Tracer &tracer(){
+    static Tracer instance;
+    return instance;
+}
+
+inline TraceBuffer *&traceBufferSlot(){
+    static thread_local TraceBuffer *buffer = NULL;
+    return buffer;
+}
+
+//Names the calling thread in the trace. Threads that don't are named after their number.
+inline TraceBuffer *traceThread(const char *name = NULL){
+    TraceBuffer *&buffer = traceBufferSlot();
+    if (buffer == NULL){
+        buffer          = new TraceBuffer();
+        buffer->events  = new TraceEvent[TRACE_CAPACITY];
+        buffer->dropped = 0;
+        buffer->count.store(0, std::memory_order_relaxed);
+        Tracer &state = tracer();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        snprintf(buffer->name, sizeof(buffer->name), "thread %zu", state.buffers.size());
+        state.buffers.push_back(buffer);
+    }
+    if (name != NULL)
+        snprintf(buffer->name, sizeof(buffer->name), "%s", name);
+    return buffer;
+}
+
+//Gives a name to value `id` of the events of a type, for the converter.
+inline void traceName(int type, int id, const char *name){
+    TraceName entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.type = (uint8_t)type;
+    entry.id   = (uint16_t)id;
+    snprintf(entry.name, sizeof(entry.name), "%s", name);
+    Tracer &state = tracer();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.names.push_back(entry);
+}
+
+inline bool tracing(){
+    return tracer().enabled.load(std::memory_order_relaxed);
+}
+
+//Adds an event to the trace of the calling thread.
+inline void trace(int type, int a, int b = 0){
+    if (!tracing())
+        return;
+    TraceBuffer *buffer = traceBufferSlot();
+    if (buffer == NULL)
+        buffer = traceThread();
+    uint32_t index = buffer->count.load(std::memory_order_relaxed);
+    if (index >= TRACE_CAPACITY){
+        buffer->dropped++;
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    TraceEvent *event = &buffer->events[index];
+    event->time_ns = (int64_t)now.tv_sec*1000000000LL + now.tv_nsec;
+    event->type    = (uint8_t)type;
+    event->a       = (int16_t)a;
+    event->b       = b;
+    buffer->count.store(index + 1, std::memory_order_release);
+}
+
+//Starts tracing.
+inline void openTrace(){
+    tracer().enabled.store(true, std::memory_order_relaxed);
+}
+
+//Stops tracing and writes the trace of every thread to file. Returns false, after printing
+//why, if it can't.
+inline bool closeTrace(const char *file){
+    Tracer &state = tracer();
+    state.enabled.store(false, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(state.mutex);
+    FILE *out = fopen(file, "wb");
+    if (out == NULL){
+        fprintf(stderr, "Trace: can't create %s (%s)\n", file, strerror(errno));
+        return false;
+    }
+    TraceHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    header.version = TRACE_VERSION;
+    header.threads = state.buffers.size();
+    header.names   = state.names.size();
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              fwrite(state.names.data(), sizeof(TraceName), state.names.size(), out) == state.names.size();
+    size_t events = 0, dropped = 0;
+    for (size_t i = 0; i < state.buffers.size() && ok; i++){
+        TraceBuffer      *buffer = state.buffers[i];
+        TraceThreadHeader thread;
+        memset(&thread, 0, sizeof(thread));
+        memcpy(thread.name, buffer->name, sizeof(thread.name));
+        thread.events  = buffer->count.load(std::memory_order_acquire);
+        thread.dropped = buffer->dropped;
+        ok = fwrite(&thread, sizeof(thread), 1, out) == 1 &&
+             fwrite(buffer->events, sizeof(TraceEvent), thread.events, out) == thread.events;
+        events  += thread.events;
+        dropped += thread.dropped;
+    }
+    ok = fclose(out) == 0 && ok;
+    if (!ok)
+        fprintf(stderr, "Trace: can't write %s\n", file);
+    printf("Trace: %zu events from %zu threads, %zu dropped\n", events, state.buffers.size(), dropped);
+    return ok;
+}
+
+//Structure to store a trace read back.
+struct TraceThread{
+    TraceThreadHeader       header;
+    std::vector<TraceEvent> events;
+};
+
+//Reads a trace. Returns false if the file isn't one.
+inline bool loadTrace(const char *file, std::vector<TraceName> *names, std::vector<TraceThread> *threads){
+    FILE *in = fopen(file, "rb");
+    if (in == NULL)
+        return false;
+    TraceHeader header;
+    bool ok = fread(&header, sizeof(header), 1, in) == 1 &&
+              memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0 && header.version == (uint32_t)TRACE_VERSION;
+    if (ok){
+        names->resize(header.names);
+        ok = fread(names->data(), sizeof(TraceName), header.names, in) == header.names;
+    }
+    for (uint32_t i = 0; i < header.threads && ok; i++){
+        TraceThread thread;
+        ok = fread(&thread.header, sizeof(thread.header), 1, in) == 1;
+        if (!ok)
+            break;
+        thread.events.resize(thread.header.events);
+        ok = fread(thread.events.data(), sizeof(TraceEvent), thread.header.events, in) == thread.header.events;
+        threads->push_back(thread);
+    }
+    fclose(in);
+    return ok;
+}
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef TUNING_H
+#define TUNING_H
+
+#include <stdlib.h>
+
+//Constants that tools/autotune searches over are declared as
+//    const int KP = TUNABLE(KP, 30);
+//On the robot TUNABLE(name, value) is just the value. Building with
+//    -DTUNED_CONSTANTS='"tuned_constants.h"'
+//uses the TUNED_<name> values of a header written by the tuner instead, so that header must
+//define every tunable. Simulator builds (-DHAL_SIM) can also be overridden at startup by
+//TUNE_<name> in the environment, which lets the tuner try values without recompiling.
+
+#ifdef TUNED_CONSTANTS
+#include TUNED_CONSTANTS
+#define TUNED_VALUE(name, value) TUNED_##name
+#else
+#define TUNED_VALUE(name, value) (value)
+#endif
+
+#ifdef HAL_SIM
+#define TUNABLE(name, value) tunableFromEnv("TUNE_" #name, TUNED_VALUE(name, value))
+#else
+#define TUNABLE(name, value) TUNED_VALUE(name, value)
+#endif
+
+//Returns the environment variable `name` if it is set, or `value`.
+template <typename T>
+inline T tunableFromEnv(const char *name, T value){
+    const char *text = getenv(name);
+    return text != NULL ? (T)atof(text) : value;
+}
+
+#endif